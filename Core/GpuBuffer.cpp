@@ -26,7 +26,7 @@ void GpuBuffer::Create( const std::wstring& name, uint32_t NumElements, uint32_t
 
     m_ElementCount = NumElements;
     m_ElementSize = ElementSize;
-    m_BufferSize = NumElements * ElementSize;
+    m_BufferSize = (size_t)NumElements * ElementSize;
 
     D3D12_RESOURCE_DESC ResourceDesc = DescribeBuffer();
 
@@ -58,12 +58,12 @@ void GpuBuffer::Create( const std::wstring& name, uint32_t NumElements, uint32_t
 }
 
 // Sub-Allocate a buffer out of a pre-allocated heap.  If initial data is provided, it will be copied into the buffer using the default command context.
-void GpuBuffer::CreatePlaced(const std::wstring& name, ID3D12Heap* pBackingHeap, uint32_t HeapOffset, uint32_t NumElements, uint32_t ElementSize,
+void GpuBuffer::CreatePlaced(const std::wstring& name, ID3D12Heap* pBackingHeap, uint64_t HeapOffset, uint32_t NumElements, uint32_t ElementSize,
     const void* initialData)
 {
     m_ElementCount = NumElements;
     m_ElementSize = ElementSize;
-    m_BufferSize = NumElements * ElementSize;
+    m_BufferSize = (size_t)NumElements * ElementSize;
 
     D3D12_RESOURCE_DESC ResourceDesc = DescribeBuffer();
 
@@ -92,9 +92,9 @@ void GpuBuffer::Create(const std::wstring& name, uint32_t NumElements, uint32_t
     Create(name, NumElements, ElementSize, initialData);
 }
 
-void GpuBuffer::Update(uint32_t startingAddress, uint32_t NumElements, const void* data)
+void GpuBuffer::Update(size_t startingAddress, uint32_t NumElements, const void* data)
 {
-	CommandContext::InitializeBuffer(*this, data, NumElements * m_ElementSize, startingAddress);
+	CommandContext::InitializeBuffer(*this, data, (size_t)NumElements * m_ElementSize, startingAddress);
 }
 
 D3D12_CPU_DESCRIPTOR_HANDLE GpuBuffer::CreateConstantBufferView(uint32_t Offset, uint32_t Size) const
@@ -33,10 +33,10 @@ public:
         EsramAllocator& Allocator, const void* initialData = nullptr);
 
     // Sub-Allocate a buffer out of a pre-allocated heap.  If initial data is provided, it will be copied into the buffer using the default command context.
-    void CreatePlaced(const std::wstring& name, ID3D12Heap* pBackingHeap, uint32_t HeapOffset, uint32_t NumElements, uint32_t ElementSize,
+    void CreatePlaced(const std::wstring& name, ID3D12Heap* pBackingHeap, uint64_t HeapOffset, uint32_t NumElements, uint32_t ElementSize,
         const void* initialData = nullptr);
 
-	void Update(uint32_t startingAddress, uint32_t NumElements, const void* data);
+	void Update(size_t startingAddress, uint32_t NumElements, const void* data);
 
     const D3D12_CPU_DESCRIPTOR_HANDLE& GetUAV(void) const { return m_UAV; }
     const D3D12_CPU_DESCRIPTOR_HANDLE& GetSRV(void) const { return m_SRV; }
@@ -0,0 +1,341 @@
+// LGH build benchmark: builds hierarchies of synthetic (or captured) VPL sets with CPULGHBuilder and
+// writes the time, bytes touched and VPLs/s of every build stage as JSON.
+//
+// LGHBench [options]
+//   --sizes 100000,1000000,10000000,50000000   VPL counts of the synthetic sets
+//   --shapes uniform,planes,clusters           synthetic distributions
+//   --vpls <file>                              also runs a captured set (Application/LGH/Capture VPLs)
+//   --source s1|vpls|both                      build source, default both
+//   --threads <n>                              build threads, 0 (default) uses all hardware threads
+//   --repeats <n>                              builds per run, the fastest is reported, default 3
+//   --stream-from <n>                          sets of n VPLs or more use the streamed build, default 20000000
+//   --batch <n>                                VPLs per batch of a streamed build, default 4194304
+//   --no-sort, --no-tiled-gather               turn off the Morton sort or the tiled gather
+//   --tile-sizes 8,6                           gather tile sizes of the S1 builds, each one is a run. The level sizes
+//                                              are compared against the first, 6 does not divide the levels
+//   --out <file>                               JSON output, default stdout
+
+#include "CPULGHBuilder.h"
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+std::uniform_real_distribution<float> distribution(0.f, 1.f);
+
+struct BenchOptions
+{
+	std::vector<long long> sizes = { 100000, 1000000, 10000000, 50000000 };
+	std::vector<std::string> shapes = { "uniform", "planes", "clusters" };
+	std::string capturePath;
+	bool isFromS1 = true;
+	bool isFromVPLs = true;
+	int numThreads = 0;
+	int numRepeats = 3;
+	long long streamFrom = 20000000;
+	int batchSize = 1 << 22;
+	bool isVPLSortEnabled = true;
+	bool isTiledGatherEnabled = true;
+	std::vector<int> tileSizes = { CPULGHBuilder::GATHER_TILE_SIZE, 6 };
+	std::string outPath;
+};
+
+static std::vector<std::string> SplitList(const char* list)
+{
+	std::vector<std::string> items;
+	std::string item;
+	for (const char* c = list; ; c++)
+	{
+		if (*c == ',' || *c == 0)
+		{
+			if (!item.empty()) items.push_back(item);
+			item.clear();
+			if (*c == 0) break;
+		}
+		else item += *c;
+	}
+	return items;
+}
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool hasValue = true;
+		if (arg == "--no-sort") { options.isVPLSortEnabled = false; hasValue = false; }
+		else if (arg == "--no-tiled-gather") { options.isTiledGatherEnabled = false; hasValue = false; }
+		else if (!value) return false;
+		else if (arg == "--sizes")
+		{
+			options.sizes.clear();
+			for (const std::string& size : SplitList(value)) options.sizes.push_back(atoll(size.c_str()));
+		}
+		else if (arg == "--shapes") options.shapes = SplitList(value);
+		else if (arg == "--vpls") options.capturePath = value;
+		else if (arg == "--source")
+		{
+			options.isFromS1 = strcmp(value, "vpls") != 0;
+			options.isFromVPLs = strcmp(value, "s1") != 0;
+		}
+		else if (arg == "--threads") options.numThreads = atoi(value);
+		else if (arg == "--repeats") options.numRepeats = std::max(1, atoi(value));
+		else if (arg == "--stream-from") options.streamFrom = atoll(value);
+		else if (arg == "--batch") options.batchSize = std::max(1, atoi(value));
+		else if (arg == "--tile-sizes")
+		{
+			options.tileSizes.clear();
+			for (const std::string& size : SplitList(value)) options.tileSizes.push_back(std::max(1, atoi(size.c_str())));
+			if (options.tileSizes.empty()) return false;
+		}
+		else if (arg == "--out") options.outPath = value;
+		else return false;
+		if (hasValue) i++;
+	}
+	return true;
+}
+
+// uniform float in [0, 1) that only depends on the VPL index and dimension, so that every batch of a
+// streamed build and every repeat sees the same set
+static float RandomOfVPL(long long index, int dim)
+{
+	uint32_t x = (uint32_t)(index * 16 + dim) ^ (uint32_t)(index >> 28) * 0x9e3779b9u;
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return (x >> 8) * (1.f / 16777216.f);
+}
+
+// the synthetic sets fill a 10 x 10 x 10 box
+static CPUVPLGeneratorSource::Generator GetShapeGenerator(const std::string& shape)
+{
+	const float extent = 10.f;
+	auto randomDirection = [](long long index, int dim)
+	{
+		float z = 1.f - 2.f * RandomOfVPL(index, dim);
+		float phi = 2.f * PI * RandomOfVPL(index, dim + 1);
+		float r = std::sqrt(std::max(0.f, 1.f - z * z));
+		return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+	};
+	auto randomColor = [](long long index)
+	{
+		return glm::vec4(RandomOfVPL(index, 8), RandomOfVPL(index, 9), RandomOfVPL(index, 10), 0.f);
+	};
+
+	if (shape == "planes")
+	{
+		// floor, ceiling and two walls, each 0.1% of the extent thick
+		return [=](long long first, int count, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors)
+		{
+			const glm::vec3 planeNormals[4] = { glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) };
+			for (int i = 0; i < count; i++)
+			{
+				long long index = first + i;
+				int plane = (int)(index % 4);
+				glm::vec3 p(RandomOfVPL(index, 0), RandomOfVPL(index, 1), RandomOfVPL(index, 2));
+				float depth = 1e-3f * RandomOfVPL(index, 3);
+				if (plane == 0) p.y = depth;
+				else if (plane == 1) p.y = 1.f - depth;
+				else if (plane == 2) p.x = depth;
+				else p.z = depth;
+				positions[i] = glm::vec4(p * extent, 0.f);
+				normals[i] = glm::vec4(planeNormals[plane], 0.f);
+				colors[i] = randomColor(index);
+			}
+		};
+	}
+	if (shape == "clusters")
+	{
+		// 6 tight clusters (standard deviation 1% of the extent) holding 95% of the VPLs, the rest uniform
+		return [=](long long first, int count, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors)
+		{
+			const glm::vec3 centers[6] = { glm::vec3(0.2f, 0.1f, 0.3f), glm::vec3(0.8f, 0.5f, 0.2f), glm::vec3(0.5f, 0.9f, 0.7f),
+				glm::vec3(0.1f, 0.6f, 0.9f), glm::vec3(0.7f, 0.2f, 0.8f), glm::vec3(0.45f, 0.45f, 0.5f) };
+			for (int i = 0; i < count; i++)
+			{
+				long long index = first + i;
+				glm::vec3 p(RandomOfVPL(index, 0), RandomOfVPL(index, 1), RandomOfVPL(index, 2));
+				if (RandomOfVPL(index, 3) < 0.95f)
+				{
+					// sum of 4 uniforms is close to a gaussian with variance 1/3
+					glm::vec3 g(0.f);
+					for (int k = 0; k < 4; k++) g += glm::vec3(RandomOfVPL(index, 11 + k), RandomOfVPL(index, 15 - k), RandomOfVPL(index, k)) - 0.5f;
+					p = glm::clamp(centers[index % 6] + g * (0.01f * std::sqrt(3.f)), glm::vec3(0.f), glm::vec3(1.f));
+				}
+				positions[i] = glm::vec4(p * extent, 0.f);
+				normals[i] = glm::vec4(randomDirection(index, 4), 0.f);
+				colors[i] = randomColor(index);
+			}
+		};
+	}
+	if (shape != "uniform") return nullptr;
+	return [=](long long first, int count, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			long long index = first + i;
+			positions[i] = glm::vec4(RandomOfVPL(index, 0) * extent, RandomOfVPL(index, 1) * extent, RandomOfVPL(index, 2) * extent, 0.f);
+			normals[i] = glm::vec4(randomDirection(index, 4), 0.f);
+			colors[i] = randomColor(index);
+		}
+	};
+}
+
+static void WriteRun(FILE* out, bool isFirst, const std::string& shape, long long numVPLs, bool isFromS1, bool isStreamed,
+	const BenchOptions& options, const CPULGHBuilder& builder, double totalMs)
+{
+	double vplsPerMs = (double)numVPLs;
+	uint64_t totalBytes = 0;
+	for (const CPULGHStageTiming& timing : builder.stageTimings) totalBytes += timing.bytes;
+
+	fprintf(out, "%s\n    {\n", isFirst ? "" : ",");
+	fprintf(out, "      \"shape\": \"%s\",\n", shape.c_str());
+	fprintf(out, "      \"numVPLs\": %lld,\n", numVPLs);
+	fprintf(out, "      \"buildSource\": \"%s\",\n", isFromS1 ? "S1" : "VPLs");
+	fprintf(out, "      \"streamed\": %s,\n", isStreamed ? "true" : "false");
+	fprintf(out, "      \"numLevels\": %d,\n", builder.highestLevel + 1);
+	fprintf(out, "      \"gatherTileSize\": %d,\n", builder.gatherTileSize);
+	fprintf(out, "      \"repeats\": %d,\n", options.numRepeats);
+	fprintf(out, "      \"ms\": %.3f,\n", totalMs);
+	fprintf(out, "      \"bytes\": %llu,\n", (unsigned long long)totalBytes);
+	fprintf(out, "      \"vplsPerSecond\": %.0f,\n", totalMs > 0.0 ? vplsPerMs * 1000.0 / totalMs : 0.0);
+	fprintf(out, "      \"levelSizes\": [");
+	for (size_t level = 0; level < builder.levelSizes.size(); level++) fprintf(out, "%s%d", level ? ", " : "", builder.levelSizes[level]);
+	fprintf(out, "],\n      \"stages\": [");
+	for (size_t i = 0; i < builder.stageTimings.size(); i++)
+	{
+		const CPULGHStageTiming& timing = builder.stageTimings[i];
+		fprintf(out, "%s\n        { \"name\": \"%s\", \"ms\": %.3f, \"bytes\": %llu, \"vplsPerSecond\": %.0f }", i ? "," : "",
+			timing.name.c_str(), timing.ms, (unsigned long long)timing.bytes, timing.ms > 0.0 ? vplsPerMs * 1000.0 / timing.ms : 0.0);
+	}
+	fprintf(out, "\n      ]\n    }");
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: LGHBench [--sizes n,...] [--shapes uniform,planes,clusters] [--vpls file] [--source s1|vpls|both]\n"
+			"                [--threads n] [--repeats n] [--stream-from n] [--batch n] [--no-sort] [--no-tiled-gather]\n"
+			"                [--tile-sizes n,...] [--out file]\n");
+		return 1;
+	}
+
+	FILE* out = options.outPath.empty() ? stdout : fopen(options.outPath.c_str(), "w");
+	if (!out)
+	{
+		fprintf(stderr, "cannot open %s\n", options.outPath.c_str());
+		return 1;
+	}
+
+	// (shape, size, source) of every set, a captured set has its own size
+	struct BenchSet
+	{
+		std::string shape;
+		long long numVPLs;
+		CPUVPLSource* source;
+	};
+	std::vector<CPUVPLGeneratorSource> generators;
+	generators.reserve(options.shapes.size() * options.sizes.size());
+	std::vector<BenchSet> sets;
+	for (const std::string& shape : options.shapes)
+	{
+		CPUVPLGeneratorSource::Generator generator = GetShapeGenerator(shape);
+		if (!generator)
+		{
+			fprintf(stderr, "unknown shape %s\n", shape.c_str());
+			continue;
+		}
+		for (long long numVPLs : options.sizes)
+		{
+			generators.emplace_back(numVPLs, generator);
+			sets.push_back({ shape, numVPLs, &generators.back() });
+		}
+	}
+	CPUVPLFileSource capture;
+	if (!options.capturePath.empty())
+	{
+		if (capture.Open(options.capturePath.c_str())) sets.push_back({ "captured:" + options.capturePath, capture.NumVPLs(), &capture });
+		else fprintf(stderr, "cannot open VPL file %s\n", options.capturePath.c_str());
+	}
+
+	CPULGHBuilder builder;
+	builder.Init(1, options.numThreads);
+	fprintf(out, "{\n  \"benchmark\": \"LGHBench\",\n  \"version\": 1,\n");
+	fprintf(out, "  \"threads\": %d,\n  \"avx2\": %s,\n", builder.numThreads, builder.isAVX2Enabled ? "true" : "false");
+	fprintf(out, "  \"vplSort\": %s,\n  \"tiledGather\": %s,\n", options.isVPLSortEnabled ? "true" : "false", options.isTiledGatherEnabled ? "true" : "false");
+	fprintf(out, "  \"runs\": [");
+
+	bool isFirstRun = true;
+	for (const BenchSet& set : sets)
+	{
+		// sets below the streaming size are read into memory once and built with Build
+		bool isStreamed = set.numVPLs >= options.streamFrom || set.numVPLs > INT_MAX;
+		std::vector<glm::vec4> vpls[3];
+		if (!isStreamed)
+		{
+			for (int i = 0; i < 3; i++) vpls[i].resize((size_t)set.numVPLs);
+			set.source->Rewind();
+			long long numRead = 0;
+			for (int n; numRead < set.numVPLs && (n = set.source->Read((int)std::min<long long>(options.batchSize, set.numVPLs - numRead),
+				vpls[0].data() + numRead, vpls[1].data() + numRead, vpls[2].data() + numRead)) > 0;) numRead += n;
+			if (numRead != set.numVPLs)
+			{
+				fprintf(stderr, "%s: read %lld of %lld VPLs\n", set.shape.c_str(), numRead, set.numVPLs);
+				continue;
+			}
+		}
+
+		for (int s = 0; s < 2; s++)
+		{
+			bool isFromS1 = s == 0;
+			if ((isFromS1 && !options.isFromS1) || (!isFromS1 && !options.isFromVPLs)) continue;
+
+			// only the tiled gather of S1 builds has a tile size
+			int numLevels = CPULGHBuilder::CalculateNumLevels(set.numVPLs);
+			int numTileSizes = isFromS1 && options.isTiledGatherEnabled ? (int)options.tileSizes.size() : 1;
+			std::vector<int> firstLevelSizes;
+			for (int t = 0; t < numTileSizes; t++)
+			{
+				CPULGHBuilder best;
+				double bestMs = 0.0;
+				for (int repeat = 0; repeat < options.numRepeats; repeat++)
+				{
+					CPULGHBuilder run;
+					run.Init(numLevels - 1, options.numThreads, options.isVPLSortEnabled, options.isTiledGatherEnabled, false, options.tileSizes[t]);
+					if (isStreamed) run.BuildStreamed(*set.source, options.batchSize, isFromS1);
+					else run.Build((int)set.numVPLs, vpls[0].data(), vpls[1].data(), vpls[2].data(), isFromS1);
+
+					double ms = 0.0;
+					for (const CPULGHStageTiming& timing : run.stageTimings) ms += timing.ms;
+					if (repeat == 0 || ms < bestMs)
+					{
+						bestMs = ms;
+						best.highestLevel = run.highestLevel;
+						best.gatherTileSize = run.gatherTileSize;
+						best.levelSizes = run.levelSizes;
+						best.stageTimings = run.stageTimings;
+					}
+				}
+				fprintf(stderr, "%s, %lld VPLs, from %s%s, gather tile %d: %.1f ms\n", set.shape.c_str(), set.numVPLs, isFromS1 ? "S1" : "VPLs",
+					isStreamed ? " (streamed)" : "", best.gatherTileSize, bestMs);
+				if (t == 0) firstLevelSizes = best.levelSizes;
+				else if (best.levelSizes != firstLevelSizes)
+					fprintf(stderr, "%s: levels of gather tile %d differ from gather tile %d\n", set.shape.c_str(), best.gatherTileSize, options.tileSizes[0]);
+				WriteRun(out, isFirstRun, set.shape, set.numVPLs, isFromS1, isStreamed, options, best, bestMs);
+				isFirstRun = false;
+			}
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) fclose(out);
+	return 0;
+}
@@ -10,6 +10,7 @@ cbuffer CSConstants : register(b0)
 	int levelSize;
 	int numLevels;
 	int numTiles;
+	int arenaOffset;
 }
 
 [numthreads(1024, 1, 1)]
@@ -25,7 +26,7 @@ void main(uint3 DTid : SV_DispatchThreadID)
 		int tileThreadId = DTid.x - tileOffset;
 
 		int id = levelOffsetOfTile[tileId * numLevels + level] + tileThreadId;
-		int srcId = numTiles * tileThreadId + tileId;
+		int srcId = arenaOffset + numTiles * tileThreadId + tileId;
 
 		instanceAttribs[0][id] = levelAttribs[0][srcId];
 		instanceAttribs[1][id] = levelAttribs[1][srcId];
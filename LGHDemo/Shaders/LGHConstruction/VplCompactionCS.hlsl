@@ -13,13 +13,14 @@ RWStructuredBuffer<float4> levelAttribsCompact[4] : register(u0);
 cbuffer CSConstants : register(b0)
 {
 	int level;
+	int arenaOffset; // first vertex of the level in the level arena, 0 for separate level buffers
 }
 
 [numthreads(DEFAULT_BLOCK_SIZE, 1, 1)]
 void main( uint3 DTid : SV_DispatchThreadID )
 {
 	float weight = levelWeights[DTid.x];
-	int addr = levelAddress[DTid.x] - 1;
+	int addr = arenaOffset + levelAddress[DTid.x] - 1;
 	if (weight > 0)
 	{
 		float3 avgPos = levelAttribs[POSITION][DTid.x].xyz / weight;
@@ -36,6 +36,7 @@ cbuffer PSConstants : register(b0)
 	int frameId;
 	int temporalRandom;
 	float sceneRadius;
+	int instanceOffset; // first drawn instance, the shadow pass indexes the instance buffers with the stored id
 }
 
 Texture2D<float4> texPosition		: register(t32);
@@ -132,7 +133,7 @@ float3 lightingFunction(float3 sp, float3 sn, float3 lp, float3 ln, float3 c, fl
 
 								if (prob < pdf / sum)
 								{ //replace value in buffer
-									vplSampleBuffer[subScreenPos] = instanceId;
+									vplSampleBuffer[subScreenPos] = instanceId + instanceOffset;
 									pdfBuffer[subScreenPos] = pdf;
 								}
 								runningSum[subScreenPos] = sum;
@@ -196,7 +197,7 @@ float3 lightingFunction(float3 sp, float3 sn, float3 lp, float3 ln, float3 c, fl
 								float prob = hash3D(float3(subPos, float(instanceId - minSampleId)));
 								if (prob < pdf / sum)
 								{ //replace value in buffer
-									vplSampleBuffer[subScreenPos] = instanceId;
+									vplSampleBuffer[subScreenPos] = instanceId + instanceOffset;
 									pdfBuffer[subScreenPos] = pdf;
 								}
 								runningSum[subScreenPos] = sum;
@@ -0,0 +1,85 @@
+#include "CPUAlphaCoverage.h"
+#include <algorithm>
+#include <cmath>
+
+void CPUAlphaCoverage::Build(int _width, int _height, int numComponents, const uint8_t* data)
+{
+	width = _width;
+	height = _height;
+	hasAlpha = numComponents == 4 && width > 0 && height > 0;
+	table.clear();
+	if (!hasAlpha) return;
+
+	size_t stride = (size_t)width + 1;
+	table.assign(stride * (height + 1), 0);
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* row = data + (size_t)y * width * 4;
+		uint32_t rowCount = 0;
+		for (int x = 0; x < width; x++)
+		{
+			rowCount += row[4 * x + 3] >= 128;
+			table[(y + 1) * stride + x + 1] = table[y * stride + x + 1] + rowCount;
+		}
+	}
+
+	// nothing to look up when every texel is opaque, which is the common case
+	if (table.back() == (uint32_t)width * height)
+	{
+		hasAlpha = false;
+		std::vector<uint32_t>().swap(table);
+	}
+}
+
+uint32_t CPUAlphaCoverage::CountOpaque(int x0, int y0, int x1, int y1) const
+{
+	size_t stride = (size_t)width + 1;
+	return table[y1 * stride + x1] - table[y0 * stride + x1] - table[y1 * stride + x0] + table[y0 * stride + x0];
+}
+
+CPUAlphaState CPUAlphaCoverage::Classify(const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) const
+{
+	if (!hasAlpha) return ALPHA_OPAQUE;
+
+	glm::vec2 uvMin = glm::min(uv0, glm::min(uv1, uv2));
+	glm::vec2 uvMax = glm::max(uv0, glm::max(uv1, uv2));
+
+	// wrapped texel range [begin, begin + count) of each axis: the bilinear footprint of the UV box
+	// and one more texel on both sides for the rounding of the interpolated UVs
+	int size[2] = { width, height };
+	int begin[2], count[2];
+	for (int axis = 0; axis < 2; axis++)
+	{
+		double first = std::floor((double)uvMin[axis] * size[axis] - 0.5) - 1.0;
+		double last = std::floor((double)uvMax[axis] * size[axis] - 0.5) + 2.0;
+		if (!(std::abs(first) < 1e15 && std::abs(last) < 1e15)) return ALPHA_MIXED; // also NaN
+		if (last - first + 1.0 >= size[axis])
+		{
+			begin[axis] = 0;
+			count[axis] = size[axis];
+			continue;
+		}
+		long long wrapped = (long long)first % size[axis];
+		begin[axis] = (int)(wrapped < 0 ? wrapped + size[axis] : wrapped);
+		count[axis] = (int)(last - first) + 1;
+	}
+
+	// up to two pieces per axis where the range wraps around
+	uint64_t numOpaque = 0;
+	for (int py = 0; py < 2; py++)
+	{
+		int y0 = py == 0 ? begin[1] : 0;
+		int y1 = py == 0 ? std::min(begin[1] + count[1], height) : begin[1] + count[1] - height;
+		if (y1 <= y0) continue;
+		for (int px = 0; px < 2; px++)
+		{
+			int x0 = px == 0 ? begin[0] : 0;
+			int x1 = px == 0 ? std::min(begin[0] + count[0], width) : begin[0] + count[0] - width;
+			if (x1 <= x0) continue;
+			numOpaque += CountOpaque(x0, y0, x1, y1);
+		}
+	}
+
+	if (numOpaque == 0) return ALPHA_TRANSPARENT;
+	return numOpaque == (uint64_t)count[0] * count[1] ? ALPHA_OPAQUE : ALPHA_MIXED;
+}
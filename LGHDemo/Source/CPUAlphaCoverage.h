@@ -0,0 +1,39 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// what the alpha test of the hit shaders (alpha < 0.5 ignores the hit) does on a triangle
+enum CPUAlphaState : uint8_t
+{
+	ALPHA_OPAQUE = 0, // every hit is kept
+	ALPHA_TRANSPARENT = 1, // every hit is ignored
+	ALPHA_MIXED = 2 // depends on the hit, only these need the texture fetch
+};
+
+// classifies triangles by the alpha of the texels their UVs can reach, as the alpha test samples mip 0
+// bilinearly with wrapping. A summed area table counts the texels with alpha >= 0.5 (128 and up), so a
+// triangle costs a few lookups however large its footprint is. The footprint is the UV bounding box
+// grown by the bilinear neighbors, which keeps the classification exact for opaque and transparent
+// triangles and conservative otherwise.
+class CPUAlphaCoverage
+{
+public:
+
+	CPUAlphaCoverage() {};
+
+	// rows in GPU order, textures without an alpha channel (numComponents < 4) are opaque
+	void Build(int width, int height, int numComponents, const uint8_t* data);
+
+	CPUAlphaState Classify(const glm::vec2& uv0, const glm::vec2& uv1, const glm::vec2& uv2) const;
+
+private:
+
+	// opaque texels in [x0, x1) x [y0, y1)
+	uint32_t CountOpaque(int x0, int y0, int x1, int y1) const;
+
+	int width = 0;
+	int height = 0;
+	bool hasAlpha = false;
+	std::vector<uint32_t> table; // (width + 1) x (height + 1), row and column 0 are zero
+};
@@ -0,0 +1,507 @@
+#include "CPUBVH.h"
+#include "CPUParallel.h"
+#include "CPUScan.h"
+#include <cfloat>
+#include <chrono>
+
+namespace
+{
+	int CeilLog2(int n)
+	{
+		int log = 0;
+		while ((1 << log) < n) log++;
+		return log;
+	}
+}
+
+void CPUBVHBuilder::Bounds::Reset()
+{
+	min = glm::vec3(FLT_MAX);
+	max = glm::vec3(-FLT_MAX);
+}
+
+float CPUBVHBuilder::Bounds::HalfArea() const
+{
+	glm::vec3 d = max - min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+void CPUBVHBuilder::Build(const std::vector<glm::vec3>& _primMin, const std::vector<glm::vec3>& _primMax, int _maxLeafSize, int _numThreads)
+{
+	auto start = std::chrono::steady_clock::now();
+	maxLeafSize = std::max(1, _maxLeafSize);
+	numThreads = std::max(1, _numThreads);
+
+	int n = (int)_primMin.size();
+	nodes.clear();
+	primIndices.resize(n);
+	refs.resize(n);
+	scratch.resize(n);
+	if (n == 0) return;
+
+	std::vector<Bounds> threadBounds(2 * numThreads);
+	for (Bounds& bounds : threadBounds) bounds.Reset();
+	ParallelFor(0, n, 65536, numThreads, [&](int begin, int end, int threadId)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			refs[i].min = _primMin[i];
+			refs[i].index = i;
+			refs[i].max = _primMax[i];
+			threadBounds[2 * threadId].min = glm::min(threadBounds[2 * threadId].min, refs[i].min);
+			threadBounds[2 * threadId].max = glm::max(threadBounds[2 * threadId].max, refs[i].max);
+			threadBounds[2 * threadId + 1].Add(refs[i].Centroid());
+		}
+	});
+
+	Range root;
+	root.node = 0;
+	root.depth = 0;
+	root.begin = 0;
+	root.end = n;
+	root.bounds.Reset();
+	root.centroidBounds.Reset();
+	for (int threadId = 0; threadId < numThreads; threadId++)
+	{
+		root.bounds.Add(threadBounds[2 * threadId]);
+		root.centroidBounds.Add(threadBounds[2 * threadId + 1]);
+	}
+	SetBins(root);
+	nodes.emplace_back();
+
+	// top splits, each on all threads
+	int subtreeSize = std::max(4096, n / (4 * numThreads));
+	std::vector<Range> pending(1, root);
+	std::vector<Range> subtrees;
+	Bin bins[3 * BVH_NUM_BINS];
+	while (!pending.empty())
+	{
+		Range range = pending.back();
+		pending.pop_back();
+		if (range.end - range.begin <= subtreeSize)
+		{
+			subtrees.push_back(range);
+			continue;
+		}
+		BinRange(range, bins, true);
+		Range left, right;
+		if (!SplitRange(range, bins, true, nodes, left, right)) continue;
+		pending.push_back(right);
+		pending.push_back(left);
+	}
+
+	std::vector<std::vector<CPUBVHNode>> subtreeNodes(subtrees.size());
+	ParallelFor(0, (int)subtrees.size(), 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++) BuildSubtree(subtrees[i], subtreeNodes[i]);
+	});
+
+	// the root of a subtree takes the place of its range's node, the others are appended
+	std::vector<int> subtreeOffsets(subtrees.size() + 1, (int)nodes.size());
+	for (size_t i = 0; i < subtrees.size(); i++) subtreeOffsets[i + 1] = subtreeOffsets[i] + (int)subtreeNodes[i].size() - 1;
+	nodes.resize(subtreeOffsets.back());
+	ParallelFor(0, (int)subtrees.size(), 16, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			std::vector<CPUBVHNode>& local = subtreeNodes[i];
+			for (size_t k = 0; k < local.size(); k++)
+			{
+				CPUBVHNode node = local[k];
+				if (node.count == 0) node.firstOrChild += subtreeOffsets[i] - 1;
+				nodes[k == 0 ? subtrees[i].node : subtreeOffsets[i] + (int)k - 1] = node;
+			}
+			std::vector<CPUBVHNode>().swap(local);
+		}
+	});
+
+	ParallelFor(0, n, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++) primIndices[i] = refs[i].index;
+	});
+	std::vector<PrimRef>().swap(refs);
+	std::vector<PrimRef>().swap(scratch);
+	buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CPUBVHBuilder::SetBins(Range& range)
+{
+	range.numBins = std::min(BVH_NUM_BINS, std::max(4, (range.end - range.begin) / 2));
+	glm::vec3 extent = range.centroidBounds.max - range.centroidBounds.min;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		range.binScale[axis] = extent[axis] > 0.f ? range.numBins * (1.f - 1e-5f) / extent[axis] : 0.f;
+	}
+}
+
+void CPUBVHBuilder::BinRange(const Range& range, Bin* bins, bool isParallel)
+{
+	int numBins = range.numBins;
+	auto binPrims = [&](int begin, int end, Bin* target)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const PrimRef& ref = refs[i];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				Bin& bin = target[axis * numBins + BinOf(range, axis, ref)];
+				bin.bounds.min = glm::min(bin.bounds.min, ref.min);
+				bin.bounds.max = glm::max(bin.bounds.max, ref.max);
+				bin.count++;
+			}
+		}
+	};
+	auto resetBins = [&](Bin* target)
+	{
+		for (int i = 0; i < 3 * numBins; i++)
+		{
+			target[i].bounds.Reset();
+			target[i].count = 0;
+		}
+	};
+
+	resetBins(bins);
+	if (!isParallel)
+	{
+		binPrims(range.begin, range.end, bins);
+		return;
+	}
+
+	std::vector<Bin> threadBins(numThreads * 3 * numBins);
+	for (int threadId = 0; threadId < numThreads; threadId++) resetBins(&threadBins[threadId * 3 * numBins]);
+	ParallelFor(range.begin, range.end, 65536, numThreads, [&](int begin, int end, int threadId)
+	{
+		binPrims(begin, end, &threadBins[threadId * 3 * numBins]);
+	});
+	for (int threadId = 0; threadId < numThreads; threadId++)
+	{
+		for (int i = 0; i < 3 * numBins; i++)
+		{
+			bins[i].bounds.Add(threadBins[threadId * 3 * numBins + i].bounds);
+			bins[i].count += threadBins[threadId * 3 * numBins + i].count;
+		}
+	}
+}
+
+CPUBVHBuilder::Split CPUBVHBuilder::FindSplit(const Range& range, const Bin* bins) const
+{
+	Split best;
+	best.cost = FLT_MAX;
+	int numBins = range.numBins;
+	float invArea = 1.f / std::max(range.bounds.HalfArea(), FLT_MIN);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (range.binScale[axis] == 0.f) continue;
+		const Bin* axisBins = bins + axis * numBins;
+
+		// area and count of bins k and above
+		float rightArea[BVH_NUM_BINS];
+		int rightCount[BVH_NUM_BINS];
+		Bounds right;
+		right.Reset();
+		int count = 0;
+		for (int k = numBins - 1; k > 0; k--)
+		{
+			right.Add(axisBins[k].bounds);
+			count += axisBins[k].count;
+			rightArea[k] = right.HalfArea();
+			rightCount[k] = count;
+		}
+
+		Bounds left;
+		left.Reset();
+		count = 0;
+		for (int k = 1; k < numBins; k++)
+		{
+			left.Add(axisBins[k - 1].bounds);
+			count += axisBins[k - 1].count;
+			if (count == 0 || rightCount[k] == 0) continue;
+			float cost = traversalCost + intersectionCost * invArea * (left.HalfArea() * count + rightArea[k] * rightCount[k]);
+			if (cost < best.cost)
+			{
+				best.axis = axis;
+				best.bin = k;
+				best.cost = cost;
+			}
+		}
+	}
+	return best;
+}
+
+template <typename Predicate>
+int CPUBVHBuilder::Partition(const Range& range, const Predicate& isLeft, bool isParallel, Bounds& leftCentroids, Bounds& rightCentroids)
+{
+	leftCentroids.Reset();
+	rightCentroids.Reset();
+	int numRanges = isParallel ? GetNumScanRanges(range.end - range.begin, numThreads) : 1;
+	if (numRanges == 1)
+	{
+		// left side in place, right side through scratch
+		int l = range.begin;
+		int r = range.begin;
+		for (int i = range.begin; i < range.end; i++)
+		{
+			PrimRef ref = refs[i];
+			if (isLeft(ref))
+			{
+				refs[l++] = ref;
+				leftCentroids.Add(ref.Centroid());
+			}
+			else
+			{
+				scratch[r++] = ref;
+				rightCentroids.Add(ref.Centroid());
+			}
+		}
+		std::copy(scratch.begin() + range.begin, scratch.begin() + r, refs.begin() + l);
+		return l;
+	}
+
+	std::vector<int> leftOffset(numRanges + 1, 0);
+	std::vector<int> rightOffset(numRanges + 1, 0);
+	ParallelForStatic(range.begin, range.end, numRanges, [&](int rangeBegin, int rangeEnd, int rangeId)
+	{
+		int numLeft = 0;
+		for (int i = rangeBegin; i < rangeEnd; i++) numLeft += isLeft(refs[i]) ? 1 : 0;
+		leftOffset[rangeId + 1] = numLeft;
+		rightOffset[rangeId + 1] = rangeEnd - rangeBegin - numLeft;
+	});
+	for (int rangeId = 0; rangeId < numRanges; rangeId++)
+	{
+		leftOffset[rangeId + 1] += leftOffset[rangeId];
+		rightOffset[rangeId + 1] += rightOffset[rangeId];
+	}
+	int mid = range.begin + leftOffset[numRanges];
+
+	std::vector<Bounds> rangeCentroids(2 * numRanges);
+	ParallelForStatic(range.begin, range.end, numRanges, [&](int rangeBegin, int rangeEnd, int rangeId)
+	{
+		Bounds leftBounds, rightBounds;
+		leftBounds.Reset();
+		rightBounds.Reset();
+		int l = range.begin + leftOffset[rangeId];
+		int r = mid + rightOffset[rangeId];
+		for (int i = rangeBegin; i < rangeEnd; i++)
+		{
+			const PrimRef& ref = refs[i];
+			if (isLeft(ref))
+			{
+				scratch[l++] = ref;
+				leftBounds.Add(ref.Centroid());
+			}
+			else
+			{
+				scratch[r++] = ref;
+				rightBounds.Add(ref.Centroid());
+			}
+		}
+		rangeCentroids[2 * rangeId] = leftBounds;
+		rangeCentroids[2 * rangeId + 1] = rightBounds;
+	});
+	ParallelForStatic(range.begin, range.end, numRanges, [&](int rangeBegin, int rangeEnd, int)
+	{
+		std::copy(scratch.begin() + rangeBegin, scratch.begin() + rangeEnd, refs.begin() + rangeBegin);
+	});
+
+	for (int rangeId = 0; rangeId < numRanges; rangeId++)
+	{
+		leftCentroids.Add(rangeCentroids[2 * rangeId]);
+		rightCentroids.Add(rangeCentroids[2 * rangeId + 1]);
+	}
+	return mid;
+}
+
+bool CPUBVHBuilder::SplitRange(const Range& range, const Bin* bins, bool isParallel, std::vector<CPUBVHNode>& target, Range& left, Range& right)
+{
+	target[range.node].boundsMin = range.bounds.min;
+	target[range.node].boundsMax = range.bounds.max;
+	target[range.node].axis = 0;
+
+	int count = range.end - range.begin;
+	if (count <= maxLeafSize)
+	{
+		target[range.node].firstOrChild = range.begin;
+		target[range.node].count = count;
+		return false;
+	}
+
+	Split split;
+	if (range.depth + CeilLog2(count) < MAX_DEPTH - 1) split = FindSplit(range, bins);
+	int mid;
+	if (split.axis >= 0)
+	{
+		mid = Partition(range, [&](const PrimRef& ref) { return BinOf(range, split.axis, ref) < split.bin; }, isParallel,
+			left.centroidBounds, right.centroidBounds);
+		left.bounds.Reset();
+		right.bounds.Reset();
+		const Bin* axisBins = bins + split.axis * range.numBins;
+		for (int k = 0; k < range.numBins; k++) (k < split.bin ? left : right).bounds.Add(axisBins[k].bounds);
+	}
+	else
+	{
+		// all centroids in one point, or close to the depth limit: halves in the current order
+		mid = (range.begin + range.end) / 2;
+		left.bounds.Reset();
+		right.bounds.Reset();
+		left.centroidBounds.Reset();
+		right.centroidBounds.Reset();
+		for (int i = range.begin; i < range.end; i++)
+		{
+			Range& side = i < mid ? left : right;
+			side.bounds.min = glm::min(side.bounds.min, refs[i].min);
+			side.bounds.max = glm::max(side.bounds.max, refs[i].max);
+			side.centroidBounds.Add(refs[i].Centroid());
+		}
+		split.axis = 0;
+	}
+
+	int child = (int)target.size();
+	target.emplace_back();
+	target.emplace_back();
+	target[range.node].firstOrChild = child;
+	target[range.node].count = 0;
+	target[range.node].axis = split.axis;
+
+	left.node = child;
+	left.depth = range.depth + 1;
+	left.begin = range.begin;
+	left.end = mid;
+	SetBins(left);
+	right.node = child + 1;
+	right.depth = range.depth + 1;
+	right.begin = mid;
+	right.end = range.end;
+	SetBins(right);
+	return true;
+}
+
+void CPUBVHBuilder::BuildSubtree(const Range& root, std::vector<CPUBVHNode>& subtreeNodes)
+{
+	subtreeNodes.reserve(2 * ((root.end - root.begin) / std::max(1, maxLeafSize / 2) + 1));
+	subtreeNodes.emplace_back();
+	std::vector<Range> stack(1, root);
+	stack[0].node = 0;
+	Bin bins[3 * BVH_NUM_BINS];
+	while (!stack.empty())
+	{
+		Range range = stack.back();
+		stack.pop_back();
+		if (range.end - range.begin > maxLeafSize) BinRange(range, bins, false);
+		Range left, right;
+		if (!SplitRange(range, bins, false, subtreeNodes, left, right)) continue;
+		stack.push_back(right);
+		stack.push_back(left);
+	}
+}
+
+void CollapseBVH8(const std::vector<CPUBVHNode>& nodes, std::vector<CPUBVH8Node>& wideNodes)
+{
+	wideNodes.clear();
+	if (nodes.empty()) return;
+
+	auto area = [&](int node)
+	{
+		glm::vec3 d = nodes[node].boundsMax - nodes[node].boundsMin;
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	};
+
+	// binary node of each wide node, in the order they are created
+	std::vector<int> sources(1, 0);
+	wideNodes.emplace_back();
+	for (size_t wide = 0; wide < sources.size(); wide++)
+	{
+		int children[8];
+		int numChildren = 1;
+		children[0] = sources[wide];
+		while (numChildren < 8)
+		{
+			int largest = -1;
+			for (int k = 0; k < numChildren; k++)
+			{
+				if (nodes[children[k]].count == 0 && (largest < 0 || area(children[k]) > area(children[largest]))) largest = k;
+			}
+			if (largest < 0) break;
+			int first = nodes[children[largest]].firstOrChild;
+			children[largest] = first;
+			children[numChildren++] = first + 1;
+		}
+
+		CPUBVH8Node node;
+		for (int k = 0; k < 8; k++)
+		{
+			const CPUBVHNode* child = k < numChildren ? &nodes[children[k]] : nullptr;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.boundsMin[axis][k] = child ? child->boundsMin[axis] : 0.f;
+				node.boundsMax[axis][k] = child ? child->boundsMax[axis] : 0.f;
+			}
+			if (!child)
+			{
+				node.child[k] = 0;
+				node.count[k] = -1;
+			}
+			else if (child->count > 0)
+			{
+				node.child[k] = child->firstOrChild;
+				node.count[k] = child->count;
+			}
+			else
+			{
+				node.child[k] = (int)sources.size();
+				node.count[k] = 0;
+				sources.push_back(children[k]);
+				wideNodes.emplace_back();
+			}
+		}
+		wideNodes[wide] = node;
+	}
+}
+
+int IntersectBVH8Node(const CPUBVH8Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax,
+	float tNear[8])
+{
+	int mask = 0;
+	for (int k = 0; k < 8; k++)
+	{
+		float enter = tMin;
+		float exit = tMax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float t0 = (node.boundsMin[axis][k] - origin[axis]) * invDirection[axis];
+			float t1 = (node.boundsMax[axis][k] - origin[axis]) * invDirection[axis];
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		tNear[k] = enter;
+		if (enter <= exit && node.count[k] >= 0) mask |= 1 << k;
+	}
+	return mask;
+}
+
+void IntersectBVH8NodePacket(const CPUBVH8Node& node, const CPUBVHPacket8& packet, int rayMask, int childRayMasks[8], float childNear[8])
+{
+	for (int k = 0; k < 8; k++)
+	{
+		childRayMasks[k] = 0;
+		childNear[k] = FLT_MAX;
+		if (node.count[k] < 0) continue;
+		for (int lane = 0; lane < 8; lane++)
+		{
+			if (!(rayMask & (1 << lane))) continue;
+			float enter = packet.tMin[lane];
+			float exit = packet.tMax[lane];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float t0 = (node.boundsMin[axis][k] - packet.origin[axis][lane]) * packet.invDirection[axis][lane];
+				float t1 = (node.boundsMax[axis][k] - packet.origin[axis][lane]) * packet.invDirection[axis][lane];
+				enter = std::max(enter, std::min(t0, t1));
+				exit = std::min(exit, std::max(t0, t1));
+			}
+			if (enter <= exit)
+			{
+				childRayMasks[k] |= 1 << lane;
+				childNear[k] = std::min(childNear[k], enter);
+			}
+		}
+	}
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+struct CPUBVHNode
+{
+	glm::vec3 boundsMin;
+	int firstOrChild; // first primitive of a leaf, first of the two children otherwise
+	glm::vec3 boundsMax;
+	int count; // primitives of a leaf, 0 for an inner node
+	int axis; // split axis of an inner node
+};
+
+// 8-wide node from collapsing the binary BVH, bounds are in SoA order so that one AVX register
+// holds a plane of all children
+struct CPUBVH8Node
+{
+	float boundsMin[3][8];
+	float boundsMax[3][8];
+	int child[8]; // index of an inner child node, first primitive of a leaf child
+	int count[8]; // primitives of a leaf child, 0 for an inner child, -1 for an empty slot
+};
+
+// the 8 rays of a packet as the box tests read them, one lane per ray. An inactive lane has
+// tMin > tMax.
+struct CPUBVHPacket8
+{
+	float origin[3][8];
+	float invDirection[3][8];
+	float tMin[8];
+	float tMax[8]; // the closest hit so far
+};
+
+// every wide node takes the 8 largest (by surface area) descendants of a binary node that can be
+// reached through inner nodes, wideNodes[0] is the root
+void CollapseBVH8(const std::vector<CPUBVHNode>& nodes, std::vector<CPUBVH8Node>& wideNodes);
+
+// slab test of a ray against the 8 children, returns the mask of children hit within
+// [tMin, tMax] and their entry distances. The AVX2 versions (CPUBVHTraversalAVX2.cpp) give the
+// same results and need IsAVX2Supported.
+int IntersectBVH8Node(const CPUBVH8Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax,
+	float tNear[8]);
+int IntersectBVH8NodeAVX2(const CPUBVH8Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax,
+	float tNear[8]);
+
+// the same for the rays of a packet in rayMask: childRayMasks[k] are the rays that hit child k,
+// childNear[k] the nearest of their entry distances
+void IntersectBVH8NodePacket(const CPUBVH8Node& node, const CPUBVHPacket8& packet, int rayMask, int childRayMasks[8], float childNear[8]);
+void IntersectBVH8NodePacketAVX2(const CPUBVH8Node& node, const CPUBVHPacket8& packet, int rayMask, int childRayMasks[8], float childNear[8]);
+
+// binary BVH over primitive bounds with binned SAH (BVH_NUM_BINS bins per axis over the centroid
+// bounds). Ranges larger than a subtree (about n / (4 * numThreads) primitives) are split on all
+// threads: every thread bins a part of the range and the partition is a stable one through per
+// part counts. The ranges left are built as independent subtrees by a dynamic ParallelFor and
+// appended in order. Binning and partitioning give the same result on any number of threads, so
+// only the node order depends on it.
+// Any range of at most maxLeafSize primitives is a leaf, so a traversal that tests 4 or 8
+// triangles at once wants maxLeafSize at that width.
+class CPUBVHBuilder
+{
+public:
+
+	// no path is deeper, which bounds traversal stacks
+	static const int MAX_DEPTH = 64;
+
+	CPUBVHBuilder() {};
+
+	void Build(const std::vector<glm::vec3>& _primMin, const std::vector<glm::vec3>& _primMax, int _maxLeafSize, int _numThreads);
+
+	std::vector<CPUBVHNode> nodes; // nodes[0] is the root, children come in pairs
+	std::vector<int> primIndices; // leaf order of the primitives
+	double buildMs = 0.0;
+
+	// SAH costs relative to intersecting one primitive
+	float traversalCost = 1.f;
+	float intersectionCost = 1.f;
+
+private:
+
+	struct Bounds
+	{
+		glm::vec3 min, max;
+
+		void Reset();
+		void Add(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void Add(const Bounds& other) { min = glm::min(min, other.min); max = glm::max(max, other.max); }
+		float HalfArea() const;
+	};
+
+	// the bounds of a primitive, moved along by the partitions so that binning reads them in order
+	struct PrimRef
+	{
+		glm::vec3 min;
+		int index;
+		glm::vec3 max;
+		int padding;
+
+		glm::vec3 Centroid() const { return 0.5f * (min + max); }
+	};
+
+	struct Bin
+	{
+		Bounds bounds;
+		int count;
+	};
+
+	// a range of refs with the bounds of its primitives and of their centroids
+	struct Range
+	{
+		int node;
+		int depth;
+		int begin, end;
+		Bounds bounds, centroidBounds;
+		int numBins; // fewer for small ranges
+		glm::vec3 binScale; // bins per unit of centroid extent
+	};
+
+	struct Split
+	{
+		int axis = -1;
+		int bin;
+		float cost;
+	};
+
+	static const int BVH_NUM_BINS = 32;
+
+	static void SetBins(Range& range);
+	static int BinOf(const Range& range, int axis, const PrimRef& ref)
+	{
+		int bin = (int)((0.5f * (ref.min[axis] + ref.max[axis]) - range.centroidBounds.min[axis]) * range.binScale[axis]);
+		return bin < 0 ? 0 : (bin < range.numBins ? bin : range.numBins - 1);
+	}
+	void BinRange(const Range& range, Bin* bins, bool isParallel);
+	Split FindSplit(const Range& range, const Bin* bins) const;
+
+	// writes the node of the range, as a leaf (returns false) or split at a bin boundary, or at its
+	// middle when there is no usable split or the depth limit is near
+	bool SplitRange(const Range& range, const Bin* bins, bool isParallel, std::vector<CPUBVHNode>& target, Range& left, Range& right);
+
+	// stable partition of the range, with the centroid bounds of both sides
+	template <typename Predicate>
+	int Partition(const Range& range, const Predicate& isLeft, bool isParallel, Bounds& leftCentroids, Bounds& rightCentroids);
+
+	void BuildSubtree(const Range& root, std::vector<CPUBVHNode>& subtreeNodes);
+
+	std::vector<PrimRef> refs;
+	std::vector<PrimRef> scratch;
+	int maxLeafSize = 4;
+	int numThreads = 1;
+};
@@ -0,0 +1,69 @@
+// Compiled with /arch:AVX2, only called after CPUScene::Build found AVX2 and FMA support.
+#include "CPUBVH.h"
+#include <immintrin.h>
+#include <cfloat>
+
+int IntersectBVH8NodeAVX2(const CPUBVH8Node& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax,
+	float tNear[8])
+{
+	// one lane per child
+	__m256 enter = _mm256_set1_ps(tMin);
+	__m256 exit = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		__m256 o = _mm256_set1_ps(origin[axis]);
+		__m256 inv = _mm256_set1_ps(invDirection[axis]);
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.boundsMin[axis]), o), inv);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.boundsMax[axis]), o), inv);
+		enter = _mm256_max_ps(enter, _mm256_min_ps(t0, t1));
+		exit = _mm256_min_ps(exit, _mm256_max_ps(t0, t1));
+	}
+	_mm256_storeu_ps(tNear, enter);
+
+	__m256 isValid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)node.count), _mm256_set1_epi32(-1)));
+	return _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ), isValid));
+}
+
+void IntersectBVH8NodePacketAVX2(const CPUBVH8Node& node, const CPUBVHPacket8& packet, int rayMask, int childRayMasks[8], float childNear[8])
+{
+	// one lane per ray, one child after the other
+	const __m256 infinity = _mm256_set1_ps(FLT_MAX);
+	__m256 origin[3], inv[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		origin[axis] = _mm256_loadu_ps(packet.origin[axis]);
+		inv[axis] = _mm256_loadu_ps(packet.invDirection[axis]);
+	}
+	__m256 tMin = _mm256_loadu_ps(packet.tMin);
+	__m256 tMax = _mm256_loadu_ps(packet.tMax);
+
+	for (int k = 0; k < 8; k++)
+	{
+		childRayMasks[k] = 0;
+		childNear[k] = FLT_MAX;
+		if (node.count[k] < 0) continue;
+
+		__m256 enter = tMin;
+		__m256 exit = tMax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin[axis][k]), origin[axis]), inv[axis]);
+			__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax[axis][k]), origin[axis]), inv[axis]);
+			enter = _mm256_max_ps(enter, _mm256_min_ps(t0, t1));
+			exit = _mm256_min_ps(exit, _mm256_max_ps(t0, t1));
+		}
+		__m256 isHit = _mm256_cmp_ps(enter, exit, _CMP_LE_OQ);
+		int mask = _mm256_movemask_ps(isHit) & rayMask;
+		if (!mask) continue;
+		childRayMasks[k] = mask;
+
+		// nearest entry of the rays in mask
+		__m256 isActive = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+			_mm256_and_si256(_mm256_set1_epi32(mask), _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)), _mm256_setzero_si256()));
+		__m256 nearest = _mm256_blendv_ps(infinity, enter, isActive);
+		nearest = _mm256_min_ps(nearest, _mm256_permute2f128_ps(nearest, nearest, 1));
+		nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+		nearest = _mm256_min_ps(nearest, _mm256_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+		childNear[k] = _mm_cvtss_f32(_mm256_castps256_ps128(nearest));
+	}
+}
@@ -0,0 +1,117 @@
+#include "CPUInstantRadiosity.h"
+#include "CPUParallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+void CPUIRRenderer::Render(const CPUScene& scene, const CPUIRParams& params, int width, int height, const glm::vec4* positions,
+	const glm::vec4* normals, int numVPLs, const glm::vec4* vplPositions, const glm::vec4* vplNormals,
+	const glm::vec4* vplColors, glm::vec3* radiance, int numThreads)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	float rayOffset = 0.001f * params.sceneRadius;
+	float bias = 0.01f * params.sceneRadius; //clamping term
+	bias *= bias;
+	std::atomic<long long> shadowRays(0);
+
+	ParallelForWorkStealing(tilesX * tilesY, numThreads, [&](int tile, int)
+	{
+		int x0 = (tile % tilesX) * TILE_SIZE;
+		int y0 = (tile / tilesX) * TILE_SIZE;
+
+		// packets of 2x4 pixel blocks, pixels without geometry left out
+		int pixels[TILE_SIZE * TILE_SIZE];
+		int numPixels = 0;
+		for (int by = 0; by < TILE_SIZE; by += 4)
+		{
+			for (int bx = 0; bx < TILE_SIZE; bx += 2)
+			{
+				for (int i = 0; i < 8; i++)
+				{
+					int x = x0 + bx + (i & 1);
+					int y = y0 + by + (i >> 1);
+					if (x >= width || y >= height) continue;
+					int pixel = y * width + x;
+					radiance[pixel] = glm::vec3(0.f);
+					if (normals[pixel].x == 0.f && normals[pixel].y == 0.f && normals[pixel].z == 0.f) continue;
+					pixels[numPixels++] = pixel;
+				}
+			}
+		}
+
+		long long tileRays = 0;
+		for (int batch = 0; batch < numVPLs; batch += VPL_BATCH_SIZE)
+		{
+			int batchEnd = std::min(numVPLs, batch + VPL_BATCH_SIZE);
+			for (int first = 0; first < numPixels; first += 8)
+			{
+				int numLanes = std::min(8, numPixels - first);
+				glm::vec3 sp[8], sn[8];
+				for (int lane = 0; lane < numLanes; lane++)
+				{
+					sp[lane] = glm::vec3(positions[pixels[first + lane]]);
+					sn[lane] = glm::vec3(normals[pixels[first + lane]]);
+				}
+
+				for (int vpl = batch; vpl < batchEnd; vpl++)
+				{
+					glm::vec3 lightPosition(vplPositions[vpl]);
+					glm::vec3 lightNormal(vplNormals[vpl]);
+					glm::vec3 lightColor(vplColors[vpl]);
+
+					// only the pixels the VPL contributes to need the shadow ray
+					CPUSceneRay rays[8];
+					glm::vec3 output[8];
+					int rayMask = 0;
+					for (int lane = 0; lane < numLanes; lane++)
+					{
+						glm::vec3 lightDir = lightPosition - sp[lane];
+						float dist = glm::length(lightDir);
+						lightDir = lightDir / dist;
+						float cosSurface = glm::dot(sn[lane], lightDir);
+						float cosLight = glm::dot(lightNormal, -lightDir);
+						if (!(cosSurface > 0.f && cosLight > 0.f)) continue;
+
+						output[lane] = cosSurface * lightColor;
+						output[lane] *= cosLight / (dist * dist + bias);
+						rays[lane].origin = sp[lane];
+						rays[lane].tMin = rayOffset;
+						rays[lane].direction = lightDir;
+						rays[lane].tMax = dist;
+						rayMask |= 1 << lane;
+						tileRays++;
+					}
+					if (!rayMask) continue;
+
+					int visible = rayMask & ~scene.Occluded8(rays, rayMask, params.alphaTest);
+					for (int lane = 0; lane < numLanes; lane++)
+					{
+						if (visible & (1 << lane)) radiance[pixels[first + lane]] += output[lane] * params.invNumPaths;
+					}
+				}
+			}
+		}
+		shadowRays += tileRays;
+	});
+
+	numShadowRays = shadowRays;
+	renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool CPUIRRenderer::SaveImage(const char* filename, int width, int height, const glm::vec3* radiance)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file) return false;
+
+	fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+	bool isWritten = true;
+	for (int y = height - 1; y >= 0 && isWritten; y--)
+	{
+		isWritten = fwrite(radiance + (size_t)y * width, sizeof(glm::vec3), width, file) == (size_t)width;
+	}
+	return fclose(file) == 0 && isWritten;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "CPUScene.h"
+#include <vector>
+
+// constants of IRRayGen
+struct CPUIRParams
+{
+	float invNumPaths = 1.f;
+	float sceneRadius = 1.f; // the ray offset is 0.001 * sceneRadius, the clamping term (0.01 * sceneRadius)^2
+	bool alphaTest = false; // the geometry is opaque to the shadow rays of IRRayGen
+};
+
+// headless CPU counterpart of InstantRadiosityRenderer for ground truth: every pixel of a G-buffer sums
+// IRRayGen over the whole VPL set, shadow rays included, in one call instead of one frame per VPL.
+// The image is split into 16x16 tiles handed out by ParallelForWorkStealing. A tile takes the VPLs in
+// batches of VPL_BATCH_SIZE (24 KB of VPL data), and for every packet of 8 neighboring pixels it goes
+// through the batch with one Occluded8 per VPL. The batch stays in cache for all packets of the tile
+// and consecutive packets of rays start from the same part of the BVH. Pixels add the VPLs in
+// index order like resultBuffer does, so the image does not depend on the number of threads.
+class CPUIRRenderer
+{
+public:
+
+	CPUIRRenderer() {};
+
+	// positions and normals are float4 per pixel in row order (row 0 at the top, as pixelPos), a zero
+	// normal marks a pixel without geometry, which stays black. The VPLs are float4 arrays as the VPL
+	// buffers hold them. radiance is resultBuffer at the last VPL, before the albedo of the compositing.
+	void Render(const CPUScene& scene, const CPUIRParams& params, int width, int height, const glm::vec4* positions,
+		const glm::vec4* normals, int numVPLs, const glm::vec4* vplPositions, const glm::vec4* vplNormals,
+		const glm::vec4* vplColors, glm::vec3* radiance, int numThreads);
+
+	// little endian PFM, which stores the bottom row first
+	static bool SaveImage(const char* filename, int width, int height, const glm::vec3* radiance);
+
+	double renderMs = 0.0;
+	long long numShadowRays = 0; // rays toward VPLs facing the pixel, the others contribute nothing
+
+private:
+
+	static const int TILE_SIZE = 16;
+	static const int VPL_BATCH_SIZE = 512;
+};
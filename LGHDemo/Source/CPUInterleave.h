@@ -0,0 +1,101 @@
+#pragma once
+#include "CPUScan.h"
+#include <vector>
+
+// CPU counterpart of the tile bucketing of MergeLevelsInterleave. The instances are the levels
+// concatenated in order, entry i of a level goes to tile i % numTiles, and inside a tile the
+// instances keep the level order, so the layout matches MergeLevelsInterleaveCS. Tiles are
+// numTilesX * numTilesY (any pattern), tile id = x + y * numTilesX.
+//
+// Done as a stable counting sort: per-range tile histograms, one exclusive scan tile-major
+// (range-minor), then every range scatters its instances from its own tile cursors.
+struct CPUInterleavedTiles
+{
+	int numTilesX = 1;
+	int numTilesY = 1;
+	int numInstances = 0;
+	std::vector<int> offsetOfTile; // first instance of each tile
+	std::vector<int> numInstanceOfTile;
+
+	int NumTiles() const { return numTilesX * numTilesY; }
+};
+
+// number of indices in [begin, end) with index % numTiles == tileId, for every tile
+inline void CountTilesOfRange(int begin, int end, int numTiles, int* histogram)
+{
+	int numCycles = (end - begin) / numTiles;
+	for (int tileId = 0; tileId < numTiles; tileId++) histogram[tileId] += numCycles;
+	for (int i = begin + numCycles * numTiles; i < end; i++) histogram[i % numTiles]++;
+}
+
+// levelSizes[firstLevel..] are bucketed, scatter(level, entry, instanceId) is called once per
+// instance (concurrently for different instances). Tile tables are sized exactly.
+template <typename Scatter>
+void BucketInterleavedTiles(const std::vector<int>& levelSizes, int firstLevel, int numTilesX, int numTilesY,
+	CPUInterleavedTiles& tiles, const Scatter& scatter, int numThreads)
+{
+	int numLevels = (int)levelSizes.size();
+	int numTiles = numTilesX * numTilesY;
+	tiles.numTilesX = numTilesX;
+	tiles.numTilesY = numTilesY;
+	tiles.offsetOfTile.assign(numTiles, 0);
+	tiles.numInstanceOfTile.assign(numTiles, 0);
+
+	// levelStart[level] is the first instance of the level in the concatenated input
+	std::vector<int> levelStart(numLevels + 1, 0);
+	for (int level = firstLevel; level < numLevels; level++) levelStart[level + 1] = levelStart[level] + levelSizes[level];
+	int n = levelStart[numLevels];
+	tiles.numInstances = n;
+	if (n == 0) return;
+
+	int numRanges = GetNumScanRanges(n, numThreads);
+	std::vector<int> histograms(numRanges * numTiles, 0);
+
+	// calls func(level, first entry, end entry) for the level pieces of [begin, end)
+	auto forEachLevelPiece = [&](int begin, int end, const auto& func)
+	{
+		int level = firstLevel;
+		while (levelStart[level + 1] <= begin) level++;
+		for (; level < numLevels && levelStart[level] < end; level++)
+		{
+			int pieceBegin = std::max(begin, levelStart[level]) - levelStart[level];
+			int pieceEnd = std::min(end, levelStart[level + 1]) - levelStart[level];
+			if (pieceBegin < pieceEnd) func(level, pieceBegin, pieceEnd);
+		}
+	};
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		forEachLevelPiece(begin, end, [&](int level, int entryBegin, int entryEnd)
+		{
+			CountTilesOfRange(entryBegin, entryEnd, numTiles, &histograms[rangeId * numTiles]);
+		});
+	});
+
+	int offset = 0;
+	for (int tileId = 0; tileId < numTiles; tileId++)
+	{
+		tiles.offsetOfTile[tileId] = offset;
+		for (int rangeId = 0; rangeId < numRanges; rangeId++)
+		{
+			int count = histograms[rangeId * numTiles + tileId];
+			histograms[rangeId * numTiles + tileId] = offset;
+			offset += count;
+		}
+		tiles.numInstanceOfTile[tileId] = offset - tiles.offsetOfTile[tileId];
+	}
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		int* cursor = &histograms[rangeId * numTiles];
+		forEachLevelPiece(begin, end, [&](int level, int entryBegin, int entryEnd)
+		{
+			int tileId = entryBegin % numTiles;
+			for (int entry = entryBegin; entry < entryEnd; entry++)
+			{
+				scatter(level, entry, cursor[tileId]++);
+				if (++tileId == numTiles) tileId = 0;
+			}
+		});
+	});
+}
@@ -0,0 +1,1174 @@
+#include "CPULGHBuilder.h"
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <xmmintrin.h>
+
+// the cell containing a position, clamped so that rounding at the bbox border stays inside the grid
+static inline glm::ivec3 GetCellId(const glm::vec3& normPos, int numCells1D)
+{
+	return glm::clamp(glm::ivec3(normPos), glm::ivec3(0), glm::ivec3(numCells1D - 1));
+}
+
+static inline glm::ivec3 GetCornerOffset(int vId)
+{
+	return glm::ivec3(vId % 2, (vId % 4) / 2, vId / 4);
+}
+
+// trilinear weight of corner vId, interp is the position inside the cell
+static inline float GetCornerWeight(int vId, const glm::vec3& interp)
+{
+	return ((vId & 1) ? interp.x : (1 - interp.x)) * ((vId & 2) ? interp.y : (1 - interp.y)) * ((vId & 4) ? interp.z : (1 - interp.z));
+}
+
+// splats one VPL onto the 8 corners of its cell (VplSplatToVertexCS),
+// vertexAt(vertId) returns the vertex the contribution is accumulated into
+template <typename VertexAt>
+static inline void SplatVPL(const glm::vec3& p, const glm::vec3& n, const glm::vec3& c,
+	const glm::vec3& normPos, const glm::ivec3& cellId, const VertexAt& vertexAt, bool useAVX2)
+{
+	glm::vec3 interp = normPos - glm::vec3(cellId);
+	if (useAVX2)
+	{
+		CPULGHVertex* corners[8];
+		for (int vId = 0; vId < 8; vId++) corners[vId] = &vertexAt(cellId + GetCornerOffset(vId));
+		SplatVPLAVX2(p, n, c, interp, corners);
+		return;
+	}
+	for (int vId = 0; vId < 8; vId++)
+	{
+		vertexAt(cellId + GetCornerOffset(vId)).Accumulate(GetCornerWeight(vId, interp), p, n, c);
+	}
+}
+
+// normalizes an accumulated vertex into compacted entry addr (VplCompactionCS)
+static inline void WriteCompactVertex(CPULGHLevel& compact, int addr, const CPULGHVertex& vert, int level)
+{
+	float weight = vert.weight;
+	glm::vec3 avgPos = vert.position / weight;
+	compact.position[addr] = glm::vec4(avgPos, level);
+	compact.normal[addr] = glm::vec4(vert.normal / weight, 0);
+	compact.color[addr] = glm::vec4(vert.color, 0);
+	compact.stdev[addr] = glm::vec4(float(PI) * glm::sqrt(glm::abs(vert.stdev / weight - avgPos * avgPos)), weight);
+}
+
+int CPULGHBuilder::CalculateNumLevels(long long numVPLs, int maxNumLevels, bool* isClamped)
+{
+	// the finest level gets about 10 vertices per VPL
+	long long numEstDenseVPLs = numVPLs * 10;
+	if (isClamped) *isClamped = false;
+	for (int i = 2; i <= maxNumLevels; i++)
+	{
+		long long dimLen = 1ll << (i - 1);
+		if (dimLen * dimLen * dimLen > numEstDenseVPLs) return i;
+	}
+	if (isClamped) *isClamped = true;
+	return maxNumLevels;
+}
+
+void CPULGHBuilder::Init(int _highestLevel, int _numThreads, bool _isVPLSortEnabled, bool _isTiledGatherEnabled, bool _isDeterministic,
+	int _gatherTileSize, bool _isIncrementalEnabled)
+{
+	highestLevel = _highestLevel;
+	numThreads = _numThreads > 0 ? _numThreads : GetNumHardwareThreads();
+	isVPLSortEnabled = _isVPLSortEnabled;
+	isTiledGatherEnabled = _isTiledGatherEnabled;
+	isDeterministic = _isDeterministic;
+	gatherTileSize = std::max(1, _gatherTileSize);
+	isIncrementalEnabled = _isIncrementalEnabled;
+	isAVX2Enabled = IsAVX2Supported();
+	threadPool.Resize(numThreads);
+	levelSizes.assign(highestLevel + 1, 0);
+	levels.resize(highestLevel + 1);
+	TablesAtLevel.resize(highestLevel + 1);
+	TableOfPlaneAtLevel.resize(highestLevel + 1);
+	SlabStartAtLevel.resize(highestLevel + 1);
+	VertexIdsAtLevel.assign(highestLevel + 1, std::vector<uint32_t>());
+	dirtyStart.assign(highestLevel + 1, 0);
+	dirtyEnd.assign(highestLevel + 1, 0);
+}
+
+void CPULGHBuilder::Build(int _numVPLs, const glm::vec4* _vplPositions, const glm::vec4* _vplNormals, const glm::vec4* _vplColors,
+	bool isBuildFromS1)
+{
+	CPUThreadPool::Scope poolScope(threadPool);
+	numVPLs = _numVPLs;
+	vplPositions = _vplPositions;
+	vplNormals = _vplNormals;
+	vplColors = _vplColors;
+
+	levelSizes.assign(highestLevel + 1, 0);
+	levelSizes[0] = numVPLs;
+	isLastBuildFromS1 = isBuildFromS1;
+	numIncrementalUpdates = 0;
+	for (int i = 0; i < 3; i++) lastVPLs[i].clear();
+	if (numVPLs <= 0) return;
+
+	stageTimings.clear();
+	if (isIncrementalEnabled) TimeStage("Snapshot VPLs", [&]()
+	{
+		lastVPLs[0].assign(vplPositions, vplPositions + numVPLs);
+		lastVPLs[1].assign(vplNormals, vplNormals + numVPLs);
+		lastVPLs[2].assign(vplColors, vplColors + numVPLs);
+		return (uint64_t)numVPLs * 6 * sizeof(glm::vec4);
+	});
+
+	TimeStage("Find BBox", [&]()
+	{
+		FindBoundingBox(numVPLs, vplPositions);
+		return (uint64_t)numVPLs * sizeof(glm::vec4);
+	});
+
+	if (isVPLSortEnabled) TimeStage("Sort VPLs", [&]()
+	{
+		SortVPLs(numVPLs);
+		return (uint64_t)numVPLs * (4 * sizeof(glm::vec4) + 2 * sizeof(uint32_t));
+	});
+
+	TimeStage("Splat level 1", [&]() { return SplatStage(1, numVPLs, vplPositions, vplNormals, vplColors); });
+	TimeStage("Compact level 1", [&]() { return CompactStage(1); });
+
+	for (int i = 2; i <= highestLevel; i++)
+	{
+		if (isBuildFromS1)
+			TimeStage("Gather level " + std::to_string(i), [&]() { return GatherStage(i); });
+		else
+			TimeStage("Splat level " + std::to_string(i), [&]() { return SplatStage(i, numVPLs, vplPositions, vplNormals, vplColors); });
+		TimeStage("Compact level " + std::to_string(i), [&]() { return CompactStage(i); });
+	}
+
+	for (int i = 1; i <= highestLevel; i++)
+	{
+		dirtyStart[i] = 0;
+		dirtyEnd[i] = levelSizes[i];
+	}
+}
+
+void CPULGHBuilder::BuildStreamed(CPUVPLSource& source, int batchSize, bool isBuildFromS1)
+{
+	CPUThreadPool::Scope poolScope(threadPool);
+	batchSize = std::max(1, batchSize);
+	numVPLs = 0;
+	levelSizes.assign(highestLevel + 1, 0);
+	isLastBuildFromS1 = isBuildFromS1;
+	numIncrementalUpdates = 0;
+	for (int i = 0; i < 3; i++) lastVPLs[i].clear();
+
+	std::vector<glm::vec4> batch[3];
+	for (int i = 0; i < 3; i++) batch[i].resize(batchSize);
+
+	// pass 1: bounding box, the time includes reading the source
+	glm::vec3 bbox_min(FLT_MAX);
+	glm::vec3 bbox_max(-FLT_MAX);
+	long long numRead = 0;
+	stageTimings.clear();
+	TimeStage("Find BBox", [&]()
+	{
+		source.Rewind();
+		for (int n; (n = source.Read(batchSize, batch[0].data(), batch[1].data(), batch[2].data())) > 0;)
+		{
+			GrowBoundingBox(n, batch[0].data(), bbox_min, bbox_max);
+			numRead += n;
+		}
+		return (uint64_t)numRead * 3 * sizeof(glm::vec4);
+	});
+	numVPLs = (int)std::min<long long>(numRead, INT_MAX);
+	levelSizes[0] = numVPLs;
+	if (numVPLs <= 0) return;
+	SetBoundingBox(bbox_min, bbox_max);
+
+	// pass 2: splat batch by batch into the level tables
+	bool isAccumulating = false;
+	int numLevelsSplatted = isBuildFromS1 ? 1 : highestLevel;
+	source.Rewind();
+	while (true)
+	{
+		int n = 0;
+		TimeStage("Read VPLs", [&]()
+		{
+			n = source.Read(batchSize, batch[0].data(), batch[1].data(), batch[2].data());
+			return (uint64_t)n * 3 * sizeof(glm::vec4);
+		});
+		if (n <= 0) break;
+		vplPositions = batch[0].data();
+		vplNormals = batch[1].data();
+		vplColors = batch[2].data();
+		if (isVPLSortEnabled) TimeStage("Sort VPLs", [&]()
+		{
+			SortVPLs(n);
+			return (uint64_t)n * (4 * sizeof(glm::vec4) + 2 * sizeof(uint32_t));
+		});
+		for (int i = 1; i <= numLevelsSplatted; i++)
+		{
+			TimeStage("Splat level " + std::to_string(i), [&]() { return SplatStage(i, n, vplPositions, vplNormals, vplColors, isAccumulating); });
+		}
+		isAccumulating = true;
+	}
+	vplPositions = vplNormals = vplColors = nullptr;
+
+	// release the batch before the levels are compacted
+	for (int i = 0; i < 3; i++)
+	{
+		std::vector<glm::vec4>().swap(batch[i]);
+		std::vector<glm::vec4>().swap(SortedVPLs[i]);
+	}
+	std::vector<uint32_t>().swap(mortonKeys);
+	std::vector<uint32_t>().swap(sortedIndices);
+	std::vector<int>().swap(vplCellZ);
+	std::vector<int>().swap(slabSortedVPLs);
+
+	for (int i = 1; i <= highestLevel; i++)
+	{
+		if (i > numLevelsSplatted) TimeStage("Gather level " + std::to_string(i), [&]() { return GatherStage(i); });
+		TimeStage("Compact level " + std::to_string(i), [&]() { return CompactStage(i); });
+		dirtyStart[i] = 0;
+		dirtyEnd[i] = levelSizes[i];
+	}
+}
+
+uint64_t CPULGHBuilder::GetNumTableEntries(int level) const
+{
+	uint64_t numEntries = 0;
+	for (const CPULGHVertexTable& table : TablesAtLevel[level]) numEntries += table.Size();
+	return numEntries;
+}
+
+// the points are read (position, normal, color) and the occupied vertices written
+uint64_t CPULGHBuilder::SplatStage(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+	bool isAccumulating)
+{
+	SplatForLevel(level, numPoints, positions, normals, colors, isAccumulating);
+	return (uint64_t)numPoints * 3 * sizeof(glm::vec4) + GetNumTableEntries(level) * sizeof(CPULGHVertex);
+}
+
+// the S1 vertices are read and the occupied vertices written
+uint64_t CPULGHBuilder::GatherStage(int level)
+{
+	GatherForLevel(level);
+	return (uint64_t)levelSizes[1] * 4 * sizeof(glm::vec4) + GetNumTableEntries(level) * sizeof(CPULGHVertex);
+}
+
+// the occupied vertices are read and the compacted level (4 attributes and the vertex id) written
+uint64_t CPULGHBuilder::CompactStage(int level)
+{
+	CompactLevel(level);
+	return GetNumTableEntries(level) * sizeof(CPULGHVertex) + (uint64_t)levelSizes[level] * (4 * sizeof(glm::vec4) + sizeof(uint32_t));
+}
+
+void CPULGHBuilder::FindBoundingBox(int numPoints, const glm::vec4* positions)
+{
+	CPUThreadPool::Scope poolScope(threadPool);
+	glm::vec3 bbox_min(FLT_MAX);
+	glm::vec3 bbox_max(-FLT_MAX);
+	GrowBoundingBox(numPoints, positions, bbox_min, bbox_max);
+	SetBoundingBox(bbox_min, bbox_max);
+}
+
+void CPULGHBuilder::GrowBoundingBox(int numPoints, const glm::vec4* positions, glm::vec3& bbox_min, glm::vec3& bbox_max)
+{
+	int numRanges = std::min(numThreads, numPoints);
+	if (numRanges <= 0) return;
+	std::vector<glm::vec4> rangeMin(numRanges);
+	std::vector<glm::vec4> rangeMax(numRanges);
+
+	// a float4 position is one SSE register, min and max are found in the same pass (w is ignored)
+	ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+	{
+		__m128 min0 = _mm_set1_ps(FLT_MAX), min1 = min0;
+		__m128 max0 = _mm_set1_ps(-FLT_MAX), max1 = max0;
+		const float* p = &positions[0].x;
+		int i = begin;
+		for (; i + 1 < end; i += 2)
+		{
+			__m128 p0 = _mm_loadu_ps(p + 4 * i);
+			__m128 p1 = _mm_loadu_ps(p + 4 * i + 4);
+			min0 = _mm_min_ps(min0, p0);
+			max0 = _mm_max_ps(max0, p0);
+			min1 = _mm_min_ps(min1, p1);
+			max1 = _mm_max_ps(max1, p1);
+		}
+		if (i < end)
+		{
+			__m128 p0 = _mm_loadu_ps(p + 4 * i);
+			min0 = _mm_min_ps(min0, p0);
+			max0 = _mm_max_ps(max0, p0);
+		}
+		_mm_storeu_ps(&rangeMin[rangeId].x, _mm_min_ps(min0, min1));
+		_mm_storeu_ps(&rangeMax[rangeId].x, _mm_max_ps(max0, max1));
+	});
+
+	for (int rangeId = 0; rangeId < numRanges; rangeId++)
+	{
+		bbox_min = glm::min(bbox_min, glm::vec3(rangeMin[rangeId]));
+		bbox_max = glm::max(bbox_max, glm::vec3(rangeMax[rangeId]));
+	}
+}
+
+void CPULGHBuilder::SetBoundingBox(const glm::vec3& bbox_min, const glm::vec3& bbox_max)
+{
+	glm::vec3 bbox_dim = bbox_max - bbox_min;
+	highestCellSize = fmaxf(bbox_dim.x, fmaxf(bbox_dim.y, bbox_dim.z)) * 1.1f;
+	glm::vec3 center = (bbox_max + bbox_min) / 2.f;
+	lgh_corner = center - glm::vec3(highestCellSize / 2);
+
+	baseRadius = highestCellSize / (1 << highestLevel);
+}
+
+
+void CPULGHBuilder::SortVPLs(int numPoints)
+{
+	int numCells1D = 1 << (highestLevel - 1);
+	float cellSize = highestCellSize / numCells1D;
+	glm::vec3 corner = lgh_corner;
+
+	mortonKeys.resize(numPoints);
+	sortedIndices.resize(numPoints);
+	ParallelFor(0, numPoints, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::ivec3 cellId = GetCellId((glm::vec3(vplPositions[i]) - corner) / cellSize, numCells1D);
+			mortonKeys[i] = EncodeMorton3(cellId.x, cellId.y, cellId.z);
+			sortedIndices[i] = i;
+		}
+	});
+
+	ParallelRadixSort(mortonKeys, sortedIndices, 30, numThreads);
+
+	// reorder all attributes in one pass
+	for (int i = 0; i < 3; i++) SortedVPLs[i].resize(numPoints);
+	ParallelFor(0, numPoints, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			uint32_t src = sortedIndices[i];
+			SortedVPLs[0][i] = vplPositions[src];
+			SortedVPLs[1][i] = vplNormals[src];
+			SortedVPLs[2][i] = vplColors[src];
+		}
+	});
+
+	vplPositions = SortedVPLs[0].data();
+	vplNormals = SortedVPLs[1].data();
+	vplColors = SortedVPLs[2].data();
+}
+
+void CPULGHBuilder::SplatForLevel(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+	bool isAccumulating)
+{
+	if (isDeterministic)
+	{
+		SplatForLevelSorted(level, numPoints, positions, normals, colors, isAccumulating);
+		return;
+	}
+
+	int numCells1D = 1 << (highestLevel - level);
+	int levelRes = numCells1D + 1;
+	int planeSize = levelRes * levelRes;
+	int numVerts = planeSize * levelRes;
+	float cellSize = highestCellSize / numCells1D;
+	glm::vec3 corner = lgh_corner;
+
+	std::vector<CPULGHVertexTable>& tables = TablesAtLevel[level];
+	std::vector<int>& tableOfPlane = TableOfPlaneAtLevel[level];
+	int numRanges = std::min(numThreads, numPoints);
+
+	if (numPoints == 0)
+	{
+		if (isAccumulating) return;
+		tables.resize(1);
+		tables[0].Clear();
+		tableOfPlane.assign(levelRes, 0);
+	}
+	else if (numThreads > 1 && numCells1D < 2 * numThreads)
+	{
+		// coarse levels: too few z layers to cut into slabs, so every thread splats a contiguous
+		// range of points into a private dense grid. A grid is at most (2 * numThreads + 1)^3 vertices,
+		// so the number of ranges is capped to keep all grids within COARSE_GRIDS_BYTES.
+		size_t gridBytes = (size_t)numVerts * sizeof(CPULGHVertex);
+		numRanges = std::max(1, (int)std::min<size_t>(numRanges, COARSE_GRIDS_BYTES / gridBytes));
+		threadGrids.resize(numRanges);
+		ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+		{
+			std::vector<CPULGHVertex>& grid = threadGrids[rangeId];
+			grid.assign(numVerts, CPULGHVertex());
+			auto vertexAt = [&](const glm::ivec3& v) -> CPULGHVertex& { return grid[v.x + v.y * levelRes + v.z * planeSize]; };
+			for (int i = begin; i < end; i++)
+			{
+				glm::vec3 p(positions[i]);
+				glm::vec3 normPos = (p - corner) / cellSize;
+				SplatVPL(p, glm::vec3(normals[i]), glm::vec3(colors[i]), normPos, GetCellId(normPos, numCells1D), vertexAt, isAVX2Enabled);
+			}
+		});
+
+		ParallelFor(0, numVerts, 4096, numThreads, [&](int begin, int end, int)
+		{
+			for (int v = begin; v < end; v++)
+			{
+				for (int rangeId = 1; rangeId < numRanges; rangeId++) threadGrids[0][v].Add(threadGrids[rangeId][v]);
+			}
+		});
+
+		const std::vector<CPULGHVertex>& grid = threadGrids[0];
+		int numTouched = ParallelCompactIndices(numVerts, [&](int v) { return grid[v].numContributors > 0; }, occupiedSlots, numThreads);
+		if (!isAccumulating || tables.size() != 1)
+		{
+			tables.resize(1);
+			tables[0].Clear(numTouched);
+			tableOfPlane.assign(levelRes, 0);
+		}
+		tables[0].ReserveAdditional(numTouched);
+		for (uint32_t v : occupiedSlots) tables[0][v].Add(grid[v]);
+	}
+	else
+	{
+		// fine levels: the grid is cut into z slabs balanced by point count. A thread owns the
+		// vertex planes [slabStart, slabEnd) and accumulates them in its own table; the shared
+		// plane slabEnd goes to a private halo table that is merged into the owner afterwards.
+		int numSlabs = numThreads;
+
+		vplCellZ.resize(numPoints);
+		std::vector<std::vector<int>> rangeHistogram(numRanges);
+		ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+		{
+			std::vector<int>& histogram = rangeHistogram[rangeId];
+			histogram.assign(numCells1D, 0);
+			for (int i = begin; i < end; i++)
+			{
+				glm::vec3 normPos = (glm::vec3(positions[i]) - corner) / cellSize;
+				int cellZ = GetCellId(normPos, numCells1D).z;
+				vplCellZ[i] = cellZ;
+				histogram[cellZ]++;
+			}
+		});
+
+		// streamed batches keep the partition of the first batch, their vertices are already in the slab tables
+		std::vector<int>& slabStart = SlabStartAtLevel[level];
+		std::vector<int> slabOfCellZ(numCells1D);
+		bool isPartitionKept = isAccumulating && (int)slabStart.size() == numSlabs + 1 && (int)tables.size() == numSlabs;
+		if (isPartitionKept)
+		{
+			for (int slab = 0; slab < numSlabs; slab++)
+			{
+				for (int z = slabStart[slab]; z < slabStart[slab + 1]; z++) slabOfCellZ[z] = slab;
+			}
+		}
+		else
+		{
+			slabStart.resize(numSlabs + 1);
+			long long cdf = 0;
+			int slabId = 1;
+			slabStart[0] = 0;
+			for (int z = 0; z < numCells1D; z++)
+			{
+				for (int rangeId = 0; rangeId < numRanges; rangeId++) cdf += rangeHistogram[rangeId][z];
+				while (slabId < numSlabs && cdf >= (long long)numPoints * slabId / numSlabs) slabStart[slabId++] = z + 1;
+			}
+			while (slabId <= numSlabs) slabStart[slabId++] = numCells1D;
+			for (int slab = 0; slab < numSlabs; slab++)
+			{
+				for (int z = slabStart[slab]; z < slabStart[slab + 1]; z++) slabOfCellZ[z] = slab;
+			}
+		}
+
+		// plane z belongs to the slab of cell layer z, the last plane to the slab of the last layer
+		tableOfPlane.resize(levelRes);
+		for (int z = 0; z < levelRes; z++) tableOfPlane[z] = slabOfCellZ[std::min(z, numCells1D - 1)];
+
+		// counting sort of point ids by slab, using the same ranges as the histogram pass
+		std::vector<int> rangeSlabOffset(numRanges * numSlabs);
+		std::vector<int> slabOffset(numSlabs + 1);
+		{
+			int offset = 0;
+			for (int slab = 0; slab < numSlabs; slab++)
+			{
+				slabOffset[slab] = offset;
+				for (int rangeId = 0; rangeId < numRanges; rangeId++)
+				{
+					rangeSlabOffset[rangeId * numSlabs + slab] = offset;
+					for (int z = slabStart[slab]; z < slabStart[slab + 1]; z++) offset += rangeHistogram[rangeId][z];
+				}
+			}
+			slabOffset[numSlabs] = offset;
+		}
+
+		slabSortedVPLs.resize(numPoints);
+		ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+		{
+			int* offsets = &rangeSlabOffset[rangeId * numSlabs];
+			for (int i = begin; i < end; i++)
+			{
+				slabSortedVPLs[offsets[slabOfCellZ[vplCellZ[i]]]++] = i;
+			}
+		});
+
+		tables.resize(numSlabs);
+		haloTables.resize(numSlabs);
+		ParallelRun(numSlabs, [&](int slab)
+		{
+			int slabEnd = slabStart[slab + 1];
+			bool ownsLastPlane = slabEnd == numCells1D;
+			CPULGHVertexTable& table = tables[slab];
+			CPULGHVertexTable& halo = haloTables[slab];
+			if (!isPartitionKept) table.Clear(table.Size());
+			halo.Clear(halo.Size());
+			auto vertexAt = [&](const glm::ivec3& v) -> CPULGHVertex&
+			{
+				uint32_t nid = v.x + v.y * levelRes + v.z * planeSize;
+				return (v.z < slabEnd || ownsLastPlane) ? table[nid] : halo[nid];
+			};
+			for (int k = slabOffset[slab]; k < slabOffset[slab + 1]; k++)
+			{
+				int i = slabSortedVPLs[k];
+				glm::vec3 p(positions[i]);
+				glm::vec3 normPos = (p - corner) / cellSize;
+				glm::ivec3 cellId = GetCellId(normPos, numCells1D);
+				cellId.z = vplCellZ[i]; // keep the slab assignment authoritative
+				table.ReserveAdditional(8); // corner references must survive the other corners' insertions
+				halo.ReserveAdditional(8);
+				SplatVPL(p, glm::vec3(normals[i]), glm::vec3(colors[i]), normPos, cellId, vertexAt, isAVX2Enabled);
+			}
+		});
+
+		// the halo plane of a non-empty slab is the first plane of the next non-empty slab
+		std::vector<int> haloOfSlab(numSlabs, -1);
+		for (int slab = 0; slab < numSlabs; slab++)
+		{
+			if (slabOffset[slab] < slabOffset[slab + 1] && slabStart[slab + 1] < numCells1D)
+				haloOfSlab[slabOfCellZ[slabStart[slab + 1]]] = slab;
+		}
+		ParallelRun(numSlabs, [&](int slab)
+		{
+			if (haloOfSlab[slab] < 0) return;
+			const CPULGHVertexTable& halo = haloTables[haloOfSlab[slab]];
+			CPULGHVertexTable& table = tables[slab];
+			for (size_t slot = 0; slot < halo.Capacity(); slot++)
+			{
+				if (halo.KeyAt(slot) != CPULGHVertexTable::EMPTY_KEY) table[halo.KeyAt(slot)].Add(halo.ValueAt(slot));
+			}
+		});
+	}
+}
+
+void CPULGHBuilder::SplatForLevelSorted(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+	bool isAccumulating)
+{
+	// Deterministic splat: every point emits a (vertex id, point) pair per cell corner, the pairs are
+	// radix sorted by vertex id (stable, so a vertex sees its points in increasing order) and every
+	// vertex is reduced in that order with scalar math. Neither the sort result nor the reduction order
+	// depends on the thread count, so neither do the bits. Costs 8 pairs of scratch per point.
+	int numCells1D = 1 << (highestLevel - level);
+	int levelRes = numCells1D + 1;
+	int planeSize = levelRes * levelRes;
+	float cellSize = highestCellSize / numCells1D;
+	glm::vec3 corner = lgh_corner;
+	int numVertIdBits = 1;
+	while ((1ll << numVertIdBits) < (long long)planeSize * levelRes) numVertIdBits++;
+
+	pairVertexIds.resize((size_t)numPoints * 8);
+	pairPoints.resize((size_t)numPoints * 8);
+	ParallelFor(0, numPoints, 16384, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::ivec3 cellId = GetCellId((glm::vec3(positions[i]) - corner) / cellSize, numCells1D);
+			for (int vId = 0; vId < 8; vId++)
+			{
+				glm::ivec3 v = cellId + GetCornerOffset(vId);
+				pairVertexIds[8 * (size_t)i + vId] = v.x + v.y * levelRes + v.z * planeSize;
+				pairPoints[8 * (size_t)i + vId] = i;
+			}
+		}
+	});
+	ParallelRadixSort(pairVertexIds, pairPoints, numVertIdBits, numThreads);
+
+	// fixed slabs of vertex planes, so streamed batches land in the same tables
+	int numSlabs = std::max(1, std::min(numThreads, levelRes));
+	std::vector<CPULGHVertexTable>& tables = TablesAtLevel[level];
+	std::vector<int>& tableOfPlane = TableOfPlaneAtLevel[level];
+	std::vector<int>& slabStart = SlabStartAtLevel[level];
+	bool isPartitionKept = isAccumulating && (int)tables.size() == numSlabs && (int)slabStart.size() == numSlabs + 1;
+	if (!isPartitionKept)
+	{
+		tables.resize(numSlabs);
+		slabStart.resize(numSlabs + 1);
+		for (int slab = 0; slab <= numSlabs; slab++) slabStart[slab] = (int)((long long)levelRes * slab / numSlabs);
+		tableOfPlane.resize(levelRes);
+		for (int slab = 0; slab < numSlabs; slab++)
+		{
+			for (int z = slabStart[slab]; z < slabStart[slab + 1]; z++) tableOfPlane[z] = slab;
+		}
+	}
+
+	size_t numPairs = pairVertexIds.size();
+	ParallelRun(numSlabs, [&](int slab)
+	{
+		size_t first = std::lower_bound(pairVertexIds.begin(), pairVertexIds.end(), (uint32_t)(slabStart[slab] * planeSize)) - pairVertexIds.begin();
+		size_t last = std::lower_bound(pairVertexIds.begin(), pairVertexIds.end(), (uint32_t)(slabStart[slab + 1] * planeSize)) - pairVertexIds.begin();
+		CPULGHVertexTable& table = tables[slab];
+		int numSegments = first < last ? 1 : 0;
+		for (size_t k = first + 1; k < last; k++) numSegments += pairVertexIds[k] != pairVertexIds[k - 1];
+		if (!isPartitionKept) table.Clear(numSegments);
+		table.ReserveAdditional(numSegments);
+		for (size_t k = first; k < last;)
+		{
+			uint32_t nid = pairVertexIds[k];
+			glm::ivec3 v(nid % levelRes, (nid / levelRes) % levelRes, nid / planeSize);
+			CPULGHVertex vert;
+			for (; k < numPairs && pairVertexIds[k] == nid; k++)
+			{
+				int i = pairPoints[k];
+				glm::vec3 p(positions[i]);
+				glm::vec3 normPos = (p - corner) / cellSize;
+				glm::ivec3 cellId = GetCellId(normPos, numCells1D);
+				glm::ivec3 offset = v - cellId;
+				vert.Accumulate(GetCornerWeight(offset.x + 2 * offset.y + 4 * offset.z, normPos - glm::vec3(cellId)), p, glm::vec3(normals[i]), glm::vec3(colors[i]));
+			}
+			table[nid].Add(vert);
+		}
+	});
+}
+
+void CPULGHBuilder::GatherForLevel(int level)
+{
+	// Every occupied S1 vertex p contributes to the 8 corners of its cell at this level with
+	// trilinear weights, which is exactly the set of vertices whose VertGatherCS window accepts p.
+	// With sparse S1 this is done as a splat of the normalized S1 vertices, so the cost follows
+	// the number of occupied S1 vertices instead of the dense gather windows.
+	if (isTiledGatherEnabled && !isDeterministic)
+	{
+		GatherForLevelTiled(level);
+		return;
+	}
+	const CPULGHLevel& levelone = levels[1];
+	SplatForLevel(level, levelSizes[1], levelone.position.data(), levelone.normal.data(), levelone.color.data());
+}
+
+void CPULGHBuilder::GatherForLevelTiled(int level)
+{
+	// The level is cut into tiles of gatherTileSize^3 vertices, the last tile of an axis also owns
+	// the last vertex plane. An S1 vertex is listed under every tile that owns one of the 8 corners
+	// of its cell (mostly just one), and a tile accumulates only its own vertices, in a dense grid
+	// that stays in cache. So tiles need no merging, and a tile with many S1 vertices (coarse
+	// levels) is cut into chunks that are added in chunk order.
+	const int T = gatherTileSize;
+	const int MIN_CHUNK_SIZE = 4096;
+	int numCells1D = 1 << (highestLevel - level);
+	int levelRes = numCells1D + 1;
+	int planeSize = levelRes * levelRes;
+	float cellSize = highestCellSize / numCells1D;
+	glm::vec3 corner = lgh_corner;
+	int tilesPerAxis = std::max(1, numCells1D / T);
+	int numTiles = tilesPerAxis * tilesPerAxis * tilesPerAxis;
+	// the last tile of an axis also takes the cells left over when T does not divide the level,
+	// so the dense grid is sized by it (T + 1 when it does)
+	const int TILE_RES = levelRes - (tilesPerAxis - 1) * T;
+
+	const CPULGHLevel& levelone = levels[1];
+	int numPoints = levelSizes[1];
+	auto cellOf = [&](int i)
+	{
+		return GetCellId((glm::vec3(levelone.position[i]) - corner) / cellSize, numCells1D);
+	};
+	// calls func(tileId) for every tile owning a corner of the cell
+	auto forEachOwnerTile = [&](const glm::ivec3& cellId, const auto& func)
+	{
+		glm::ivec3 first = glm::min(cellId / T, tilesPerAxis - 1);
+		glm::ivec3 last = glm::min((cellId + 1) / T, tilesPerAxis - 1);
+		for (int z = first.z; z <= last.z; z++)
+			for (int y = first.y; y <= last.y; y++)
+				for (int x = first.x; x <= last.x; x++) func(x + y * tilesPerAxis + z * tilesPerAxis * tilesPerAxis);
+	};
+
+	// counting sort of the (tile, S1 entry) pairs: per-range tile histograms, tile-major scan, scatter.
+	// A single tile reads S1 as it is.
+	std::vector<size_t> tileStart(numTiles + 1, 0);
+	tileStart[numTiles] = numPoints;
+	if (numTiles > 1)
+	{
+		int numRanges = GetNumScanRanges(numPoints, numThreads);
+		tileHistograms.assign((size_t)numRanges * numTiles, 0);
+		ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+		{
+			size_t* histogram = &tileHistograms[(size_t)rangeId * numTiles];
+			for (int i = begin; i < end; i++) forEachOwnerTile(cellOf(i), [&](int tileId) { histogram[tileId]++; });
+		});
+		size_t numPairs = 0;
+		for (int tileId = 0; tileId < numTiles; tileId++)
+		{
+			tileStart[tileId] = numPairs;
+			for (int rangeId = 0; rangeId < numRanges; rangeId++)
+			{
+				size_t& count = tileHistograms[(size_t)rangeId * numTiles + tileId];
+				size_t offset = numPairs;
+				numPairs += count;
+				count = offset;
+			}
+		}
+		tileStart[numTiles] = numPairs;
+		tilePoints.resize(numPairs);
+		ParallelForStatic(0, numPoints, numRanges, [&](int begin, int end, int rangeId)
+		{
+			size_t* cursor = &tileHistograms[(size_t)rangeId * numTiles];
+			for (int i = begin; i < end; i++) forEachOwnerTile(cellOf(i), [&](int tileId) { tilePoints[cursor[tileId]++] = i; });
+		});
+	}
+	const int* pointOfPair = numTiles > 1 ? tilePoints.data() : nullptr;
+
+	// work items: one per non-empty tile, or up to numThreads chunks of a crowded one
+	struct GatherChunk
+	{
+		int tileId;
+		size_t begin;
+		size_t end;
+		std::vector<uint32_t> vertexIds; // occupied vertices of the tile, increasing
+		std::vector<CPULGHVertex> vertices;
+	};
+	std::vector<GatherChunk> chunks;
+	for (int tileId = 0; tileId < numTiles; tileId++)
+	{
+		size_t count = tileStart[tileId + 1] - tileStart[tileId];
+		if (count == 0) continue;
+		int numChunks = (int)std::max<size_t>(1, std::min<size_t>(numThreads, count / MIN_CHUNK_SIZE));
+		for (int k = 0; k < numChunks; k++)
+		{
+			GatherChunk chunk;
+			chunk.tileId = tileId;
+			chunk.begin = tileStart[tileId] + count * k / numChunks;
+			chunk.end = tileStart[tileId] + count * (k + 1) / numChunks;
+			chunks.push_back(std::move(chunk));
+		}
+	}
+
+	std::vector<std::vector<CPULGHVertex>> threadTiles(numThreads, std::vector<CPULGHVertex>(TILE_RES * TILE_RES * TILE_RES + 1));
+	ParallelForWorkStealing((int)chunks.size(), numThreads, [&](int chunkId, int threadId)
+	{
+		GatherChunk& chunk = chunks[chunkId];
+		std::vector<CPULGHVertex>& tile = threadTiles[threadId];
+		CPULGHVertex& outside = tile[TILE_RES * TILE_RES * TILE_RES]; // corners owned by other tiles land here and are dropped
+		glm::ivec3 tileCoord(chunk.tileId % tilesPerAxis, (chunk.tileId / tilesPerAxis) % tilesPerAxis, chunk.tileId / (tilesPerAxis * tilesPerAxis));
+		glm::ivec3 tileBase = tileCoord * T;
+		glm::ivec3 tileSize(T);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (tileCoord[axis] == tilesPerAxis - 1) tileSize[axis] = levelRes - tileBase[axis];
+		}
+		auto vertexAt = [&](const glm::ivec3& v) -> CPULGHVertex&
+		{
+			glm::ivec3 local = v - tileBase;
+			if ((unsigned)local.x >= (unsigned)tileSize.x || (unsigned)local.y >= (unsigned)tileSize.y || (unsigned)local.z >= (unsigned)tileSize.z) return outside;
+			return tile[local.x + local.y * TILE_RES + local.z * TILE_RES * TILE_RES];
+		};
+		for (size_t k = chunk.begin; k < chunk.end; k++)
+		{
+			int i = pointOfPair ? pointOfPair[k] : (int)k;
+			glm::vec3 p(levelone.position[i]);
+			glm::vec3 normPos = (p - corner) / cellSize;
+			SplatVPL(p, glm::vec3(levelone.normal[i]), glm::vec3(levelone.color[i]), normPos, GetCellId(normPos, numCells1D), vertexAt, isAVX2Enabled);
+		}
+
+		for (int z = 0; z < tileSize.z; z++)
+			for (int y = 0; y < tileSize.y; y++)
+				for (int x = 0; x < tileSize.x; x++)
+				{
+					CPULGHVertex& vert = tile[x + y * TILE_RES + z * TILE_RES * TILE_RES];
+					if (vert.numContributors <= 0) continue;
+					glm::ivec3 v = tileBase + glm::ivec3(x, y, z);
+					chunk.vertexIds.push_back(v.x + v.y * levelRes + v.z * planeSize);
+					chunk.vertices.push_back(vert);
+					vert = CPULGHVertex();
+				}
+		outside = CPULGHVertex();
+	});
+
+	// one table per row of tiles along z, which keeps the planes of a table contiguous like the splat slabs
+	std::vector<CPULGHVertexTable>& tables = TablesAtLevel[level];
+	std::vector<int>& tableOfPlane = TableOfPlaneAtLevel[level];
+	tables.resize(tilesPerAxis);
+	tableOfPlane.resize(levelRes);
+	for (int z = 0; z < levelRes; z++) tableOfPlane[z] = std::min(z / T, tilesPerAxis - 1);
+	SlabStartAtLevel[level].clear();
+
+	std::vector<int> firstChunkOfRow(tilesPerAxis + 1, (int)chunks.size());
+	for (int chunkId = (int)chunks.size() - 1; chunkId >= 0; chunkId--)
+		firstChunkOfRow[chunks[chunkId].tileId / (tilesPerAxis * tilesPerAxis)] = chunkId;
+	for (int row = tilesPerAxis - 1; row >= 0; row--) firstChunkOfRow[row] = std::min(firstChunkOfRow[row], firstChunkOfRow[row + 1]);
+	ParallelFor(0, tilesPerAxis, 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int row = begin; row < end; row++)
+		{
+			int numEntries = 0;
+			for (int chunkId = firstChunkOfRow[row]; chunkId < firstChunkOfRow[row + 1]; chunkId++) numEntries += (int)chunks[chunkId].vertexIds.size();
+			CPULGHVertexTable& table = tables[row];
+			table.Clear(numEntries);
+			for (int chunkId = firstChunkOfRow[row]; chunkId < firstChunkOfRow[row + 1]; chunkId++)
+			{
+				const GatherChunk& chunk = chunks[chunkId];
+				for (size_t k = 0; k < chunk.vertexIds.size(); k++) table[chunk.vertexIds[k]].Add(chunk.vertices[k]);
+			}
+		}
+	});
+}
+
+void CPULGHBuilder::CompactLevel(int level)
+{
+	std::vector<CPULGHVertexTable>& tables = TablesAtLevel[level];
+	int numTables = (int)tables.size();
+
+	// occupied slots of every table sorted by vertex id. Tables are scanned on their own, their
+	// slots can pass the int range together (and alone on the finest levels).
+	std::vector<std::vector<std::pair<uint32_t, size_t>>> sortedSlots(numTables);
+	ParallelFor(0, numTables, 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int t = begin; t < end; t++)
+		{
+			const CPULGHVertexTable& table = tables[t];
+			std::vector<std::pair<uint32_t, size_t>>& slots = sortedSlots[t];
+			slots.clear();
+			slots.reserve(table.Size());
+			for (size_t slot = 0; slot < table.Capacity(); slot++)
+			{
+				if (table.KeyAt(slot) != CPULGHVertexTable::EMPTY_KEY && table.ValueAt(slot).weight > 0) slots.push_back(std::make_pair(table.KeyAt(slot), slot));
+			}
+			std::sort(slots.begin(), slots.end());
+		}
+	});
+
+	// tables hold disjoint, increasing vertex id ranges, so the scan of their sizes gives the addresses
+	std::vector<size_t> tableStart(numTables + 1, 0);
+	for (int t = 0; t < numTables; t++) tableStart[t + 1] = tableStart[t] + sortedSlots[t].size();
+	levelSizes[level] = (int)tableStart[numTables];
+
+	VertexIdsAtLevel[level].resize(levelSizes[level]);
+	CPULGHLevel& compact = levels[level];
+	compact.position.resize(levelSizes[level]);
+	compact.normal.resize(levelSizes[level]);
+	compact.color.resize(levelSizes[level]);
+	compact.stdev.resize(levelSizes[level]);
+
+	// write to new address and normalize, as VplCompactionCS
+	ParallelFor(0, numTables, 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int t = begin; t < end; t++)
+		{
+			int addr = (int)tableStart[t];
+			for (const auto& entry : sortedSlots[t])
+			{
+				VertexIdsAtLevel[level][addr] = entry.first;
+				WriteCompactVertex(compact, addr, tables[t].ValueAt(entry.second), level);
+				addr++;
+			}
+		}
+	});
+}
+
+void CPULGHBuilder::CompressLevels()
+{
+	CPUThreadPool::Scope poolScope(threadPool);
+	compressedLevels.resize(highestLevel + 1);
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		const CPULGHLevel& compact = levels[level];
+		CPULGHCompressedLevel& compressed = compressedLevels[level];
+		int numCells1D = 1 << (highestLevel - level);
+		compressed.level = level;
+		compressed.levelRes = numCells1D + 1;
+		compressed.cellSize = highestCellSize / numCells1D;
+		compressed.corner = lgh_corner;
+		compressed.vertexIds = VertexIdsAtLevel[level];
+		compressed.vertices.resize(levelSizes[level]);
+
+		// colors are sums over many VPLs, so they are scaled per level to stay in the RGB9E5 range
+		float maxColor = 0.f;
+		float maxStdev = 0.f;
+		for (int addr = 0; addr < levelSizes[level]; addr++)
+		{
+			maxColor = std::max(maxColor, std::max(compact.color[addr].x, std::max(compact.color[addr].y, compact.color[addr].z)));
+			maxStdev = std::max(maxStdev, std::max(compact.stdev[addr].x, std::max(compact.stdev[addr].y, compact.stdev[addr].z)));
+		}
+		compressed.colorScale = maxColor > 0.f ? maxColor / 32768.f : 1.f;
+		compressed.stdevScale = maxStdev > 0.f ? maxStdev / 32768.f : 1.f;
+
+		ParallelFor(0, levelSizes[level], 65536, numThreads, [&](int begin, int end, int)
+		{
+			for (int addr = begin; addr < end; addr++)
+			{
+				compressed.vertices[addr] = compressed.Encode(compressed.vertexIds[addr],
+					compact.position[addr], compact.normal[addr], compact.color[addr], compact.stdev[addr]);
+			}
+		});
+	}
+}
+
+CPULGHCompressionError CPULGHBuilder::MeasureCompressionError(int level) const
+{
+	const CPULGHLevel& compact = levels[level];
+	const CPULGHCompressedLevel& compressed = compressedLevels[level];
+	auto maxChannel = [](const glm::vec4& v) { return std::max(v.x, std::max(v.y, v.z)); };
+	auto maxAbs = [](const glm::vec4& v) { return std::max(std::abs(v.x), std::max(std::abs(v.y), std::abs(v.z))); };
+
+	CPULGHCompressionError error;
+	for (int addr = 0; addr < (int)compressed.vertices.size(); addr++)
+	{
+		glm::vec4 position, normal, color, stdev;
+		compressed.Decode(addr, position, normal, color, stdev);
+		error.position = std::max(error.position, maxAbs(position - compact.position[addr]) / compressed.cellSize);
+		error.normal = std::max(error.normal, maxAbs(normal - compact.normal[addr]));
+		// below 2^-16 (times the level scale) RGB9E5 runs out of exponent, there the error is absolute
+		error.color = std::max(error.color, maxAbs(color - compact.color[addr]) /
+			std::max(maxChannel(compact.color[addr]), compressed.colorScale / 65536.f));
+		error.stdev = std::max(error.stdev, maxAbs(stdev - compact.stdev[addr]) /
+			std::max(maxChannel(compact.stdev[addr]), compressed.stdevScale / 65536.f));
+	}
+	return error;
+}
+
+bool CPULGHBuilder::Update(int _numVPLs, const glm::vec4* _vplPositions, const glm::vec4* _vplNormals, const glm::vec4* _vplColors,
+	int dirtyBegin, int dirtyEnd, bool isBuildFromS1, float maxDirtyFraction)
+{
+	CPUThreadPool::Scope poolScope(threadPool);
+	int lastNumVPLs = numVPLs;
+	if (lastNumVPLs <= 0 || _numVPLs <= 0 || isBuildFromS1 != isLastBuildFromS1 || isDeterministic || !isIncrementalEnabled) return false;
+	if ((int)lastVPLs[0].size() != lastNumVPLs) return false; // streamed build, there is no snapshot to diff
+	if (numIncrementalUpdates >= MAX_INCREMENTAL_UPDATES) return false; // rebuild before the removal residue adds up
+
+	// only the dirty range is read, so it has to hold every VPL past the last count
+	dirtyBegin = std::max(dirtyBegin, 0);
+	dirtyEnd = std::min(dirtyEnd, _numVPLs);
+	if (_numVPLs > lastNumVPLs && (dirtyBegin > lastNumVPLs || dirtyEnd < _numVPLs)) return false;
+
+	// changed VPLs by index: dirty indices whose attributes differ, plus the grown or shrunk tail
+	int numCommon = std::min(lastNumVPLs, _numVPLs);
+	int diffEnd = std::min(dirtyEnd, numCommon);
+	std::vector<int> changed;
+	if (diffEnd > dirtyBegin)
+	{
+		ParallelCompactIndices(diffEnd - dirtyBegin, [&](int k)
+		{
+			int i = dirtyBegin + k;
+			return memcmp(&lastVPLs[0][i], &_vplPositions[i], sizeof(glm::vec4)) != 0 ||
+				memcmp(&lastVPLs[1][i], &_vplNormals[i], sizeof(glm::vec4)) != 0 ||
+				memcmp(&lastVPLs[2][i], &_vplColors[i], sizeof(glm::vec4)) != 0;
+		}, changed, numThreads);
+		for (int& i : changed) i += dirtyBegin;
+	}
+	int numDirty = (int)changed.size() + std::abs(_numVPLs - lastNumVPLs);
+	if (numDirty > maxDirtyFraction * std::max(lastNumVPLs, _numVPLs)) return false;
+
+	// the bounding box (and so every cell) stays fixed, new VPLs have to lie inside of it
+	for (int i = numCommon; i < _numVPLs; i++) changed.push_back(i);
+	for (int i : changed)
+	{
+		glm::vec3 normPos = (glm::vec3(_vplPositions[i]) - lgh_corner) / highestCellSize;
+		if (glm::any(glm::lessThan(normPos, glm::vec3(0.f))) || glm::any(glm::greaterThan(normPos, glm::vec3(1.f)))) return false;
+	}
+	numIncrementalUpdates++;
+
+	CPULGHLevel removed, added;
+	for (int i : changed)
+	{
+		if (i < lastNumVPLs)
+		{
+			removed.position.push_back(lastVPLs[0][i]);
+			removed.normal.push_back(lastVPLs[1][i]);
+			removed.color.push_back(lastVPLs[2][i]);
+		}
+		added.position.push_back(_vplPositions[i]);
+		added.normal.push_back(_vplNormals[i]);
+		added.color.push_back(_vplColors[i]);
+	}
+	for (int i = _numVPLs; i < lastNumVPLs; i++)
+	{
+		removed.position.push_back(lastVPLs[0][i]);
+		removed.normal.push_back(lastVPLs[1][i]);
+		removed.color.push_back(lastVPLs[2][i]);
+	}
+
+	numVPLs = _numVPLs;
+	levelSizes[0] = numVPLs;
+	for (int a = 0; a < 3; a++) lastVPLs[a].resize(numVPLs);
+	for (int i : changed)
+	{
+		lastVPLs[0][i] = _vplPositions[i];
+		lastVPLs[1][i] = _vplNormals[i];
+		lastVPLs[2][i] = _vplColors[i];
+	}
+
+	std::vector<uint32_t> levelOneDirty;
+	SplatDelta(1, removed, added, levelOneDirty);
+
+	// coarser levels built from S1 see a dirty S1 vertex as one removed and one added point
+	CPULGHLevel removedS1, addedS1;
+	if (isBuildFromS1) GatherCompactVertices(1, levelOneDirty, removedS1);
+	RecompactLevel(1, levelOneDirty);
+	if (isBuildFromS1) GatherCompactVertices(1, levelOneDirty, addedS1);
+
+	// levels only read S1 or the VPLs, so they are updated in parallel
+	ParallelFor(2, highestLevel + 1, 1, numThreads, [&](int begin, int end, int)
+	{
+		std::vector<uint32_t> dirtyIds;
+		for (int level = begin; level < end; level++)
+		{
+			if (isBuildFromS1)
+				SplatDelta(level, removedS1, addedS1, dirtyIds);
+			else
+				SplatDelta(level, removed, added, dirtyIds);
+			RecompactLevel(level, dirtyIds);
+		}
+	});
+
+	return true;
+}
+
+void CPULGHBuilder::SplatDelta(int level, const CPULGHLevel& removed, const CPULGHLevel& added, std::vector<uint32_t>& dirtyIds)
+{
+	int numCells1D = 1 << (highestLevel - level);
+	int levelRes = numCells1D + 1;
+	int planeSize = levelRes * levelRes;
+	float cellSize = highestCellSize / numCells1D;
+	glm::vec3 corner = lgh_corner;
+
+	std::vector<CPULGHVertexTable>& tables = TablesAtLevel[level];
+	const std::vector<int>& tableOfPlane = TableOfPlaneAtLevel[level];
+
+	// same cells and weights as SplatForLevel, so a removal cancels the original splat
+	dirtyIds.clear();
+	auto splat = [&](const CPULGHLevel& points, bool isRemoval)
+	{
+		for (size_t i = 0; i < points.position.size(); i++)
+		{
+			glm::vec3 p(points.position[i]);
+			glm::vec3 n(points.normal[i]);
+			glm::vec3 c(points.color[i]);
+			glm::vec3 normPos = (p - corner) / cellSize;
+			glm::ivec3 cellId = GetCellId(normPos, numCells1D);
+			glm::vec3 interp = normPos - glm::vec3(cellId);
+			for (int vId = 0; vId < 8; vId++)
+			{
+				glm::ivec3 v = cellId + GetCornerOffset(vId);
+				uint32_t nid = v.x + v.y * levelRes + v.z * planeSize;
+				CPULGHVertex& vert = tables[tableOfPlane[v.z]][nid];
+				if (isRemoval)
+					vert.Remove(GetCornerWeight(vId, interp), p, n, c);
+				else
+					vert.Accumulate(GetCornerWeight(vId, interp), p, n, c);
+				dirtyIds.push_back(nid);
+			}
+		}
+	};
+	splat(removed, true);
+	splat(added, false);
+
+	std::sort(dirtyIds.begin(), dirtyIds.end());
+	dirtyIds.erase(std::unique(dirtyIds.begin(), dirtyIds.end()), dirtyIds.end());
+}
+
+void CPULGHBuilder::RecompactLevel(int level, const std::vector<uint32_t>& dirtyIds)
+{
+	std::vector<uint32_t>& vertexIds = VertexIdsAtLevel[level];
+	CPULGHLevel& compact = levels[level];
+	int numDirty = (int)dirtyIds.size();
+
+	// a dirty vertex keeps its entry unless it became empty or was empty before
+	bool isLayoutChanged = false;
+	std::vector<const CPULGHVertex*> dirtyVerts(numDirty);
+	std::vector<int> oldAddr(numDirty);
+	for (int k = 0; k < numDirty; k++)
+	{
+		const CPULGHVertex* vert = FindVertex(level, dirtyIds[k]);
+		dirtyVerts[k] = (vert && vert->weight > 0) ? vert : nullptr;
+		auto it = std::lower_bound(vertexIds.begin(), vertexIds.end(), dirtyIds[k]);
+		oldAddr[k] = (it != vertexIds.end() && *it == dirtyIds[k]) ? int(it - vertexIds.begin()) : -1;
+		if ((oldAddr[k] >= 0) != (dirtyVerts[k] != nullptr)) isLayoutChanged = true;
+	}
+
+	if (!isLayoutChanged)
+	{
+		// renormalize in place
+		dirtyStart[level] = levelSizes[level];
+		dirtyEnd[level] = 0;
+		for (int k = 0; k < numDirty; k++)
+		{
+			if (!dirtyVerts[k]) continue;
+			WriteCompactVertex(compact, oldAddr[k], *dirtyVerts[k], level);
+			dirtyStart[level] = std::min(dirtyStart[level], oldAddr[k]);
+			dirtyEnd[level] = std::max(dirtyEnd[level], oldAddr[k] + 1);
+		}
+		if (dirtyStart[level] >= dirtyEnd[level]) dirtyStart[level] = dirtyEnd[level] = 0;
+		return;
+	}
+
+	// merge the unchanged entries with the dirty ones, everything behind the first dirty entry moves
+	int oldSize = levelSizes[level];
+	int maxSize = oldSize + numDirty;
+	std::vector<uint32_t> newIds(maxSize);
+	CPULGHLevel merged;
+	merged.position.resize(maxSize);
+	merged.normal.resize(maxSize);
+	merged.color.resize(maxSize);
+	merged.stdev.resize(maxSize);
+
+	int addr = 0;
+	int i = 0;
+	for (int k = 0; k < numDirty; k++)
+	{
+		for (; i < oldSize && vertexIds[i] < dirtyIds[k]; i++, addr++)
+		{
+			newIds[addr] = vertexIds[i];
+			merged.position[addr] = compact.position[i];
+			merged.normal[addr] = compact.normal[i];
+			merged.color[addr] = compact.color[i];
+			merged.stdev[addr] = compact.stdev[i];
+		}
+		if (k == 0) dirtyStart[level] = addr;
+		if (oldAddr[k] >= 0) i++;
+		if (dirtyVerts[k])
+		{
+			newIds[addr] = dirtyIds[k];
+			WriteCompactVertex(merged, addr, *dirtyVerts[k], level);
+			addr++;
+		}
+	}
+	for (; i < oldSize; i++, addr++)
+	{
+		newIds[addr] = vertexIds[i];
+		merged.position[addr] = compact.position[i];
+		merged.normal[addr] = compact.normal[i];
+		merged.color[addr] = compact.color[i];
+		merged.stdev[addr] = compact.stdev[i];
+	}
+
+	newIds.resize(addr);
+	merged.position.resize(addr);
+	merged.normal.resize(addr);
+	merged.color.resize(addr);
+	merged.stdev.resize(addr);
+	vertexIds.swap(newIds);
+	std::swap(compact, merged);
+	levelSizes[level] = addr;
+	dirtyEnd[level] = addr;
+	dirtyStart[level] = std::min(dirtyStart[level], addr);
+}
+
+void CPULGHBuilder::GatherCompactVertices(int level, const std::vector<uint32_t>& vertIds, CPULGHLevel& out)
+{
+	const std::vector<uint32_t>& vertexIds = VertexIdsAtLevel[level];
+	const CPULGHLevel& compact = levels[level];
+	out = CPULGHLevel();
+	for (uint32_t vertId : vertIds)
+	{
+		auto it = std::lower_bound(vertexIds.begin(), vertexIds.end(), vertId);
+		if (it == vertexIds.end() || *it != vertId) continue;
+		size_t addr = it - vertexIds.begin();
+		out.position.push_back(compact.position[addr]);
+		out.normal.push_back(compact.normal[addr]);
+		out.color.push_back(compact.color[addr]);
+	}
+}
+
+const CPULGHVertex* CPULGHBuilder::FindVertex(int level, uint32_t vertId)
+{
+	int levelRes = (1 << (highestLevel - level)) + 1;
+	int z = vertId / (levelRes * levelRes);
+	return TablesAtLevel[level][TableOfPlaneAtLevel[level][z]].Find(vertId);
+}
@@ -0,0 +1,351 @@
+#pragma once
+#include "CPUMath.h"
+#include "CPUParallel.h"
+#include "CPULGHCompression.h"
+#include "CPUScan.h"
+#include "CPUSort.h"
+#include "CPUVPLStream.h"
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <string>
+
+// accumulated (not yet normalized) attributes of one grid vertex, padded to 16 floats
+// (one cache line) so the SIMD splat can update it with two 8-lane loads/stores
+struct CPULGHVertex
+{
+	glm::vec3 position = glm::vec3(0.f);
+	glm::vec3 normal = glm::vec3(0.f);
+	glm::vec3 color = glm::vec3(0.f);
+	glm::vec3 stdev = glm::vec3(0.f);
+	float weight = 0.f;
+	float numContributors = 0.f; // lets an incremental update clear a vertex exactly once its last point is removed
+	float padding[2] = { 0.f, 0.f };
+
+	void Accumulate(float w, const glm::vec3& p, const glm::vec3& n, const glm::vec3& c)
+	{
+		position += w * p;
+		normal += w * n;
+		color += w * c;
+		stdev += w * p * p;
+		weight += w;
+		numContributors += 1.f;
+	}
+
+	// undoes Accumulate(w, p, n, c)
+	void Remove(float w, const glm::vec3& p, const glm::vec3& n, const glm::vec3& c)
+	{
+		numContributors -= 1.f;
+		if (numContributors <= 0.f)
+		{
+			*this = CPULGHVertex(); // drop the rounding residue
+			return;
+		}
+		position -= w * p;
+		normal -= w * n;
+		color -= w * c;
+		stdev -= w * p * p;
+		weight -= w;
+	}
+
+	void Add(const CPULGHVertex& other)
+	{
+		position += other.position;
+		normal += other.normal;
+		color += other.color;
+		stdev += other.stdev;
+		weight += other.weight;
+		numContributors += other.numContributors;
+	}
+};
+static_assert(sizeof(CPULGHVertex) == 16 * sizeof(float), "CPULGHVertex must stay 16 floats for SplatVPLAVX2");
+
+// AVX2 splat of one VPL (CPULGHSplatAVX2.cpp): computes the 8 trilinear corner weights in one
+// register and adds weight * (p, n, c, p * p, 1) to each corner vertex
+void SplatVPLAVX2(const glm::vec3& p, const glm::vec3& n, const glm::vec3& c, const glm::vec3& interp,
+	CPULGHVertex* const corners[8]);
+
+// open-addressing (linear probing) hash from vertex id to accumulated vertex.
+// Memory grows with the number of occupied vertices, not with the grid volume.
+class CPULGHVertexTable
+{
+public:
+
+	enum : uint32_t { EMPTY_KEY = 0xffffffff };
+
+	// drops all entries, capacityHint is the expected number of entries.
+	// Capacities and slots are size_t, a fine level of 11 levels can pass 2^30 slots.
+	void Clear(size_t capacityHint = 0)
+	{
+		size_t capacity = 1024;
+		while (capacity < 2 * capacityHint) capacity *= 2;
+		Rehash(capacity, false);
+	}
+
+	// finds or inserts the vertex with this id
+	CPULGHVertex& operator[](uint32_t key)
+	{
+		size_t slot = Hash(key);
+		while (true)
+		{
+			if (keys[slot] == key) return values[slot];
+			if (keys[slot] == EMPTY_KEY)
+			{
+				if (2 * (numEntries + 1) > keys.size())
+				{
+					Rehash(2 * keys.size(), true);
+					return (*this)[key];
+				}
+				keys[slot] = key;
+				values[slot] = CPULGHVertex();
+				numEntries++;
+				return values[slot];
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	// makes sure the next n insertions do not rehash, so references stay valid
+	void ReserveAdditional(size_t n)
+	{
+		size_t capacity = keys.size();
+		while (2 * (numEntries + n) > capacity) capacity *= 2;
+		if (capacity != keys.size()) Rehash(capacity, true);
+	}
+
+	// returns nullptr when the vertex has never been touched
+	const CPULGHVertex* Find(uint32_t key) const
+	{
+		for (size_t slot = Hash(key); keys[slot] != EMPTY_KEY; slot = (slot + 1) & mask)
+		{
+			if (keys[slot] == key) return &values[slot];
+		}
+		return nullptr;
+	}
+
+	size_t Size() const { return numEntries; }
+	size_t Capacity() const { return keys.size(); }
+	uint32_t KeyAt(size_t slot) const { return keys[slot]; }
+	const CPULGHVertex& ValueAt(size_t slot) const { return values[slot]; }
+
+private:
+
+	// Fibonacci hashing to the top bits, 64-bit so that tables can pass 2^32 slots
+	size_t Hash(uint32_t key) const { return (size_t)((key * 0x9e3779b97f4a7c15ull) >> shift); }
+
+	void Rehash(size_t capacity, bool keepEntries)
+	{
+		std::vector<uint32_t> oldKeys;
+		std::vector<CPULGHVertex> oldValues;
+		if (keepEntries)
+		{
+			oldKeys.swap(keys);
+			oldValues.swap(values);
+		}
+		keys.assign(capacity, EMPTY_KEY);
+		values.resize(capacity);
+		mask = capacity - 1;
+		shift = 64;
+		for (size_t c = capacity; c > 1; c >>= 1) shift--;
+		numEntries = 0;
+		for (size_t slot = 0; slot < oldKeys.size(); slot++)
+		{
+			if (oldKeys[slot] != EMPTY_KEY) (*this)[oldKeys[slot]] = oldValues[slot];
+		}
+	}
+
+	std::vector<uint32_t> keys;
+	std::vector<CPULGHVertex> values;
+	size_t numEntries = 0;
+	size_t mask = 0;
+	int shift = 64;
+};
+
+// a compacted level, laid out exactly as the output of VplCompactionCS
+struct CPULGHLevel
+{
+	std::vector<glm::vec4> position; // (average position, level)
+	std::vector<glm::vec4> normal;
+	std::vector<glm::vec4> color;
+	std::vector<glm::vec4> stdev; // (PI * standard deviation, weight)
+};
+
+// wall time of a build stage and the bytes it touches, counted as its input read once plus its output
+// written once. Comparable between stages and versions, it does not count cache traffic.
+struct CPULGHStageTiming
+{
+	std::string name; // as the ScopedTimer blocks of LGHBuilder, "Splat level 1", "Gather level 2", ...
+	double ms;
+	uint64_t bytes;
+};
+
+// CPU counterpart of the LGHBuilder construction passes. Needs no GPU, so it can
+// run on render nodes, and mirrors the math of the LGHConstruction shaders.
+// Levels are stored sparsely: only occupied vertices are kept, in vertex id order.
+class CPULGHBuilder
+{
+public:
+
+	CPULGHBuilder() {};
+
+	// level 1 vertex ids of 11 levels ((2^10 + 1)^3) still fit in 32 bits
+	enum { MAX_NUM_LEVELS = 11 };
+
+	// number of levels for a VPL set (LGHBuilder heuristic), clamped to maxNumLevels.
+	// isClamped is set when the VPL set asks for more levels than that.
+	static int CalculateNumLevels(long long numVPLs, int maxNumLevels = MAX_NUM_LEVELS, bool* isClamped = nullptr);
+
+	// default cells per axis of a gather tile, its at most 9^3 accumulated vertices take 46 KB
+	enum { GATHER_TILE_SIZE = 8 };
+
+	// _numThreads = 0 uses all hardware threads, _isVPLSortEnabled orders VPLs along a Z-curve before splatting,
+	// _isTiledGatherEnabled builds levels from S1 with the tiled gather instead of splatting S1 like the VPLs.
+	// _isDeterministic splats by sorting (vertex id, point) pairs and reducing every vertex in point order, which
+	// makes the levels bitwise identical for any number of threads (see SplatForLevelSorted).
+	// _gatherTileSize is the cells per axis of a tile of the tiled gather.
+	// _isIncrementalEnabled keeps a copy of the VPLs (48 bytes each) at every Build so Update can diff against it.
+	void Init(int _highestLevel, int _numThreads = 0, bool _isVPLSortEnabled = true, bool _isTiledGatherEnabled = true,
+		bool _isDeterministic = false, int _gatherTileSize = GATHER_TILE_SIZE, bool _isIncrementalEnabled = false);
+
+	// VPL attributes are float4 arrays, the same layout as the GPU VPL buffers
+	void Build(int _numVPLs, const glm::vec4* _vplPositions, const glm::vec4* _vplNormals, const glm::vec4* _vplColors,
+		bool isBuildFromS1 = true);
+
+	// Incremental rebuild against the VPLs of the last Build/Update: the contributions of changed VPLs are
+	// removed and re-added, and only the touched vertices of each level are normalized again. Only VPLs in
+	// [dirtyBegin, dirtyEnd) are read and diffed, the others are taken as unchanged, and VPLs past the last
+	// count have to lie in that range. The bounding box is kept, so it returns false (and changes nothing)
+	// when a new VPL falls outside of it, the build source differs or more than maxDirtyFraction of the VPLs
+	// changed. It also returns false after MAX_INCREMENTAL_UPDATES updates since the last Build, as removed
+	// contributions leave float residue behind. Call Build in that case.
+	// Deterministic builds always return false, a removed contribution does not restore the exact bits,
+	// and so do builders initialized without _isIncrementalEnabled.
+	bool Update(int _numVPLs, const glm::vec4* _vplPositions, const glm::vec4* _vplNormals, const glm::vec4* _vplColors,
+		int dirtyBegin, int dirtyEnd, bool isBuildFromS1 = true, float maxDirtyFraction = 0.25f);
+
+	// Out-of-core build: reads the source once for the bounding box and once more in batches of batchSize
+	// VPLs that are splatted into the level tables, so memory is the level storage plus one batch.
+	// Levels are compacted after the last batch. Streamed builds cannot be updated incrementally.
+	void BuildStreamed(CPUVPLSource& source, int batchSize = 1 << 22, bool isBuildFromS1 = true);
+
+	// min and max of the positions in one SSE pass with per-thread partials, then the derived
+	// highestCellSize, lgh_corner and baseRadius. Build calls it, a GPU build can use it after Init.
+	void FindBoundingBox(int numPoints, const glm::vec4* positions);
+
+	// fills compressedLevels from the compacted levels (16 bytes per vertex plus its id instead of 64).
+	// MeasureCompressionError compares a compressed level against the float one it was made from.
+	void CompressLevels();
+	CPULGHCompressionError MeasureCompressionError(int level) const;
+
+	// vertex id of each compacted entry of a level, increasing
+	const std::vector<uint32_t>& GetVertexIds(int level) const { return VertexIdsAtLevel[level]; }
+
+	int numVPLs;
+	int highestLevel;
+	int numThreads;
+	bool isVPLSortEnabled;
+	bool isTiledGatherEnabled;
+	bool isDeterministic;
+	int gatherTileSize;
+	bool isIncrementalEnabled;
+	bool isAVX2Enabled; // set by Init when the CPU supports AVX2 and FMA
+	float highestCellSize;
+	float baseRadius;
+	glm::vec3 lgh_corner;
+
+	std::vector<int> levelSizes;
+	std::vector<CPULGHLevel> levels;
+	std::vector<CPULGHCompressedLevel> compressedLevels; // filled by CompressLevels
+
+	// compacted entries [dirtyStart, dirtyEnd) of a level changed in the last Build/Update
+	std::vector<int> dirtyStart;
+	std::vector<int> dirtyEnd;
+
+	// stages of the last Build/BuildStreamed in order, the batches of a streamed build add up
+	std::vector<CPULGHStageTiming> stageTimings;
+
+private:
+
+	// memory of the private dense grids of a coarse level, 17 MB each at 64 threads
+	static const size_t COARSE_GRIDS_BYTES = 256 << 20;
+
+	// incremental updates between two full builds
+	static const int MAX_INCREMENTAL_UPDATES = 16;
+
+	// runs stage(), which returns the bytes it touched, and adds it to the timing of that name
+	template <typename Stage>
+	void TimeStage(const std::string& name, const Stage& stage)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t bytes = stage();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		for (CPULGHStageTiming& timing : stageTimings)
+		{
+			if (timing.name != name) continue;
+			timing.ms += ms;
+			timing.bytes += bytes;
+			return;
+		}
+		CPULGHStageTiming timing = { name, ms, bytes };
+		stageTimings.push_back(timing);
+	}
+	uint64_t GetNumTableEntries(int level) const;
+	uint64_t SplatStage(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+		bool isAccumulating = false);
+	uint64_t GatherStage(int level);
+	uint64_t CompactStage(int level);
+
+	void GrowBoundingBox(int numPoints, const glm::vec4* positions, glm::vec3& bbox_min, glm::vec3& bbox_max);
+	void SetBoundingBox(const glm::vec3& bbox_min, const glm::vec3& bbox_max);
+	void SortVPLs(int numPoints);
+	// isAccumulating adds to the tables of the previous call and keeps its slab partition (streamed batches)
+	void SplatForLevel(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+		bool isAccumulating = false);
+	void SplatForLevelSorted(int level, int numPoints, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors,
+		bool isAccumulating);
+	void GatherForLevel(int level);
+	void GatherForLevelTiled(int level);
+	void CompactLevel(int level);
+	void SplatDelta(int level, const CPULGHLevel& removed, const CPULGHLevel& added, std::vector<uint32_t>& dirtyIds);
+	void RecompactLevel(int level, const std::vector<uint32_t>& dirtyIds);
+	void GatherCompactVertices(int level, const std::vector<uint32_t>& vertIds, CPULGHLevel& out);
+	const CPULGHVertex* FindVertex(int level, uint32_t vertId);
+
+	const glm::vec4* vplPositions;
+	const glm::vec4* vplNormals;
+	const glm::vec4* vplColors;
+
+	// VPLs in Morton order of their S1 cells (position, normal, color)
+	std::vector<uint32_t> mortonKeys;
+	std::vector<uint32_t> sortedIndices;
+	std::vector<glm::vec4> SortedVPLs[3];
+
+	// occupied vertices of a level, one table per z slab, slabs hold disjoint vertex ids in increasing z
+	std::vector<std::vector<CPULGHVertexTable>> TablesAtLevel;
+	std::vector<std::vector<int>> TableOfPlaneAtLevel; // table holding each vertex z plane
+	std::vector<std::vector<int>> SlabStartAtLevel; // first cell layer of each slab
+	std::vector<std::vector<uint32_t>> VertexIdsAtLevel; // vertex id of each compacted entry
+
+	// workers of every parallel pass of Build, BuildStreamed and Update, started by Init
+	CPUThreadPool threadPool;
+
+	// VPLs of the last Build/Update in input order, diffed by Update
+	std::vector<glm::vec4> lastVPLs[3];
+	bool isLastBuildFromS1;
+	int numIncrementalUpdates; // since the last Build, reset by Build and BuildStreamed
+
+	// splat scratch
+	std::vector<int> vplCellZ;
+	std::vector<int> slabSortedVPLs;
+	std::vector<CPULGHVertexTable> haloTables;
+	std::vector<std::vector<CPULGHVertex>> threadGrids; // private grids of coarse levels
+	std::vector<uint32_t> occupiedSlots; // compacted vertex ids of the coarse splat
+
+	// sorted splat scratch, (vertex id, point) pairs
+	std::vector<uint32_t> pairVertexIds;
+	std::vector<uint32_t> pairPoints;
+
+	// tiled gather scratch
+	std::vector<size_t> tileHistograms;
+	std::vector<int> tilePoints; // S1 entries grouped by the tiles owning one of their corners
+};
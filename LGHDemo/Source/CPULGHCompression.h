@@ -0,0 +1,154 @@
+#pragma once
+#include "CPUMath.h"
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+// 16-byte encoding of a compacted LGH vertex, which takes 64 bytes as four float4 attributes.
+// The level is implied by the level the vertex is stored in, and the weight in stdev.w is not
+// used for shading, so it is dropped.
+struct CPULGHPackedVertex
+{
+	uint32_t position; // 11/11/10 bit offset from the grid vertex, in [-1, 1] cells
+	uint32_t normal; // 12/12 bit octahedral direction and 8 bit length (averaged normals are shorter than 1)
+	uint32_t color; // RGB9E5 of color / colorScale
+	uint32_t stdev; // RGB9E5 of stdev / stdevScale
+};
+static_assert(sizeof(CPULGHPackedVertex) == 16, "CPULGHPackedVertex must stay 16 bytes");
+
+// largest errors of a compressed level against its float attributes. Position is in cells,
+// normal is absolute, color and stdev are relative to the largest channel of the vertex.
+// Vertices with a largest channel far below the level maximum (under 2^-31 of it) are measured
+// against that floor instead.
+struct CPULGHCompressionError
+{
+	float position = 0.f;
+	float normal = 0.f;
+	float color = 0.f;
+	float stdev = 0.f;
+
+	bool IsWithin(const CPULGHCompressionError& budget) const
+	{
+		return position <= budget.position && normal <= budget.normal && color <= budget.color && stdev <= budget.stdev;
+	}
+};
+
+// quantization steps are 2/1023 cells (z), 2^-11 in octahedral space, 2^-8 in length and 2^-9 of the shared exponent
+const CPULGHCompressionError LGH_COMPRESSION_ERROR_BUDGET = { 1e-3f, 4e-3f, 4e-3f, 4e-3f };
+
+inline uint32_t PackUnorm(float x, int numBits)
+{
+	float maxValue = float((1u << numBits) - 1);
+	return (uint32_t)(saturate(x) * maxValue + 0.5f);
+}
+
+inline float UnpackUnorm(uint32_t x, int numBits)
+{
+	return float(x & ((1u << numBits) - 1)) / float((1u << numBits) - 1);
+}
+
+// shared exponent encoding of a non-negative color, as DXGI_FORMAT_R9G9B9E5_SHAREDEXP
+inline uint32_t EncodeRGB9E5(const glm::vec3& rgb)
+{
+	const float maxValue = 65408.f; // (511 / 512) * 2^15
+	glm::vec3 c = glm::clamp(rgb, glm::vec3(0.f), glm::vec3(maxValue));
+	float maxChannel = std::max(c.x, std::max(c.y, c.z));
+	if (!(maxChannel > 0.f)) return 0;
+
+	int exponent = std::max(-16, (int)std::floor(std::log2(maxChannel))) + 1 + 15;
+	float denom = std::exp2(float(exponent - 15 - 9));
+	if ((int)std::floor(maxChannel / denom + 0.5f) == 512)
+	{
+		denom *= 2.f;
+		exponent++;
+	}
+	uint32_t r = (uint32_t)std::floor(c.x / denom + 0.5f);
+	uint32_t g = (uint32_t)std::floor(c.y / denom + 0.5f);
+	uint32_t b = (uint32_t)std::floor(c.z / denom + 0.5f);
+	return r | (g << 9) | (b << 18) | ((uint32_t)exponent << 27);
+}
+
+inline glm::vec3 DecodeRGB9E5(uint32_t x)
+{
+	float scale = std::exp2(float(int(x >> 27) - 15 - 9));
+	return glm::vec3(float(x & 511), float((x >> 9) & 511), float((x >> 18) & 511)) * scale;
+}
+
+inline uint32_t EncodeOctahedralNormal(const glm::vec3& n)
+{
+	float length = glm::length(n);
+	glm::vec2 oct(0.f);
+	if (length > 0.f)
+	{
+		glm::vec3 d = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+		oct = glm::vec2(d.x, d.y);
+		if (d.z < 0.f)
+		{
+			glm::vec2 signs(d.x >= 0.f ? 1.f : -1.f, d.y >= 0.f ? 1.f : -1.f);
+			oct = (1.f - glm::abs(glm::vec2(d.y, d.x))) * signs;
+		}
+	}
+	return PackUnorm(oct.x * 0.5f + 0.5f, 12) | (PackUnorm(oct.y * 0.5f + 0.5f, 12) << 12) | (PackUnorm(length, 8) << 24);
+}
+
+inline glm::vec3 DecodeOctahedralNormal(uint32_t x)
+{
+	glm::vec2 oct(UnpackUnorm(x, 12) * 2.f - 1.f, UnpackUnorm(x >> 12, 12) * 2.f - 1.f);
+	glm::vec3 d(oct.x, oct.y, 1.f - std::abs(oct.x) - std::abs(oct.y));
+	float t = std::max(-d.z, 0.f);
+	d.x += d.x >= 0.f ? -t : t;
+	d.y += d.y >= 0.f ? -t : t;
+	return glm::normalize(d) * UnpackUnorm(x >> 24, 8);
+}
+
+// a compressed level, decoded on the CPU where the vertex is shaded
+struct CPULGHCompressedLevel
+{
+	int level = 0;
+	int levelRes = 0; // vertices per dimension, vertex id = x + y * levelRes + z * levelRes^2
+	float cellSize = 0.f;
+	glm::vec3 corner = glm::vec3(0.f);
+	float colorScale = 1.f;
+	float stdevScale = 1.f;
+	std::vector<uint32_t> vertexIds;
+	std::vector<CPULGHPackedVertex> vertices;
+
+	size_t SizeInBytes() const
+	{
+		return vertexIds.size() * sizeof(uint32_t) + vertices.size() * sizeof(CPULGHPackedVertex);
+	}
+
+	glm::vec3 GridPosition(uint32_t vertexId) const
+	{
+		glm::ivec3 v(vertexId % levelRes, (vertexId / levelRes) % levelRes, vertexId / (levelRes * levelRes));
+		return corner + glm::vec3(v) * cellSize;
+	}
+
+	CPULGHPackedVertex Encode(uint32_t vertexId, const glm::vec4& position, const glm::vec4& normal, const glm::vec4& color, const glm::vec4& stdev) const
+	{
+		glm::vec3 offset = (glm::vec3(position) - GridPosition(vertexId)) / cellSize * 0.5f + 0.5f;
+		CPULGHPackedVertex packed;
+		packed.position = PackUnorm(offset.x, 11) | (PackUnorm(offset.y, 11) << 11) | (PackUnorm(offset.z, 10) << 22);
+		packed.normal = EncodeOctahedralNormal(glm::vec3(normal));
+		packed.color = EncodeRGB9E5(glm::vec3(color) / colorScale);
+		packed.stdev = EncodeRGB9E5(glm::vec3(stdev) / stdevScale);
+		return packed;
+	}
+
+	glm::vec3 DecodePosition(int addr) const
+	{
+		uint32_t packed = vertices[addr].position;
+		glm::vec3 offset(UnpackUnorm(packed, 11), UnpackUnorm(packed >> 11, 11), UnpackUnorm(packed >> 22, 10));
+		return GridPosition(vertexIds[addr]) + (offset * 2.f - 1.f) * cellSize;
+	}
+
+	// same layout as CPULGHLevel: (position, level), normal, color, (stdev, 0)
+	void Decode(int addr, glm::vec4& position, glm::vec4& normal, glm::vec4& color, glm::vec4& stdev) const
+	{
+		const CPULGHPackedVertex& packed = vertices[addr];
+		position = glm::vec4(DecodePosition(addr), float(level));
+		normal = glm::vec4(DecodeOctahedralNormal(packed.normal), 0.f);
+		color = glm::vec4(DecodeRGB9E5(packed.color) * colorScale, 0.f);
+		stdev = glm::vec4(DecodeRGB9E5(packed.stdev) * stdevScale, 0.f);
+	}
+};
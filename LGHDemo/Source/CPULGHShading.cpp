@@ -0,0 +1,85 @@
+#include "CPULGHShading.h"
+
+void CPULGHShader::Init(const CPULGHBuilder& _builder, const CPULGHShadingParams& _params, bool _isCompressed,
+	int _numVPLs, const glm::vec4* _vplPositions, const glm::vec4* _vplNormals, const glm::vec4* _vplColors)
+{
+	builder = &_builder;
+	params = _params;
+	isCompressed = _isCompressed && (int)builder->compressedLevels.size() == builder->highestLevel + 1;
+	numLevels = builder->highestLevel + 1;
+	numThreads = builder->numThreads;
+	baseRadius = builder->baseRadius;
+	lgh_corner = builder->lgh_corner;
+
+	numVPLs = _numVPLs;
+	vplPositions = _vplPositions;
+	vplNormals = _vplNormals;
+	vplColors = _vplColors;
+	vplCellKeys.clear();
+	vplCellStart.clear();
+	vplOrder.clear();
+	if (params.minLevel > 0 || numVPLs <= 0 || !vplPositions)
+	{
+		params.minLevel = std::max(params.minLevel, 1);
+		return;
+	}
+
+	// level 0 cells are baseRadius wide, 2^highestLevel per axis
+	int res = 1 << builder->highestLevel;
+	std::vector<uint32_t> keys(numVPLs);
+	vplOrder.resize(numVPLs);
+	ParallelFor(0, numVPLs, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::ivec3 cell = glm::ivec3(glm::floor((glm::vec3(vplPositions[i]) - lgh_corner) / baseRadius));
+			cell = glm::clamp(cell, glm::ivec3(0), glm::ivec3(res - 1));
+			keys[i] = (uint32_t)cell.x + (uint32_t)cell.y * res + (uint32_t)cell.z * res * res;
+			vplOrder[i] = i;
+		}
+	});
+	ParallelRadixSort(keys, vplOrder, 3 * builder->highestLevel, numThreads);
+
+	for (int i = 0; i < numVPLs; i++)
+	{
+		if (i > 0 && keys[i] == keys[i - 1]) continue;
+		vplCellKeys.push_back(keys[i]);
+		vplCellStart.push_back(i);
+	}
+	vplCellStart.push_back(numVPLs);
+}
+
+void CPULGHShader::Shade(int numPoints, const glm::vec4* positions, const glm::vec4* normals, glm::vec3* radiance) const
+{
+	ParallelFor(0, numPoints, 64, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::vec3 sp(positions[i]);
+			glm::vec3 sn(normals[i]);
+			glm::vec3 sum(0.f);
+			ForEachLightInCut(sp, sn, [&](const CPULGHLight& light) { sum += Evaluate(sp, sn, light); });
+			radiance[i] = sum;
+		}
+	});
+}
+
+glm::vec3 CPULGHShader::ShadeAllLights(const glm::vec3& sp, const glm::vec3& sn) const
+{
+	glm::vec3 sum(0.f);
+	for (int level = params.minLevel; level < numLevels; level++)
+	{
+		float lightRadius = params.alpha * baseRadius * (1 << level);
+		int numEntries = level == 0 ? numVPLs : builder->levelSizes[level];
+		for (int addr = 0; addr < numEntries; addr++)
+		{
+			float ratio = GetRatio(level, sp, sn, GetPosition(level, addr), lightRadius);
+			if (ratio <= 0.f) continue;
+			CPULGHLight light;
+			GetLight(level, addr, light);
+			light.ratio = ratio;
+			sum += Evaluate(sp, sn, light);
+		}
+	}
+	return sum;
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include "CPULGHBuilder.h"
+#include <algorithm>
+#include <vector>
+
+// shading constants of LightingComputationVS/PS
+struct CPULGHShadingParams
+{
+	float alpha = 1.f; // light radius of a level in cells (Alpha)
+	float invNumPaths = 1.f;
+	float sceneRadius = 1.f; // the clamping term is (0.01 * sceneRadius)^2
+	int minLevel = 1; // 0 also shades with the VPLs themselves ("Include VPLs")
+};
+
+// a light of the cut of a shading point, ratio is the level blending weight of LightingComputationPS
+struct CPULGHLight
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 color;
+	glm::vec3 stdev;
+	int level;
+	int addr; // entry of the level (the VPL index at level 0)
+	float ratio;
+};
+
+// CPU counterpart of drawing every LGH instance as a cube and accumulating LightingComputationPS,
+// without the shadow sampling. A vertex of level l reaches the points within 2 * alpha * cellSize(l)
+// of its averaged position, and that position lies within one cell of its grid vertex. So the cut of
+// a point is found by walking the rows of a window of about (4 alpha + 3)^3 grid vertices per level
+// through the sorted vertex ids of the level, instead of testing every instance, and the cost per
+// point grows with the number of levels rather than with the size of the hierarchy.
+// When minLevel is 0, the VPLs are bucketed by the cells of a level 0 grid for the same lookup.
+class CPULGHShader
+{
+public:
+
+	CPULGHShader() {};
+
+	// the builder has to outlive the shader and keep its levels, isCompressed shades from the
+	// compressed levels (CompressLevels). The VPLs are float4 arrays, only used when minLevel is 0.
+	void Init(const CPULGHBuilder& _builder, const CPULGHShadingParams& _params, bool _isCompressed = false,
+		int _numVPLs = 0, const glm::vec4* _vplPositions = nullptr, const glm::vec4* _vplNormals = nullptr,
+		const glm::vec4* _vplColors = nullptr);
+
+	// calls func(light) for every light of the cut of the shading point
+	template <typename Func>
+	void ForEachLightInCut(const glm::vec3& sp, const glm::vec3& sn, const Func& func) const
+	{
+		for (int level = params.minLevel; level < numLevels; level++)
+		{
+			float lightRadius = params.alpha * baseRadius * (1 << level);
+			ForEachCandidate(level, sp, 2.f * lightRadius, [&](int addr)
+			{
+				glm::vec3 lp = GetPosition(level, addr);
+				float ratio = GetRatio(level, sp, sn, lp, lightRadius);
+				if (ratio <= 0.f) return;
+				CPULGHLight light;
+				GetLight(level, addr, light);
+				light.ratio = ratio;
+				func(light);
+			});
+		}
+	}
+
+	// diffuse radiance of every point (lightingFunction summed over its cut), the points are float4 arrays
+	void Shade(int numPoints, const glm::vec4* positions, const glm::vec4* normals, glm::vec3* radiance) const;
+
+	// the same sum over every VPL and vertex of every level, as the rasterized cubes test them.
+	// Linear in the size of the hierarchy, for validation.
+	glm::vec3 ShadeAllLights(const glm::vec3& sp, const glm::vec3& sn) const;
+
+	// lightingFunction without the shadow sampling
+	glm::vec3 Evaluate(const glm::vec3& sp, const glm::vec3& sn, const CPULGHLight& light) const
+	{
+		glm::vec3 toLight = light.position - sp;
+		float dist = glm::length(toLight);
+		glm::vec3 lightDir = toLight / dist;
+		glm::vec3 diffuse = std::max(glm::dot(sn, lightDir), 0.f) * light.ratio * light.color * params.invNumPaths;
+		float bias = 0.01f * params.sceneRadius; //clamping term
+		bias *= bias;
+		return diffuse * std::max(glm::dot(light.normal, -lightDir), 0.f) / (dist * dist + bias);
+	}
+
+	int numLevels;
+	int numThreads;
+	float baseRadius;
+	glm::vec3 lgh_corner;
+	CPULGHShadingParams params;
+
+private:
+
+	// the level blending of LightingComputationPS, 0 when the light does not reach the point. The cube
+	// drawn for a light has a half extent of 2 * lightRadius, which only bounds the highest level.
+	float GetRatio(int level, const glm::vec3& sp, const glm::vec3& sn, const glm::vec3& lp, float lightRadius) const
+	{
+		glm::vec3 d = glm::abs(sp - lp);
+		if (std::max(d.x, std::max(d.y, d.z)) > 2.f * lightRadius) return 0.f;
+		if (glm::dot(sn, lp - sp) <= 0.f) return 0.f;
+
+		float dist = glm::length(sp - lp);
+		if (dist < lightRadius)
+		{
+			if (level == params.minLevel) return 1.f;
+			return (dist - 0.5f * lightRadius) / (0.5f * lightRadius);
+		}
+		if (level < numLevels - 1) return (2.f * lightRadius - dist) / lightRadius;
+		return 1.f;
+	}
+
+	// calls func(addr) for the entries of a level that may lie within reach of sp on every axis
+	template <typename Func>
+	void ForEachCandidate(int level, const glm::vec3& sp, float reach, const Func& func) const
+	{
+		float cellSize = baseRadius * (1 << level);
+		glm::vec3 lo = (sp - reach - lgh_corner) / cellSize;
+		glm::vec3 hi = (sp + reach - lgh_corner) / cellSize;
+		int res;
+		glm::ivec3 first, last;
+		const std::vector<uint32_t>* keys;
+		if (level == 0)
+		{
+			// VPLs are bucketed by the cell they are in
+			res = 1 << (numLevels - 1);
+			first = glm::ivec3(glm::floor(lo));
+			last = glm::ivec3(glm::floor(hi));
+			keys = &vplCellKeys;
+		}
+		else
+		{
+			// an averaged position is less than one cell away from its grid vertex
+			res = (1 << (numLevels - 1 - level)) + 1;
+			first = glm::ivec3(glm::ceil(lo)) - 1;
+			last = glm::ivec3(glm::floor(hi)) + 1;
+			keys = isCompressed ? &builder->compressedLevels[level].vertexIds : &builder->GetVertexIds(level);
+		}
+		first = glm::max(first, glm::ivec3(0));
+		last = glm::min(last, glm::ivec3(res - 1));
+		if (glm::any(glm::greaterThan(first, last))) return;
+
+		// rows of x are contiguous key ranges, and rows come in increasing key order
+		auto cursor = keys->begin();
+		for (int z = first.z; z <= last.z; z++)
+		{
+			for (int y = first.y; y <= last.y; y++)
+			{
+				uint32_t rowBase = (uint32_t)y * res + (uint32_t)z * res * res;
+				uint32_t rowEnd = rowBase + last.x;
+				cursor = std::lower_bound(cursor, keys->end(), rowBase + first.x);
+				for (; cursor != keys->end() && *cursor <= rowEnd; ++cursor)
+				{
+					int entry = (int)(cursor - keys->begin());
+					if (level > 0) func(entry);
+					else for (int i = vplCellStart[entry]; i < vplCellStart[entry + 1]; i++) func((int)vplOrder[i]);
+				}
+			}
+		}
+	}
+
+	glm::vec3 GetPosition(int level, int addr) const
+	{
+		if (level == 0) return glm::vec3(vplPositions[addr]);
+		if (isCompressed) return builder->compressedLevels[level].DecodePosition(addr);
+		return glm::vec3(builder->levels[level].position[addr]);
+	}
+
+	void GetLight(int level, int addr, CPULGHLight& light) const
+	{
+		light.level = level;
+		light.addr = addr;
+		if (level == 0)
+		{
+			light.position = glm::vec3(vplPositions[addr]);
+			light.normal = glm::vec3(vplNormals[addr]);
+			light.color = glm::vec3(vplColors[addr]);
+			light.stdev = glm::vec3(0.f);
+			return;
+		}
+		glm::vec4 position, normal, color, stdev;
+		if (isCompressed)
+		{
+			builder->compressedLevels[level].Decode(addr, position, normal, color, stdev);
+		}
+		else
+		{
+			const CPULGHLevel& cpuLevel = builder->levels[level];
+			position = cpuLevel.position[addr];
+			normal = cpuLevel.normal[addr];
+			color = cpuLevel.color[addr];
+			stdev = cpuLevel.stdev[addr];
+		}
+		light.position = glm::vec3(position);
+		light.normal = glm::vec3(normal);
+		light.color = glm::vec3(color);
+		light.stdev = glm::vec3(stdev);
+	}
+
+	const CPULGHBuilder* builder = nullptr;
+	bool isCompressed = false;
+
+	// VPLs sorted by their level 0 cell, vplCellStart[i] is the first VPL of occupied cell vplCellKeys[i]
+	int numVPLs = 0;
+	const glm::vec4* vplPositions = nullptr;
+	const glm::vec4* vplNormals = nullptr;
+	const glm::vec4* vplColors = nullptr;
+	std::vector<uint32_t> vplCellKeys;
+	std::vector<int> vplCellStart;
+	std::vector<uint32_t> vplOrder;
+};
@@ -0,0 +1,34 @@
+// Compiled with /arch:AVX2, only called after CPULGHBuilder::Init found AVX2 and FMA support.
+#include "CPULGHBuilder.h"
+#include <immintrin.h>
+
+void SplatVPLAVX2(const glm::vec3& p, const glm::vec3& n, const glm::vec3& c, const glm::vec3& interp,
+	CPULGHVertex* const corners[8])
+{
+	// corner vId = (x, y, z) bits, lane vId takes interp on a set bit and 1 - interp otherwise (VplSplatToVertexCS)
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 maskX = _mm256_castsi256_ps(_mm256_setr_epi32(0, -1, 0, -1, 0, -1, 0, -1));
+	const __m256 maskY = _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, -1, -1, 0, 0, -1, -1));
+	const __m256 maskZ = _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1));
+
+	__m256 ix = _mm256_set1_ps(interp.x);
+	__m256 iy = _mm256_set1_ps(interp.y);
+	__m256 iz = _mm256_set1_ps(interp.z);
+	__m256 wx = _mm256_blendv_ps(_mm256_sub_ps(one, ix), ix, maskX);
+	__m256 wy = _mm256_blendv_ps(_mm256_sub_ps(one, iy), iy, maskY);
+	__m256 wz = _mm256_blendv_ps(_mm256_sub_ps(one, iz), iz, maskZ);
+	__m256 weights = _mm256_mul_ps(_mm256_mul_ps(wx, wy), wz);
+
+	// contribution of the VPL in CPULGHVertex layout: position, normal, color, second moment, weight, contributors
+	__m256 contribLo = _mm256_setr_ps(p.x, p.y, p.z, n.x, n.y, n.z, c.x, c.y);
+	__m256 contribHi = _mm256_setr_ps(c.z, p.x * p.x, p.y * p.y, p.z * p.z, 1.f, 0.f, 0.f, 0.f);
+	const __m256 contributor = _mm256_setr_ps(0.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f); // numContributors, not weighted
+
+	for (int vId = 0; vId < 8; vId++)
+	{
+		__m256 w = _mm256_permutevar8x32_ps(weights, _mm256_set1_epi32(vId));
+		float* vert = reinterpret_cast<float*>(corners[vId]);
+		_mm256_storeu_ps(vert, _mm256_fmadd_ps(w, contribLo, _mm256_loadu_ps(vert)));
+		_mm256_storeu_ps(vert + 8, _mm256_add_ps(_mm256_fmadd_ps(w, contribHi, _mm256_loadu_ps(vert + 8)), contributor));
+	}
+}
@@ -83,7 +83,7 @@ struct CPUFace {
 
 class CPUTexture {
 public:
-	int width, height, nrComponents;
+	int width = 0, height = 0, nrComponents = 0;
 	std::string path;
 	std::string type;
 
@@ -177,7 +177,7 @@ public:
 			toColor3(iyp*width + ixp) * (fx *   fy);
 	}
 
-	unsigned char* data;
+	unsigned char* data = nullptr;
 };
 
 
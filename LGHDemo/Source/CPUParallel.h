@@ -0,0 +1,276 @@
+#pragma once
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int GetNumHardwareThreads()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : (int)n;
+}
+
+// AVX2 and FMA, the requirement of the *AVX2.cpp files compiled with /arch:AVX2
+inline bool IsAVX2Supported()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	bool hasFMA = (info[2] & (1 << 12)) != 0;
+	bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+	bool hasAVX = (info[2] & (1 << 28)) != 0;
+	if (!hasFMA || !hasOSXSAVE || !hasAVX) return false;
+	if ((_xgetbv(0) & 6) != 6) return false; // OS saves the YMM registers
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+// Worker threads that stay alive between jobs. While a Scope of the pool is open on a thread,
+// every ParallelRun of that thread (so every helper below) runs on the pool instead of starting
+// and joining threads of its own. A ParallelRun nested in a job, or wider than the pool, falls
+// back to its own threads.
+class CPUThreadPool
+{
+public:
+
+	CPUThreadPool() {};
+	~CPUThreadPool() { Resize(0); }
+	CPUThreadPool(const CPUThreadPool&) = delete;
+	CPUThreadPool& operator=(const CPUThreadPool&) = delete;
+
+	// numThreads counts the calling thread, which acts as worker 0 of every job
+	void Resize(int numThreads)
+	{
+		int numWorkers = std::max(0, numThreads - 1);
+		if ((int)workers.size() == numWorkers) return;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			isStopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers) worker.join();
+		workers.clear();
+		isStopping = false;
+		workers.reserve(numWorkers);
+		for (int threadId = 1; threadId <= numWorkers; threadId++) workers.emplace_back([this, threadId]() { WorkerLoop(threadId); });
+	}
+
+	int NumThreads() const { return (int)workers.size() + 1; }
+
+	// runs func(threadId) for threadId in [0, numThreads), returns false when the pool is busy or too small
+	template <typename Func>
+	bool TryRun(int numThreads, const Func& func)
+	{
+		if (isBusy || numThreads > NumThreads()) return false;
+		isBusy = true;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			invoke = [](const void* context, int threadId) { (*(const Func*)context)(threadId); };
+			context = &func;
+			numJobThreads = numThreads;
+			numPending = numThreads - 1;
+			generation++;
+		}
+		wake.notify_all();
+		func(0);
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [&]() { return numPending == 0; });
+		isBusy = false;
+		return true;
+	}
+
+	// makes pool the one of the ParallelRun calls of this thread until the scope closes
+	class Scope
+	{
+	public:
+		Scope(CPUThreadPool& pool) : previous(Active()) { Active() = &pool; }
+		~Scope() { Active() = previous; }
+	private:
+		CPUThreadPool* previous;
+	};
+
+	static CPUThreadPool*& Active()
+	{
+		thread_local CPUThreadPool* pool = nullptr;
+		return pool;
+	}
+
+private:
+
+	void WorkerLoop(int threadId)
+	{
+		uint64_t lastGeneration = 0;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true)
+		{
+			wake.wait(guard, [&]() { return isStopping || generation != lastGeneration; });
+			if (isStopping) return;
+			lastGeneration = generation;
+			if (threadId >= numJobThreads) continue;
+			void (*jobInvoke)(const void*, int) = invoke;
+			const void* jobContext = context;
+			guard.unlock();
+			jobInvoke(jobContext, threadId);
+			guard.lock();
+			if (--numPending == 0) done.notify_one();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation = 0;
+	int numJobThreads = 0;
+	int numPending = 0;
+	bool isStopping = false;
+	bool isBusy = false; // only touched by the thread running jobs
+	void (*invoke)(const void*, int) = nullptr;
+	const void* context = nullptr;
+};
+
+// runs func(threadId) on numThreads workers, the calling thread acts as worker 0
+template <typename Func>
+void ParallelRun(int numThreads, const Func& func)
+{
+	if (numThreads <= 1)
+	{
+		func(0);
+		return;
+	}
+	CPUThreadPool* pool = CPUThreadPool::Active();
+	if (pool && pool->TryRun(numThreads, func)) return;
+
+	std::vector<std::thread> workers;
+	workers.reserve(numThreads - 1);
+	for (int threadId = 1; threadId < numThreads; threadId++)
+	{
+		workers.emplace_back([&func, threadId]() { func(threadId); });
+	}
+	func(0);
+	for (auto& worker : workers) worker.join();
+}
+
+// splits [begin, end) into chunks of grainSize and hands them out dynamically,
+// func(chunkBegin, chunkEnd, threadId) is called once per chunk
+template <typename Func>
+void ParallelFor(int begin, int end, int grainSize, int numThreads, const Func& func)
+{
+	if (end <= begin) return;
+	grainSize = std::max(1, grainSize);
+	int numChunks = (end - begin + grainSize - 1) / grainSize;
+	numThreads = std::max(1, std::min(numThreads, numChunks));
+
+	std::atomic<int> nextChunk(0);
+	ParallelRun(numThreads, [&](int threadId)
+	{
+		for (int chunk = nextChunk++; chunk < numChunks; chunk = nextChunk++)
+		{
+			int chunkBegin = begin + chunk * grainSize;
+			int chunkEnd = std::min(end, chunkBegin + grainSize);
+			func(chunkBegin, chunkEnd, threadId);
+		}
+	});
+}
+
+// static partition of [begin, end) into one contiguous range per thread,
+// used when per-thread results have to be combined in a fixed order
+template <typename Func>
+void ParallelForStatic(int begin, int end, int numThreads, const Func& func)
+{
+	if (end <= begin) return;
+	numThreads = std::max(1, std::min(numThreads, end - begin));
+	ParallelRun(numThreads, [&](int threadId)
+	{
+		int rangeBegin = begin + (int)((long long)(end - begin) * threadId / numThreads);
+		int rangeEnd = begin + (int)((long long)(end - begin) * (threadId + 1) / numThreads);
+		func(rangeBegin, rangeEnd, threadId);
+	});
+}
+
+// [0, numItems) with work stealing: every thread starts on its own contiguous share and, once it
+// runs dry, takes the back half of the largest share left. For items of very uneven cost that
+// should still be processed mostly in order. func(item, threadId) is called once per item.
+template <typename Func>
+void ParallelForWorkStealing(int numItems, int numThreads, const Func& func)
+{
+	if (numItems <= 0) return;
+	numThreads = std::max(1, std::min(numThreads, numItems));
+
+	struct WorkShare
+	{
+		std::mutex lock;
+		int begin = 0;
+		int end = 0;
+		char padding[64]; // keeps the shares of different threads on different cache lines
+	};
+	std::vector<WorkShare> shares(numThreads);
+	for (int threadId = 0; threadId < numThreads; threadId++)
+	{
+		shares[threadId].begin = (int)((long long)numItems * threadId / numThreads);
+		shares[threadId].end = (int)((long long)numItems * (threadId + 1) / numThreads);
+	}
+
+	auto steal = [&](int threadId)
+	{
+		while (true)
+		{
+			int victim = -1;
+			int largest = 0;
+			for (int other = 0; other < numThreads; other++)
+			{
+				if (other == threadId) continue;
+				std::lock_guard<std::mutex> guard(shares[other].lock);
+				if (shares[other].end - shares[other].begin > largest)
+				{
+					largest = shares[other].end - shares[other].begin;
+					victim = other;
+				}
+			}
+			if (victim < 0) return false;
+
+			int stolenBegin, stolenEnd;
+			{
+				std::lock_guard<std::mutex> guard(shares[victim].lock);
+				int remaining = shares[victim].end - shares[victim].begin;
+				if (remaining <= 0) continue; // drained meanwhile, look again
+				stolenEnd = shares[victim].end;
+				stolenBegin = stolenEnd - (remaining + 1) / 2;
+				shares[victim].end = stolenBegin;
+			}
+			std::lock_guard<std::mutex> guard(shares[threadId].lock);
+			shares[threadId].begin = stolenBegin;
+			shares[threadId].end = stolenEnd;
+			return true;
+		}
+	};
+
+	ParallelRun(numThreads, [&](int threadId)
+	{
+		while (true)
+		{
+			int item = -1;
+			{
+				std::lock_guard<std::mutex> guard(shares[threadId].lock);
+				if (shares[threadId].begin < shares[threadId].end) item = shares[threadId].begin++;
+			}
+			if (item < 0)
+			{
+				if (!steal(threadId)) return;
+				continue;
+			}
+			func(item, threadId);
+		}
+	});
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "CPUParallel.h"
+#include <vector>
+
+// CPU counterparts of the VplPreScanCS / VplScan1-3CS / VplCompactionCS chain. Both use the
+// blocked two-pass scheme: every worker reduces one contiguous range, the per-range totals are
+// scanned serially (one value per range), then every worker writes its range from its offset.
+// The ranges are the same static ones in both passes, so the result does not depend on timing.
+
+// ranges below this size are not worth a thread
+constexpr int SCAN_MIN_RANGE_SIZE = 16384;
+
+inline int GetNumScanRanges(int n, int numThreads)
+{
+	return std::max(1, std::min(numThreads, n / SCAN_MIN_RANGE_SIZE));
+}
+
+// output[i] = input[0] + ... + input[i - 1], returns the total. output may alias input.
+template <typename T>
+T ParallelExclusiveScan(const T* input, T* output, int n, int numThreads)
+{
+	if (n <= 0) return T(0);
+	int numRanges = GetNumScanRanges(n, numThreads);
+	std::vector<T> rangeOffset(numRanges + 1, T(0));
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		T sum = T(0);
+		for (int i = begin; i < end; i++) sum += input[i];
+		rangeOffset[rangeId + 1] = sum;
+	});
+	for (int rangeId = 0; rangeId < numRanges; rangeId++) rangeOffset[rangeId + 1] += rangeOffset[rangeId];
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		T sum = rangeOffset[rangeId];
+		for (int i = begin; i < end; i++)
+		{
+			T value = input[i];
+			output[i] = sum;
+			sum += value;
+		}
+	});
+	return rangeOffset[numRanges];
+}
+
+// stable compaction of the indices i in [0, n) with isKept(i), output is resized to exactly the
+// surviving count, which is returned. isKept is evaluated twice per index and has to be pure.
+template <typename IndexType, typename Predicate>
+int ParallelCompactIndices(int n, const Predicate& isKept, std::vector<IndexType>& output, int numThreads)
+{
+	output.clear();
+	if (n <= 0) return 0;
+	int numRanges = GetNumScanRanges(n, numThreads);
+	std::vector<int> rangeOffset(numRanges + 1, 0);
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		int count = 0;
+		for (int i = begin; i < end; i++) count += isKept(i) ? 1 : 0;
+		rangeOffset[rangeId + 1] = count;
+	});
+	for (int rangeId = 0; rangeId < numRanges; rangeId++) rangeOffset[rangeId + 1] += rangeOffset[rangeId];
+
+	output.resize(rangeOffset[numRanges]);
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		int addr = rangeOffset[rangeId];
+		for (int i = begin; i < end; i++)
+		{
+			if (isKept(i)) output[addr++] = (IndexType)i;
+		}
+	});
+	return rangeOffset[numRanges];
+}
+
+// stable compaction of the elements with isKept(element), returns the surviving count
+template <typename T, typename Predicate>
+int ParallelCompact(const T* input, int n, const Predicate& isKept, std::vector<T>& output, int numThreads)
+{
+	output.clear();
+	if (n <= 0) return 0;
+	int numRanges = GetNumScanRanges(n, numThreads);
+	std::vector<int> rangeOffset(numRanges + 1, 0);
+
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		int count = 0;
+		for (int i = begin; i < end; i++) count += isKept(input[i]) ? 1 : 0;
+		rangeOffset[rangeId + 1] = count;
+	});
+	for (int rangeId = 0; rangeId < numRanges; rangeId++) rangeOffset[rangeId + 1] += rangeOffset[rangeId];
+
+	output.resize(rangeOffset[numRanges]);
+	ParallelForStatic(0, n, numRanges, [&](int begin, int end, int rangeId)
+	{
+		int addr = rangeOffset[rangeId];
+		for (int i = begin; i < end; i++)
+		{
+			if (isKept(input[i])) output[addr++] = input[i];
+		}
+	});
+	return rangeOffset[numRanges];
+}
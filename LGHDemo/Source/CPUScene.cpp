@@ -0,0 +1,742 @@
+#include "CPUScene.h"
+#include "CPUParallel.h"
+#include "CPUSort.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	float SRGBToLinear(uint8_t c)
+	{
+		static const std::vector<float> table = []()
+		{
+			std::vector<float> t(256);
+			for (int i = 0; i < 256; i++)
+			{
+				float s = i / 255.f;
+				t[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+			}
+			return t;
+		}();
+		return table[c];
+	}
+
+	int Wrap(int i, int n)
+	{
+		i %= n;
+		return i < 0 ? i + n : i;
+	}
+
+	// of the 8 corners, which keeps the bounds exact under the identity
+	void TransformBounds(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+		glm::vec3& outMin, glm::vec3& outMax)
+	{
+		outMin = glm::vec3(FLT_MAX);
+		outMax = glm::vec3(-FLT_MAX);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 p(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z);
+			p = glm::vec3(transform * glm::vec4(p, 1.f));
+			outMin = glm::min(outMin, p);
+			outMax = glm::max(outMax, p);
+		}
+	}
+}
+
+glm::vec4 CPUSceneTexture::Sample(const glm::vec2& uv) const
+{
+	if (width == 0 || height == 0) return glm::vec4(1.f);
+
+	// texel centers are at half integers
+	float x = uv.x * width - 0.5f;
+	float y = uv.y * height - 0.5f;
+	float x0 = std::floor(x);
+	float y0 = std::floor(y);
+	float fx = x - x0;
+	float fy = y - y0;
+	int ix = Wrap((int)x0, width);
+	int iy = Wrap((int)y0, height);
+	int ixp = ix + 1 == width ? 0 : ix + 1;
+	int iyp = iy + 1 == height ? 0 : iy + 1;
+
+	auto texel = [&](int tx, int ty)
+	{
+		const uint8_t* t = texels.data() + 4 * ((size_t)ty * width + tx);
+		if (isSRGB) return glm::vec4(SRGBToLinear(t[0]), SRGBToLinear(t[1]), SRGBToLinear(t[2]), t[3] / 255.f);
+		return glm::vec4(t[0], t[1], t[2], t[3]) / 255.f;
+	};
+	return glm::mix(glm::mix(texel(ix, iy), texel(ixp, iy), fx), glm::mix(texel(ix, iyp), texel(ixp, iyp), fx), fy);
+}
+
+void CPUScene::Clear()
+{
+	textures.clear();
+	materials.clear();
+	vertices.clear();
+	triangleIndices.clear();
+	triangleMaterials.clear();
+	triangleAlpha.clear();
+	triangleInstances.clear();
+	materialAlpha.clear();
+	triangles.clear();
+	nodes.clear();
+	instances.clear();
+	instanceTree.clear();
+	instanceOrder.clear();
+	topNodes.clear();
+}
+
+int CPUScene::AddTexture(int width, int height, int numComponents, const uint8_t* data, bool isSRGB)
+{
+	CPUSceneTexture texture;
+	texture.width = width;
+	texture.height = height;
+	texture.isSRGB = isSRGB;
+	texture.texels.resize((size_t)width * height * 4);
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* src = data + (size_t)y * width * numComponents;
+		uint8_t* dst = texture.texels.data() + (size_t)y * width * 4;
+		for (int x = 0; x < width; x++)
+		{
+			dst[4 * x] = src[numComponents * x];
+			dst[4 * x + 1] = src[numComponents * x + 1];
+			dst[4 * x + 2] = src[numComponents * x + 2];
+			dst[4 * x + 3] = numComponents == 4 ? src[numComponents * x + 3] : 255;
+		}
+	}
+	textures.push_back(std::move(texture));
+	return (int)textures.size() - 1;
+}
+
+int CPUScene::AddMaterial(const CPUSceneMaterial& material)
+{
+	materials.push_back(material);
+	materialAlpha.emplace_back();
+	if (material.diffuseTexture >= 0)
+	{
+		const CPUSceneTexture& texture = textures[material.diffuseTexture];
+		materialAlpha.back().Build(texture.width, texture.height, 4, texture.texels.data());
+	}
+	return (int)materials.size() - 1;
+}
+
+int CPUScene::AddInstance(const glm::mat4& transform)
+{
+	instances.emplace_back();
+	SetInstanceTransform((int)instances.size() - 1, transform);
+	return (int)instances.size() - 1;
+}
+
+void CPUScene::AddMesh(const CPUSceneVertex* meshVertices, int numVertices, const uint32_t* indices, int numIndices,
+	int material, int instance)
+{
+	uint32_t baseVertex = (uint32_t)vertices.size();
+	vertices.insert(vertices.end(), meshVertices, meshVertices + numVertices);
+
+	for (int i = 0; i + 2 < numIndices; i += 3)
+	{
+		glm::uvec3 tri(indices[i], indices[i + 1], indices[i + 2]);
+		triangleIndices.push_back(tri + baseVertex);
+		triangleMaterials.push_back(material);
+		triangleAlpha.push_back(materialAlpha[material].Classify(meshVertices[tri.x].uv, meshVertices[tri.y].uv, meshVertices[tri.z].uv));
+		triangleInstances.push_back(instance);
+	}
+}
+
+void CPUScene::Build(int numThreads)
+{
+	int numTriangles = NumTriangles();
+	int numInstances = NumInstances();
+	nodes.clear();
+	triangles.clear();
+	instanceTree.clear();
+	instanceOrder.clear();
+	topNodes.clear();
+	isAVX2Enabled = IsAVX2Supported();
+	buildMs = 0.0;
+
+	// triangles grouped by instance
+	std::vector<int> instanceFirst(numInstances + 1, 0);
+	for (int i = 0; i < numTriangles; i++) instanceFirst[triangleInstances[i] + 1]++;
+	for (int id = 0; id < numInstances; id++) instanceFirst[id + 1] += instanceFirst[id];
+	std::vector<int> order(numTriangles);
+	std::vector<int> offsets(instanceFirst.begin(), instanceFirst.end() - 1);
+	for (int i = 0; i < numTriangles; i++) order[offsets[triangleInstances[i]]++] = i;
+
+	// the BVH of every instance, each on all threads, its nodes appended with children that index nodes
+	// and the triangles in leaf order
+	std::vector<glm::vec3> primMin, primMax;
+	std::vector<int> instanceTriangles;
+	std::vector<CPUBVH8Node> instanceNodes;
+	for (int id = 0; id < numInstances; id++)
+	{
+		Instance& instance = instances[id];
+		int first = instanceFirst[id];
+		int count = instanceFirst[id + 1] - first;
+		instance.rootNode = -1;
+		if (count == 0) continue;
+
+		primMin.resize(count);
+		primMax.resize(count);
+		ParallelFor(0, count, 65536, numThreads, [&](int begin, int end, int)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const glm::uvec3& tri = triangleIndices[order[first + i]];
+				const glm::vec3& p0 = vertices[tri.x].position;
+				const glm::vec3& p1 = vertices[tri.y].position;
+				const glm::vec3& p2 = vertices[tri.z].position;
+				primMin[i] = glm::min(p0, glm::min(p1, p2));
+				primMax[i] = glm::max(p0, glm::max(p1, p2));
+			}
+		});
+
+		CPUBVHBuilder builder;
+		builder.Build(primMin, primMax, LEAF_SIZE, numThreads);
+		buildMs += builder.buildMs;
+		CollapseBVH8(builder.nodes, instanceNodes);
+		int firstNode = (int)nodes.size();
+		for (CPUBVH8Node& node : instanceNodes)
+		{
+			for (int k = 0; k < 8; k++)
+			{
+				if (node.count[k] >= 0) node.child[k] += node.count[k] > 0 ? first : firstNode;
+			}
+		}
+		nodes.insert(nodes.end(), instanceNodes.begin(), instanceNodes.end());
+		instance.rootNode = firstNode;
+		instance.boundsMin = builder.nodes[0].boundsMin;
+		instance.boundsMax = builder.nodes[0].boundsMax;
+
+		instanceTriangles.assign(order.begin() + first, order.begin() + first + count);
+		for (int i = 0; i < count; i++) order[first + i] = instanceTriangles[builder.primIndices[i]];
+	}
+
+	std::vector<glm::uvec3> sortedIndices(numTriangles);
+	std::vector<int> sortedMaterials(numTriangles);
+	std::vector<CPUAlphaState> sortedAlpha(numTriangles);
+	std::vector<int> sortedInstances(numTriangles);
+	triangles.resize(numTriangles);
+	ParallelFor(0, numTriangles, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			sortedIndices[i] = triangleIndices[order[i]];
+			sortedMaterials[i] = triangleMaterials[order[i]];
+			sortedAlpha[i] = triangleAlpha[order[i]];
+			sortedInstances[i] = triangleInstances[order[i]];
+			triangles[i].v0 = vertices[sortedIndices[i].x].position;
+			triangles[i].v1 = vertices[sortedIndices[i].y].position;
+			triangles[i].v2 = vertices[sortedIndices[i].z].position;
+		}
+	});
+	triangleIndices.swap(sortedIndices);
+	triangleMaterials.swap(sortedMaterials);
+	triangleAlpha.swap(sortedAlpha);
+	triangleInstances.swap(sortedInstances);
+
+	// one instance per leaf over their world bounds
+	std::vector<int> ids;
+	for (int id = 0; id < numInstances; id++)
+	{
+		if (instances[id].rootNode >= 0) ids.push_back(id);
+	}
+	if (ids.empty()) return;
+	primMin.resize(ids.size());
+	primMax.resize(ids.size());
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		Instance& instance = instances[ids[i]];
+		TransformBounds(instance.objectToWorld, instance.boundsMin, instance.boundsMax, instance.worldMin, instance.worldMax);
+		primMin[i] = instance.worldMin;
+		primMax[i] = instance.worldMax;
+	}
+	CPUBVHBuilder builder;
+	builder.Build(primMin, primMax, 1, 1);
+	buildMs += builder.buildMs;
+	instanceTree = builder.nodes;
+	instanceOrder.resize(ids.size());
+	for (size_t i = 0; i < ids.size(); i++) instanceOrder[i] = ids[builder.primIndices[i]];
+	CollapseBVH8(instanceTree, topNodes);
+	boundsMin = instanceTree[0].boundsMin;
+	boundsMax = instanceTree[0].boundsMax;
+}
+
+void CPUScene::SetInstanceTransform(int instance, const glm::mat4& transform)
+{
+	Instance& target = instances[instance];
+	target.objectToWorld = transform;
+	target.worldToObject = glm::inverse(transform);
+	target.normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+	target.isIdentity = transform == glm::mat4(1.f);
+}
+
+void CPUScene::Refit()
+{
+	if (instanceTree.empty()) return;
+	auto start = std::chrono::steady_clock::now();
+
+	for (Instance& instance : instances)
+	{
+		if (instance.rootNode >= 0) TransformBounds(instance.objectToWorld, instance.boundsMin, instance.boundsMax, instance.worldMin, instance.worldMax);
+	}
+
+	// children come after their parent
+	for (int i = (int)instanceTree.size() - 1; i >= 0; i--)
+	{
+		CPUBVHNode& node = instanceTree[i];
+		if (node.count > 0)
+		{
+			node.boundsMin = glm::vec3(FLT_MAX);
+			node.boundsMax = glm::vec3(-FLT_MAX);
+			for (int j = node.firstOrChild; j < node.firstOrChild + node.count; j++)
+			{
+				node.boundsMin = glm::min(node.boundsMin, instances[instanceOrder[j]].worldMin);
+				node.boundsMax = glm::max(node.boundsMax, instances[instanceOrder[j]].worldMax);
+			}
+		}
+		else
+		{
+			const CPUBVHNode& left = instanceTree[node.firstOrChild];
+			const CPUBVHNode& right = instanceTree[node.firstOrChild + 1];
+			node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+		}
+	}
+	CollapseBVH8(instanceTree, topNodes);
+	boundsMin = instanceTree[0].boundsMin;
+	boundsMax = instanceTree[0].boundsMax;
+
+	refitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+CPUScene::RayData CPUScene::MakeRayData(const glm::vec3& origin, const glm::vec3& direction, float tMin)
+{
+	RayData ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	ray.tMin = tMin;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		// no infinities, so that a box plane through the origin does not give 0 * inf
+		float d = direction[axis];
+		ray.invDirection[axis] = 1.f / (std::abs(d) > 1e-20f ? d : (d < 0.f ? -1e-20f : 1e-20f));
+	}
+
+	glm::vec3 a = glm::abs(direction);
+	ray.kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+	ray.kx = (ray.kz + 1) % 3;
+	ray.ky = (ray.kx + 1) % 3;
+	// keeps the winding of the sheared triangles
+	if (direction[ray.kz] < 0.f) std::swap(ray.kx, ray.ky);
+	ray.shear = glm::vec3(direction[ray.kx] / direction[ray.kz], direction[ray.ky] / direction[ray.kz], 1.f / direction[ray.kz]);
+	return ray;
+}
+
+bool CPUScene::Intersect(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax,
+	bool cullBackFaces, bool alphaTest, CPUSceneHit& hit) const
+{
+	return Traverse<false>(MakeRayData(origin, direction, tMin), tMax, cullBackFaces, alphaTest, hit);
+}
+
+bool CPUScene::Occluded(const CPUSceneRay& ray, bool alphaTest) const
+{
+	CPUSceneHit hit;
+	return Traverse<true>(MakeRayData(ray.origin, ray.direction, ray.tMin), ray.tMax, false, alphaTest, hit);
+}
+
+int CPUScene::Intersect8(const CPUSceneRay* rays, int rayMask, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const
+{
+	return TraversePacket<false>(rays, rayMask, cullBackFaces, alphaTest, hits);
+}
+
+int CPUScene::Occluded8(const CPUSceneRay* rays, int rayMask, bool alphaTest) const
+{
+	CPUSceneHit hits[8];
+	return TraversePacket<true>(rays, rayMask, false, alphaTest, hits);
+}
+
+void CPUScene::IntersectStream(const CPUSceneRay* rays, int numRays, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const
+{
+	std::vector<int> order;
+	SortRays(rays, numRays, order);
+	for (int first = 0; first < numRays; first += 8)
+	{
+		CPUSceneRay packet[8];
+		CPUSceneHit packetHits[8];
+		int numLanes = std::min(8, numRays - first);
+		for (int lane = 0; lane < numLanes; lane++) packet[lane] = rays[order[first + lane]];
+		TraversePacket<false>(packet, (1 << numLanes) - 1, cullBackFaces, alphaTest, packetHits);
+		for (int lane = 0; lane < numLanes; lane++) hits[order[first + lane]] = packetHits[lane];
+	}
+}
+
+void CPUScene::OccludedStream(const CPUSceneRay* rays, int numRays, bool alphaTest, uint8_t* occluded) const
+{
+	std::vector<int> order;
+	SortRays(rays, numRays, order);
+	for (int first = 0; first < numRays; first += 8)
+	{
+		CPUSceneRay packet[8];
+		CPUSceneHit packetHits[8];
+		int numLanes = std::min(8, numRays - first);
+		for (int lane = 0; lane < numLanes; lane++) packet[lane] = rays[order[first + lane]];
+		int mask = TraversePacket<true>(packet, (1 << numLanes) - 1, false, alphaTest, packetHits);
+		for (int lane = 0; lane < numLanes; lane++) occluded[order[first + lane]] = (mask >> lane) & 1;
+	}
+}
+
+void CPUScene::SortRays(const CPUSceneRay* rays, int numRays, std::vector<int>& order) const
+{
+	// direction octant, then the Morton code of the origin on a 1024^3 grid over the scene bounds
+	glm::vec3 scale = 1023.f / glm::max(boundsMax - boundsMin, glm::vec3(FLT_MIN));
+	std::vector<uint64_t> keys(numRays);
+	for (int i = 0; i < numRays; i++)
+	{
+		const glm::vec3& d = rays[i].direction;
+		uint64_t octant = (d.x < 0.f ? 1 : 0) | (d.y < 0.f ? 2 : 0) | (d.z < 0.f ? 4 : 0);
+		glm::uvec3 cell(glm::clamp((rays[i].origin - boundsMin) * scale, glm::vec3(0.f), glm::vec3(1023.f)));
+		keys[i] = (octant << 62) | ((uint64_t)EncodeMorton3(cell.x, cell.y, cell.z) << 32) | (uint32_t)i;
+	}
+	std::sort(keys.begin(), keys.end());
+
+	order.resize(numRays);
+	for (int i = 0; i < numRays; i++) order[i] = (int)(keys[i] & 0xFFFFFFFF);
+}
+
+CPUScene::RayData CPUScene::ToObjectSpace(const Instance& instance, const RayData& ray)
+{
+	// directions are not normalized so that distances stay those of world space
+	glm::vec3 origin(instance.worldToObject * glm::vec4(ray.origin, 1.f));
+	glm::vec3 direction(glm::mat3(instance.worldToObject) * ray.direction);
+	return MakeRayData(origin, direction, ray.tMin);
+}
+
+void CPUScene::SetPacketLane(PacketState& state, int lane, const RayData& ray, float tMax)
+{
+	state.rayData[lane] = ray;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		state.packet.origin[axis][lane] = ray.origin[axis];
+		state.packet.invDirection[axis][lane] = ray.invDirection[axis];
+	}
+	state.packet.tMin[lane] = ray.tMin;
+	state.packet.tMax[lane] = tMax;
+}
+
+template <bool isAnyHit>
+void CPUScene::RecordPacketHit(PacketState& state, int lane, float t)
+{
+	state.hitMask |= 1 << lane;
+	if (isAnyHit) state.rayMask &= ~(1 << lane);
+	else state.packet.tMax[lane] = t;
+}
+
+template <bool isAnyHit, typename LeafTest>
+bool CPUScene::TraverseNodes(const std::vector<CPUBVH8Node>& wideNodes, const RayData& ray, float& closest,
+	int rootIndex, int rootCount, const LeafTest& leafTest) const
+{
+	// a leaf child is pushed with its primitive count, an inner one with count 0
+	struct Entry
+	{
+		int index;
+		int count;
+		float tNear;
+	};
+	Entry stack[STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = { rootIndex, rootCount, ray.tMin };
+
+	bool isHit = false;
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		if (entry.tNear > closest) continue;
+
+		if (entry.count > 0)
+		{
+			if (!leafTest(entry.index, entry.count, closest)) continue;
+			if (isAnyHit) return true;
+			isHit = true;
+			continue;
+		}
+
+		const CPUBVH8Node& node = wideNodes[entry.index];
+		float tNear[8];
+		int mask = isAVX2Enabled ? IntersectBVH8NodeAVX2(node, ray.origin, ray.invDirection, ray.tMin, closest, tNear)
+			: IntersectBVH8Node(node, ray.origin, ray.invDirection, ray.tMin, closest, tNear);
+
+		// nearest child on top
+		int first = stackSize;
+		for (int k = 0; k < 8; k++)
+		{
+			if (!(mask & (1 << k))) continue;
+			Entry child = { node.child[k], node.count[k], tNear[k] };
+			int j = stackSize++;
+			for (; j > first && stack[j - 1].tNear < child.tNear; j--) stack[j] = stack[j - 1];
+			stack[j] = child;
+		}
+	}
+	return isHit;
+}
+
+template <bool isAnyHit, typename LeafTest, typename SingleRay>
+void CPUScene::TraversePacketNodes(const std::vector<CPUBVH8Node>& wideNodes, PacketState& state, int rootIndex, int rootCount,
+	int rootMask, const LeafTest& leafTest, const SingleRay& singleRay) const
+{
+	struct Entry
+	{
+		int index;
+		int count;
+		int rayMask;
+		float tNear;
+	};
+	Entry stack[STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = { rootIndex, rootCount, rootMask, 0.f };
+
+	while (stackSize > 0)
+	{
+		Entry entry = stack[--stackSize];
+		int active = entry.rayMask & state.rayMask;
+		if (!active) continue;
+
+		// few rays left: they go on alone
+		int numActive = 0;
+		for (int lane = 0; lane < 8; lane++) numActive += (active >> lane) & 1;
+		if (numActive <= MAX_SINGLE_RAYS)
+		{
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (active & (1 << lane)) singleRay(lane, entry.index, entry.count);
+			}
+		}
+		else if (entry.count > 0)
+		{
+			leafTest(entry.index, entry.count, active);
+		}
+		else
+		{
+			const CPUBVH8Node& node = wideNodes[entry.index];
+			int childRayMasks[8];
+			float childNear[8];
+			if (isAVX2Enabled) IntersectBVH8NodePacketAVX2(node, state.packet, active, childRayMasks, childNear);
+			else IntersectBVH8NodePacket(node, state.packet, active, childRayMasks, childNear);
+
+			int first = stackSize;
+			for (int k = 0; k < 8; k++)
+			{
+				if (!childRayMasks[k]) continue;
+				Entry child = { node.child[k], node.count[k], childRayMasks[k], childNear[k] };
+				int j = stackSize++;
+				for (; j > first && stack[j - 1].tNear < child.tNear; j--) stack[j] = stack[j - 1];
+				stack[j] = child;
+			}
+		}
+		if (isAnyHit && !state.rayMask) break;
+	}
+}
+
+template <bool isAnyHit>
+bool CPUScene::Traverse(const RayData& ray, float tMax, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit,
+	int rootIndex, int rootCount) const
+{
+	if (topNodes.empty()) return false;
+
+	float closest = tMax;
+	return TraverseNodes<isAnyHit>(topNodes, ray, closest, rootIndex, rootCount, [&](int first, int count, float& leafClosest)
+	{
+		bool isHit = false;
+		for (int i = first; i < first + count; i++)
+		{
+			const Instance& instance = instances[instanceOrder[i]];
+			RayData objectRay;
+			if (!instance.isIdentity) objectRay = ToObjectSpace(instance, ray);
+			if (!TraverseInstance<isAnyHit>(instance.isIdentity ? ray : objectRay, leafClosest, cullBackFaces, alphaTest, hit,
+				instance.rootNode, 0)) continue;
+			if (isAnyHit) return true;
+			isHit = true;
+		}
+		return isHit;
+	});
+}
+
+template <bool isAnyHit>
+bool CPUScene::TraverseInstance(const RayData& ray, float& closest, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit,
+	int rootIndex, int rootCount) const
+{
+	return TraverseNodes<isAnyHit>(nodes, ray, closest, rootIndex, rootCount, [&](int first, int count, float& leafClosest)
+	{
+		bool isHit = false;
+		for (int i = first; i < first + count; i++)
+		{
+			if (!IntersectTriangle(i, ray, leafClosest, cullBackFaces, alphaTest, hit)) continue;
+			if (isAnyHit) return true;
+			leafClosest = hit.t;
+			isHit = true;
+		}
+		return isHit;
+	});
+}
+
+template <bool isAnyHit>
+int CPUScene::TraversePacket(const CPUSceneRay* rays, int rayMask, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const
+{
+	PacketState state;
+	state.rayMask = rayMask;
+	state.hitMask = 0;
+	for (int lane = 0; lane < 8; lane++)
+	{
+		hits[lane].triangle = -1;
+		if (rayMask & (1 << lane)) SetPacketLane(state, lane, MakeRayData(rays[lane].origin, rays[lane].direction, rays[lane].tMin), rays[lane].tMax);
+	}
+	if (topNodes.empty()) return 0;
+
+	auto leafTest = [&](int first, int count, int active)
+	{
+		for (int i = first; i < first + count; i++)
+		{
+			const Instance& instance = instances[instanceOrder[i]];
+			int mask = active & state.rayMask;
+			if (instance.isIdentity)
+			{
+				TraversePacketInstance<isAnyHit>(state, cullBackFaces, alphaTest, hits, instance.rootNode, 0, mask);
+				continue;
+			}
+
+			PacketState objectState;
+			objectState.rayMask = mask;
+			objectState.hitMask = 0;
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (mask & (1 << lane)) SetPacketLane(objectState, lane, ToObjectSpace(instance, state.rayData[lane]), state.packet.tMax[lane]);
+			}
+			TraversePacketInstance<isAnyHit>(objectState, cullBackFaces, alphaTest, hits, instance.rootNode, 0, mask);
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (objectState.hitMask & (1 << lane)) RecordPacketHit<isAnyHit>(state, lane, objectState.packet.tMax[lane]);
+			}
+		}
+	};
+	auto singleRay = [&](int lane, int index, int count)
+	{
+		CPUSceneHit hit;
+		if (!Traverse<isAnyHit>(state.rayData[lane], state.packet.tMax[lane], cullBackFaces, alphaTest, hit, index, count)) return;
+		hits[lane] = hit;
+		RecordPacketHit<isAnyHit>(state, lane, hit.t);
+	};
+	TraversePacketNodes<isAnyHit>(topNodes, state, 0, 0, rayMask, leafTest, singleRay);
+	return state.hitMask;
+}
+
+template <bool isAnyHit>
+void CPUScene::TraversePacketInstance(PacketState& state, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits,
+	int rootIndex, int rootCount, int rootMask) const
+{
+	auto leafTest = [&](int first, int count, int active)
+	{
+		for (int i = first; i < first + count; i++)
+		{
+			for (int lane = 0; lane < 8; lane++)
+			{
+				if (!(active & (1 << lane))) continue;
+				if (!IntersectTriangle(i, state.rayData[lane], state.packet.tMax[lane], cullBackFaces, alphaTest, hits[lane])) continue;
+				RecordPacketHit<isAnyHit>(state, lane, hits[lane].t);
+				if (isAnyHit) active &= ~(1 << lane);
+			}
+		}
+	};
+	auto singleRay = [&](int lane, int index, int count)
+	{
+		CPUSceneHit hit;
+		float closest = state.packet.tMax[lane];
+		if (!TraverseInstance<isAnyHit>(state.rayData[lane], closest, cullBackFaces, alphaTest, hit, index, count)) return;
+		hits[lane] = hit;
+		RecordPacketHit<isAnyHit>(state, lane, hit.t);
+	};
+	TraversePacketNodes<isAnyHit>(nodes, state, rootIndex, rootCount, rootMask, leafTest, singleRay);
+}
+
+bool CPUScene::IntersectTriangle(int triangle, const RayData& ray, float tMax, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit) const
+{
+	CPUAlphaState alpha = alphaTest ? triangleAlpha[triangle] : ALPHA_OPAQUE;
+	if (alpha == ALPHA_TRANSPARENT) return false;
+
+	const Triangle& tri = triangles[triangle];
+	glm::vec3 a = tri.v0 - ray.origin;
+	glm::vec3 b = tri.v1 - ray.origin;
+	glm::vec3 c = tri.v2 - ray.origin;
+	float ax = a[ray.kx] - ray.shear.x * a[ray.kz];
+	float ay = a[ray.ky] - ray.shear.y * a[ray.kz];
+	float bx = b[ray.kx] - ray.shear.x * b[ray.kz];
+	float by = b[ray.ky] - ray.shear.y * b[ray.kz];
+	float cx = c[ray.kx] - ray.shear.x * c[ray.kz];
+	float cy = c[ray.ky] - ray.shear.y * c[ray.kz];
+
+	// scaled barycentrics of v0, v1 and v2, recomputed in double on an edge
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+	if (u == 0.f || v == 0.f || w == 0.f)
+	{
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+	if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f)) return false;
+	// det is positive when the vertices appear clockwise
+	float det = u + v + w;
+	if (det == 0.f || (cullBackFaces && det < 0.f)) return false;
+
+	float invDet = 1.f / det;
+	float t = (u * a[ray.kz] + v * b[ray.kz] + w * c[ray.kz]) * ray.shear.z * invDet;
+	if (t < ray.tMin || t >= tMax) return false;
+
+	CPUSceneHit candidate;
+	candidate.triangle = triangle;
+	candidate.t = t;
+	candidate.u = v * invDet;
+	candidate.v = w * invDet;
+	if (alpha == ALPHA_MIXED && textures[GetMaterial(candidate).diffuseTexture].Sample(GetUV(candidate)).a < 0.5f) return false;
+	hit = candidate;
+	return true;
+}
+
+glm::vec2 CPUScene::GetUV(const CPUSceneHit& hit) const
+{
+	const glm::uvec3& tri = triangleIndices[hit.triangle];
+	return (1.f - hit.u - hit.v) * vertices[tri.x].uv + hit.u * vertices[tri.y].uv + hit.v * vertices[tri.z].uv;
+}
+
+glm::vec3 CPUScene::GetVertexNormal(const CPUSceneHit& hit) const
+{
+	const glm::uvec3& tri = triangleIndices[hit.triangle];
+	const Instance& instance = instances[triangleInstances[hit.triangle]];
+	return glm::normalize(instance.normalMatrix *
+		((1.f - hit.u - hit.v) * vertices[tri.x].normal + hit.u * vertices[tri.y].normal + hit.v * vertices[tri.z].normal));
+}
+
+glm::vec3 CPUScene::GetShadingNormal(const CPUSceneHit& hit, const glm::vec2& uv) const
+{
+	const glm::uvec3& tri = triangleIndices[hit.triangle];
+	const CPUSceneVertex& a = vertices[tri.x];
+	const CPUSceneVertex& b = vertices[tri.y];
+	const CPUSceneVertex& c = vertices[tri.z];
+	const Instance& instance = instances[triangleInstances[hit.triangle]];
+	glm::mat3 linear(instance.objectToWorld);
+	float w = 1.f - hit.u - hit.v;
+	glm::vec3 normal = glm::normalize(instance.normalMatrix * (w * a.normal + hit.u * b.normal + hit.v * c.normal));
+
+	// all(vsTangent) == 0 of the hit shaders, a tangent with a zero component is undefined
+	glm::vec3 tangent = linear * (w * a.tangent + hit.u * b.tangent + hit.v * c.tangent);
+	const CPUSceneMaterial& material = GetMaterial(hit);
+	if (material.normalTexture < 0 || tangent.x == 0.f || tangent.y == 0.f || tangent.z == 0.f) return normal;
+
+	tangent = glm::normalize(tangent);
+	glm::vec3 bitangent = glm::normalize(linear * (w * a.bitangent + hit.u * b.bitangent + hit.v * c.bitangent));
+	glm::vec3 n = glm::vec3(textures[material.normalTexture].Sample(uv)) * 2.f - 1.f;
+	return glm::normalize(n.x * tangent + n.y * bitangent + n.z * normal);
+}
@@ -0,0 +1,224 @@
+#pragma once
+#include "CPUAlphaCoverage.h"
+#include "CPUBVH.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// a texture as the hit shaders sample it at mip 0: RGBA8 rows in GPU order (row 0 at v = 0),
+// bilinear with wrapping, sRGB textures are decoded to linear before filtering
+struct CPUSceneTexture
+{
+	int width = 0;
+	int height = 0;
+	bool isSRGB = false;
+	std::vector<uint8_t> texels;
+
+	glm::vec4 Sample(const glm::vec2& uv) const;
+};
+
+struct CPUSceneMaterial
+{
+	glm::vec3 albedo = glm::vec3(1.f); // m_materialAlbedo
+	int diffuseTexture = -1; // no texture samples as white (the "default" texture)
+	int normalTexture = -1;
+};
+
+struct CPUSceneVertex
+{
+	glm::vec3 position;
+	glm::vec2 uv;
+	glm::vec3 normal;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+};
+
+// the closest hit of a ray, u and v are the barycentrics of the second and third vertex
+struct CPUSceneHit
+{
+	int triangle = -1;
+	float t;
+	float u, v;
+};
+
+struct CPUSceneRay
+{
+	glm::vec3 origin;
+	float tMin;
+	glm::vec3 direction;
+	float tMax;
+};
+
+// the triangles of the loaded models in two levels, the CPU counterpart of the DXR TLAS/BLASes: every
+// instance (a model) has a BVH over its object space triangles, built once, and a small BVH over the
+// world bounds of the instances is refit when their transforms change
+class CPUScene
+{
+public:
+
+	CPUScene() {};
+
+	void Clear();
+
+	// numComponents is 3 or 4, rows in GPU order
+	int AddTexture(int width, int height, int numComponents, const uint8_t* data, bool isSRGB);
+	// the diffuse texture is added first, its alpha classifies the triangles of the material
+	int AddMaterial(const CPUSceneMaterial& material);
+
+	// transform takes the meshes of the instance to world space, as the instance transform of the TLAS does
+	int AddInstance(const glm::mat4& transform);
+
+	// vertices are in object space. Triangles keep their object space facing and get their
+	// CPUAlphaState from their UVs.
+	void AddMesh(const CPUSceneVertex* vertices, int numVertices, const uint32_t* indices, int numIndices,
+		int material, int instance);
+
+	// builds the BVH of every instance and the one over the instances, both collapsed to 8-wide nodes
+	void Build(int numThreads);
+
+	// new transforms only take effect with Refit, which updates the instance bounds and the BVH over
+	// them (not the instance BVHs) in microseconds. The tree keeps the topology of the last Build.
+	void SetInstanceTransform(int instance, const glm::mat4& transform);
+	void Refit();
+
+	// closest hit within [tMin, tMax]. cullBackFaces is RAY_FLAG_CULL_BACK_FACING_TRIANGLES (front
+	// faces are clockwise seen from the ray origin), alphaTest runs the AnyHit test of LightHit and
+	// ignores hits where the diffuse alpha is below 0.5. It only samples the texture on
+	// ALPHA_MIXED triangles.
+	bool Intersect(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax,
+		bool cullBackFaces, bool alphaTest, CPUSceneHit& hit) const;
+
+	// any hit within [tMin, tMax], a shadow ray with RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH
+	bool Occluded(const CPUSceneRay& ray, bool alphaTest) const;
+
+	// a packet of 8 coherent rays (rays[lane] for the lanes in rayMask) traced together, which pays
+	// off for primary and interleaved sample rays. hits[lane].triangle is -1 on a miss. Returns the
+	// mask of the rays that hit.
+	int Intersect8(const CPUSceneRay* rays, int rayMask, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const;
+	int Occluded8(const CPUSceneRay* rays, int rayMask, bool alphaTest) const;
+
+	// large batches of rays in any order: sorted by direction octant and origin into packets of 8.
+	// Runs on the calling thread, callers parallelize over batches.
+	void IntersectStream(const CPUSceneRay* rays, int numRays, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const;
+	void OccludedStream(const CPUSceneRay* rays, int numRays, bool alphaTest, uint8_t* occluded) const;
+
+	// interpolated vertex attributes of a hit
+	glm::vec2 GetUV(const CPUSceneHit& hit) const;
+	glm::vec3 GetVertexNormal(const CPUSceneHit& hit) const;
+
+	// the shading normal of the hit shaders: the vertex normal, perturbed by the normal texture
+	// when the tangent frame is defined
+	glm::vec3 GetShadingNormal(const CPUSceneHit& hit, const glm::vec2& uv) const;
+
+	const CPUSceneMaterial& GetMaterial(const CPUSceneHit& hit) const { return materials[triangleMaterials[hit.triangle]]; }
+
+	int NumTriangles() const { return (int)triangleIndices.size(); }
+	int NumTriangles(CPUAlphaState state) const { return (int)std::count(triangleAlpha.begin(), triangleAlpha.end(), state); }
+
+	// of every triangle
+	const glm::vec3& GetBoundsMin() const { return boundsMin; }
+	const glm::vec3& GetBoundsMax() const { return boundsMax; }
+
+	int NumInstances() const { return (int)instances.size(); }
+
+	double buildMs = 0.0; // of the BVHs
+	double refitMs = 0.0;
+
+	std::vector<CPUSceneTexture> textures;
+	std::vector<CPUSceneMaterial> materials;
+
+private:
+
+	struct Triangle
+	{
+		glm::vec3 v0, v1, v2;
+	};
+
+	// a BLAS with its transform. Its nodes are in nodes with children that index nodes and triangles.
+	struct Instance
+	{
+		glm::mat4 objectToWorld = glm::mat4(1.f);
+		glm::mat4 worldToObject = glm::mat4(1.f);
+		glm::mat3 normalMatrix = glm::mat3(1.f);
+		bool isIdentity = true; // rays need no transform
+		int rootNode = -1; // -1 without triangles
+		glm::vec3 boundsMin, boundsMax; // object space
+		glm::vec3 worldMin, worldMax;
+	};
+
+	// a ray prepared for the box tests and for the watertight triangle test (Woop et al. 2013),
+	// which shears the triangle so the ray runs along +z of the kx, ky, kz frame
+	struct RayData
+	{
+		glm::vec3 origin, direction, invDirection;
+		float tMin;
+		int kx, ky, kz;
+		glm::vec3 shear;
+	};
+
+	static const int LEAF_SIZE = 4;
+	static const int STACK_SIZE = 7 * CPUBVHBuilder::MAX_DEPTH + 1;
+	// packet subtrees with at most this many rays left are traversed one ray at a time
+	static const int MAX_SINGLE_RAYS = 2;
+
+	// the rays of a packet in the space of one level
+	struct PacketState
+	{
+		RayData rayData[8];
+		CPUBVHPacket8 packet;
+		int rayMask; // any hit rays leave once occluded
+		int hitMask;
+	};
+
+	static RayData MakeRayData(const glm::vec3& origin, const glm::vec3& direction, float tMin);
+	static RayData ToObjectSpace(const Instance& instance, const RayData& ray);
+	static void SetPacketLane(PacketState& state, int lane, const RayData& ray, float tMax);
+	template <bool isAnyHit>
+	static void RecordPacketHit(PacketState& state, int lane, float t);
+
+	// the stack traversals of a level from the entry (rootIndex, rootCount), leafTest(first, count, ...)
+	// tests the primitives of a leaf
+	template <bool isAnyHit, typename LeafTest>
+	bool TraverseNodes(const std::vector<CPUBVH8Node>& wideNodes, const RayData& ray, float& closest,
+		int rootIndex, int rootCount, const LeafTest& leafTest) const;
+	template <bool isAnyHit, typename LeafTest, typename SingleRay>
+	void TraversePacketNodes(const std::vector<CPUBVH8Node>& wideNodes, PacketState& state, int rootIndex, int rootCount,
+		int rootMask, const LeafTest& leafTest, const SingleRay& singleRay) const;
+
+	// world space rays through the instances
+	template <bool isAnyHit>
+	bool Traverse(const RayData& ray, float tMax, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit,
+		int rootIndex = 0, int rootCount = 0) const;
+	template <bool isAnyHit>
+	int TraversePacket(const CPUSceneRay* rays, int rayMask, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits) const;
+
+	// object space rays through the triangles of an instance, from an entry of nodes
+	template <bool isAnyHit>
+	bool TraverseInstance(const RayData& ray, float& closest, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit,
+		int rootIndex, int rootCount) const;
+	template <bool isAnyHit>
+	void TraversePacketInstance(PacketState& state, bool cullBackFaces, bool alphaTest, CPUSceneHit* hits,
+		int rootIndex, int rootCount, int rootMask) const;
+
+	// ray indices in packet order
+	void SortRays(const CPUSceneRay* rays, int numRays, std::vector<int>& order) const;
+
+	bool IntersectTriangle(int triangle, const RayData& ray, float tMax, bool cullBackFaces, bool alphaTest, CPUSceneHit& hit) const;
+
+	std::vector<CPUSceneVertex> vertices;
+	std::vector<glm::uvec3> triangleIndices;
+	std::vector<int> triangleMaterials;
+	std::vector<CPUAlphaState> triangleAlpha;
+	std::vector<int> triangleInstances;
+	std::vector<CPUAlphaCoverage> materialAlpha;
+	std::vector<Triangle> triangles; // object space
+	std::vector<CPUBVH8Node> nodes; // of every instance
+
+	std::vector<Instance> instances;
+	std::vector<CPUBVHNode> instanceTree; // binary, refit in place
+	std::vector<int> instanceOrder; // leaf order of the instances with triangles
+	std::vector<CPUBVH8Node> topNodes;
+	glm::vec3 boundsMin = glm::vec3(0.f), boundsMax = glm::vec3(0.f);
+	bool isAVX2Enabled = false;
+};
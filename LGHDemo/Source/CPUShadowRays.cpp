@@ -0,0 +1,71 @@
+#include "CPUShadowRays.h"
+#include "CPUParallel.h"
+#include "CPUSort.h"
+#include <atomic>
+#include <chrono>
+
+void CPUShadowRayBatch::Trace(const CPUScene& scene, const CPUShadowRay* rays, int numRays, uint8_t* visibility, bool alphaTest, int numThreads)
+{
+	auto start = std::chrono::steady_clock::now();
+	numOccluded = 0;
+	if (numRays <= 0) return;
+
+	// bin key: octant in the high bits, Morton code of the origin tile in the low ones
+	const int tilesPerAxis = 1 << TILE_BITS;
+	glm::vec3 boundsMin = scene.GetBoundsMin();
+	glm::vec3 scale = (float)tilesPerAxis / glm::max(scene.GetBoundsMax() - boundsMin, glm::vec3(FLT_MIN));
+	keys.resize(numRays);
+	order.resize(numRays);
+	ParallelFor(0, numRays, 65536, numThreads, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			glm::vec3 d = rays[i].target - rays[i].origin;
+			uint32_t octant = (d.x < 0.f ? 1 : 0) | (d.y < 0.f ? 2 : 0) | (d.z < 0.f ? 4 : 0);
+			glm::uvec3 tile(glm::clamp((rays[i].origin - boundsMin) * scale, glm::vec3(0.f), glm::vec3((float)(tilesPerAxis - 1))));
+			keys[i] = (octant << (3 * TILE_BITS)) | EncodeMorton3(tile.x, tile.y, tile.z);
+			order[i] = (uint32_t)i;
+		}
+	});
+	ParallelRadixSort(keys, order, 3 + 3 * TILE_BITS, numThreads);
+	auto binned = std::chrono::steady_clock::now();
+	binMs = std::chrono::duration<double, std::milli>(binned - start).count();
+
+	int numPackets = (numRays + 7) / 8;
+	std::atomic<int> occluded(0);
+	ParallelFor(0, numPackets, PACKETS_PER_TASK, numThreads, [&](int begin, int end, int)
+	{
+		int taskOccluded = 0;
+		for (int packetId = begin; packetId < end; packetId++)
+		{
+			CPUSceneRay packet[8];
+			int rayMask = 0;
+			int first = packetId * 8;
+			int numLanes = std::min(8, numRays - first);
+			for (int lane = 0; lane < numLanes; lane++)
+			{
+				const CPUShadowRay& ray = rays[order[first + lane]];
+				glm::vec3 toTarget = ray.target - ray.origin;
+				float dist = glm::length(toTarget);
+				// a target within the ray offset is visible, as a DXR ray with TMin >= TMax misses
+				if (!(dist > ray.tMin)) continue;
+				packet[lane].origin = ray.origin;
+				packet[lane].tMin = ray.tMin;
+				packet[lane].direction = toTarget / dist;
+				packet[lane].tMax = dist;
+				rayMask |= 1 << lane;
+			}
+
+			int occludedMask = rayMask ? scene.Occluded8(packet, rayMask, alphaTest) : 0;
+			for (int lane = 0; lane < numLanes; lane++)
+			{
+				bool isOccluded = (occludedMask & (1 << lane)) != 0;
+				visibility[rays[order[first + lane]].pixel] = isOccluded ? 0 : 1;
+				taskOccluded += isOccluded ? 1 : 0;
+			}
+		}
+		occluded += taskOccluded;
+	});
+	numOccluded = occluded;
+	traceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - binned).count();
+}
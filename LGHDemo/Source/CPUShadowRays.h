@@ -0,0 +1,40 @@
+#pragma once
+#include "CPUScene.h"
+#include <vector>
+#include <cstdint>
+
+// one shadow ray of LGHShadowRayGen: from the surface point toward the jittered light position
+// (lightPosition + devScale * randomPos * lightDev)
+struct CPUShadowRay
+{
+	glm::vec3 origin;
+	uint32_t pixel; // where the visibility goes, e.g. the sub-pixel (shadowRate * pixelPos + offset) index
+	glm::vec3 target;
+	float tMin; // the ray offset, 0.001 * sceneRadius
+};
+
+// traces the shadow rays of a whole frame as one batch. The rays are binned by direction octant
+// and by the tile (of a 32^3 grid over the scene bounds) of their origin with a radix sort, and
+// every 8 consecutive rays of the binned order go down the BVH as one packet, any hit only.
+class CPUShadowRayBatch
+{
+public:
+
+	CPUShadowRayBatch() {};
+
+	// sets visibility[ray.pixel] to 1 when nothing lies between origin and target and to 0 otherwise,
+	// alphaTest runs the AnyHit test of ShadowHit
+	void Trace(const CPUScene& scene, const CPUShadowRay* rays, int numRays, uint8_t* visibility, bool alphaTest, int numThreads);
+
+	double binMs = 0.0;
+	double traceMs = 0.0;
+	int numOccluded = 0;
+
+private:
+
+	static const int TILE_BITS = 5; // per axis
+	static const int PACKETS_PER_TASK = 64;
+
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> order;
+};
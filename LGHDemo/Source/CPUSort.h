@@ -0,0 +1,75 @@
+#pragma once
+#include "CPUParallel.h"
+#include <vector>
+#include <cstdint>
+
+// spreads the low 10 bits of x so that there are two zero bits between each
+inline uint32_t Part1By2(uint32_t x)
+{
+	x &= 0x000003ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+// 30-bit Morton (Z-curve) code of a cell coordinate, 10 bits per axis
+inline uint32_t EncodeMorton3(uint32_t x, uint32_t y, uint32_t z)
+{
+	return Part1By2(x) | (Part1By2(y) << 1) | (Part1By2(z) << 2);
+}
+
+// stable LSD radix sort of (key, value) pairs on the low numKeyBits bits of the keys.
+// Every pass builds per-thread digit histograms over static ranges, scans them
+// digit-major (which keeps the sort stable) and scatters into the other buffer.
+// Counts and offsets are 64-bit, the sorted splat passes 8 pairs per VPL.
+inline void ParallelRadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, int numKeyBits, int numThreads)
+{
+	const int RADIX_BITS = 10;
+	const uint32_t RADIX = 1 << RADIX_BITS;
+
+	size_t n = keys.size();
+	if (n <= 1) return;
+	int numRanges = (int)std::max<size_t>(1, std::min<size_t>(numThreads, n / 4096));
+	auto rangeBegin = [&](int rangeId) { return n * rangeId / numRanges; };
+
+	std::vector<uint32_t> tempKeys(n);
+	std::vector<uint32_t> tempValues(n);
+	std::vector<size_t> histograms(numRanges * RADIX);
+
+	for (int shift = 0; shift < numKeyBits; shift += RADIX_BITS)
+	{
+		ParallelRun(numRanges, [&](int rangeId)
+		{
+			size_t* histogram = &histograms[rangeId * RADIX];
+			std::fill(histogram, histogram + RADIX, 0);
+			for (size_t i = rangeBegin(rangeId), end = rangeBegin(rangeId + 1); i < end; i++) histogram[(keys[i] >> shift) & (RADIX - 1)]++;
+		});
+
+		size_t offset = 0;
+		for (uint32_t digit = 0; digit < RADIX; digit++)
+		{
+			for (int rangeId = 0; rangeId < numRanges; rangeId++)
+			{
+				size_t count = histograms[rangeId * RADIX + digit];
+				histograms[rangeId * RADIX + digit] = offset;
+				offset += count;
+			}
+		}
+
+		ParallelRun(numRanges, [&](int rangeId)
+		{
+			size_t* offsets = &histograms[rangeId * RADIX];
+			for (size_t i = rangeBegin(rangeId), end = rangeBegin(rangeId + 1); i < end; i++)
+			{
+				size_t addr = offsets[(keys[i] >> shift) & (RADIX - 1)]++;
+				tempKeys[addr] = keys[i];
+				tempValues[addr] = values[i];
+			}
+		});
+
+		keys.swap(tempKeys);
+		values.swap(tempValues);
+	}
+}
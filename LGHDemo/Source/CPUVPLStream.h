@@ -0,0 +1,126 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+// a VPL set read in batches, used by CPULGHBuilder::BuildStreamed for sets that do not fit in memory.
+// It is read twice (bounding box, then splat), so it has to be rewindable.
+class CPUVPLSource
+{
+public:
+	virtual ~CPUVPLSource() {}
+
+	virtual long long NumVPLs() const = 0;
+	virtual void Rewind() = 0;
+
+	// fills up to maxCount VPLs (float4 position, normal, color), returns the number read, 0 at the end
+	virtual int Read(int maxCount, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors) = 0;
+};
+
+// VPLs produced on demand, generator(firstIndex, count, positions, normals, colors) has to be deterministic
+class CPUVPLGeneratorSource : public CPUVPLSource
+{
+public:
+	typedef std::function<void(long long, int, glm::vec4*, glm::vec4*, glm::vec4*)> Generator;
+
+	CPUVPLGeneratorSource(long long _numVPLs, const Generator& _generator) : numVPLs(_numVPLs), generator(_generator) {};
+
+	long long NumVPLs() const override { return numVPLs; }
+	void Rewind() override { nextVPL = 0; }
+
+	int Read(int maxCount, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors) override
+	{
+		int count = (int)std::min<long long>(maxCount, numVPLs - nextVPL);
+		if (count <= 0) return 0;
+		generator(nextVPL, count, positions, normals, colors);
+		nextVPL += count;
+		return count;
+	}
+
+private:
+	long long numVPLs;
+	long long nextVPL = 0;
+	Generator generator;
+};
+
+// VPL file: "VPLS", uint32 version, uint64 count, then the position, normal and color float4 arrays
+class CPUVPLFileSource : public CPUVPLSource
+{
+public:
+	enum : uint32_t { MAGIC = 0x534c5056, VERSION = 1 };
+
+	~CPUVPLFileSource() { Close(); }
+
+	bool Open(const char* path)
+	{
+		Close();
+		file = fopen(path, "rb");
+		if (!file) return false;
+		uint32_t header[2];
+		uint64_t count;
+		if (fread(header, sizeof(header), 1, file) != 1 || fread(&count, sizeof(count), 1, file) != 1 ||
+			header[0] != MAGIC || header[1] != VERSION)
+		{
+			Close();
+			return false;
+		}
+		numVPLs = (long long)count;
+		nextVPL = 0;
+		return true;
+	}
+
+	void Close()
+	{
+		if (file) fclose(file);
+		file = nullptr;
+		numVPLs = 0;
+	}
+
+	long long NumVPLs() const override { return numVPLs; }
+	void Rewind() override { nextVPL = 0; }
+
+	int Read(int maxCount, glm::vec4* positions, glm::vec4* normals, glm::vec4* colors) override
+	{
+		int count = (int)std::min<long long>(maxCount, numVPLs - nextVPL);
+		if (!file || count <= 0) return 0;
+		glm::vec4* attributes[3] = { positions, normals, colors };
+		for (int i = 0; i < 3; i++)
+		{
+			long long offset = HEADER_SIZE + (i * numVPLs + nextVPL) * (long long)sizeof(glm::vec4);
+			if (Seek(offset) != 0 || fread(attributes[i], sizeof(glm::vec4), count, file) != (size_t)count) return 0;
+		}
+		nextVPL += count;
+		return count;
+	}
+
+	static bool Write(const char* path, long long count, const glm::vec4* positions, const glm::vec4* normals, const glm::vec4* colors)
+	{
+		FILE* out = fopen(path, "wb");
+		if (!out) return false;
+		uint32_t header[2] = { MAGIC, VERSION };
+		uint64_t numVPLs = (uint64_t)count;
+		bool ok = fwrite(header, sizeof(header), 1, out) == 1 && fwrite(&numVPLs, sizeof(numVPLs), 1, out) == 1 &&
+			fwrite(positions, sizeof(glm::vec4), (size_t)count, out) == (size_t)count &&
+			fwrite(normals, sizeof(glm::vec4), (size_t)count, out) == (size_t)count &&
+			fwrite(colors, sizeof(glm::vec4), (size_t)count, out) == (size_t)count;
+		return fclose(out) == 0 && ok;
+	}
+
+private:
+	static const long long HEADER_SIZE = 16;
+
+	int Seek(long long offset)
+	{
+#ifdef _MSC_VER
+		return _fseeki64(file, offset, SEEK_SET);
+#else
+		return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+	}
+
+	FILE* file = nullptr;
+	long long numVPLs = 0;
+	long long nextVPL = 0;
+};
@@ -0,0 +1,125 @@
+#include "CPUVPLTracer.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+namespace
+{
+	// EPS of LightRayLib
+	const float BOUNCE_OFFSET = 0.1f;
+
+	// GetCosineWeightedHemisphereSample of LightHit
+	glm::vec3 GetCosineWeightedHemisphereSample(CPURandom& random, const glm::vec3& N)
+	{
+		glm::vec3 u = glm::normalize(glm::cross(std::abs(N.x) > 0.1f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), N));
+		glm::vec3 v = glm::cross(N, u);
+		float phi = 2.f * (float)PI * random.Next();
+		float xi = random.Next();
+		float z = std::sqrt(1.f - xi);
+		float r = std::sqrt(xi);
+		return glm::normalize(u * std::cos(phi) * r + v * std::sin(phi) * r + N * z);
+	}
+}
+
+void CPUVPLTracer::Trace(const CPUScene& scene, const CPUVPLTracingParams& params, int numThreads)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	int totalPaths = params.sqrtNumPaths * params.sqrtNumPaths;
+	int numTasks = (totalPaths + PATHS_PER_TASK - 1) / PATHS_PER_TASK;
+	std::vector<std::vector<glm::vec4>> taskVPLs(numTasks); // position, normal and color of each VPL
+	std::vector<int> taskPaths(numTasks, 0);
+
+	glm::vec3 diskU, diskV;
+	CoordinateSystem(params.sunDirection, &diskU, &diskV);
+
+	ParallelFor(0, numTasks, 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int task = begin; task < end; task++)
+		{
+			int firstPath = task * PATHS_PER_TASK;
+			int lastPath = std::min(totalPaths, firstPath + PATHS_PER_TASK);
+			taskVPLs[task].reserve(3 * (lastPath - firstPath));
+			for (int path = firstPath; path < lastPath; path++)
+			{
+				if (TracePath(scene, params, diskU, diskV, (uint32_t)path, taskVPLs[task])) taskPaths[task]++;
+			}
+		}
+	});
+
+	std::vector<int> taskOffsets(numTasks + 1, 0);
+	numPaths = 0;
+	for (int task = 0; task < numTasks; task++)
+	{
+		taskOffsets[task + 1] = taskOffsets[task] + (int)taskVPLs[task].size() / 3;
+		numPaths += taskPaths[task];
+	}
+	numVPLs = std::min(taskOffsets[numTasks], params.maxVPLs);
+
+	positions.resize(numVPLs);
+	normals.resize(numVPLs);
+	colors.resize(numVPLs);
+	ParallelFor(0, numTasks, 1, numThreads, [&](int begin, int end, int)
+	{
+		for (int task = begin; task < end; task++)
+		{
+			const std::vector<glm::vec4>& vpls = taskVPLs[task];
+			int count = std::min(taskOffsets[task + 1], numVPLs) - taskOffsets[task];
+			for (int i = 0; i < count; i++)
+			{
+				positions[taskOffsets[task] + i] = vpls[3 * i];
+				normals[taskOffsets[task] + i] = vpls[3 * i + 1];
+				colors[taskOffsets[task] + i] = vpls[3 * i + 2];
+			}
+			std::vector<glm::vec4>().swap(taskVPLs[task]);
+		}
+	});
+
+	traceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool CPUVPLTracer::TracePath(const CPUScene& scene, const CPUVPLTracingParams& params, const glm::vec3& diskU, const glm::vec3& diskV,
+	uint32_t pathIndex, std::vector<glm::vec4>& vpls) const
+{
+	CPURandom random(pathIndex, 1234);
+
+	// GenerateDirectionalLightRay: a point on the disk of the scene sphere facing the sun
+	float diskRadius = std::sqrt(random.Next());
+	float theta = 2.f * (float)PI * random.Next();
+	glm::vec2 cd(diskRadius * std::cos(theta), diskRadius * std::sin(theta));
+	glm::vec3 center(params.sceneSphere);
+	float sceneRadius = params.sceneSphere.w;
+	glm::vec3 origin = center - sceneRadius * params.sunDirection + sceneRadius * (cd.x * diskU + cd.y * diskV);
+	float pdf = 1.f / ((float)PI * sceneRadius * sceneRadius);
+
+	glm::vec3 color = params.sunColor / pdf;
+	glm::vec3 direction = params.sunDirection;
+	bool isCounted = false;
+	for (int depth = 0; depth < params.maxDepth; depth++)
+	{
+		// the light ray is forced non-opaque so AnyHit alpha tests it, the bounces cull back faces
+		CPUSceneHit hit;
+		bool isLightRay = depth == 0;
+		if (!scene.Intersect(origin, direction, 0.f, isLightRay ? FLT_MAX : 10000.f, !isLightRay, isLightRay, hit)) break;
+
+		glm::vec2 uv = scene.GetUV(hit);
+		glm::vec3 normal = scene.GetShadingNormal(hit, uv);
+		glm::vec3 worldPosition = origin + direction * hit.t;
+		const CPUSceneMaterial& material = scene.GetMaterial(hit);
+		glm::vec3 diffuseColor = material.albedo;
+		if (material.diffuseTexture >= 0) diffuseColor *= glm::vec3(scene.textures[material.diffuseTexture].Sample(uv));
+
+		glm::vec3 R = GetCosineWeightedHemisphereSample(random, normal);
+		color *= diffuseColor;
+		if (std::isnan(normal.x) || std::isnan(R.x)) break;
+
+		if (isLightRay) isCounted = true;
+		vpls.push_back(glm::vec4(worldPosition, 0.f));
+		vpls.push_back(glm::vec4(normal, 0.f));
+		vpls.push_back(glm::vec4(color, 0.f));
+
+		origin = worldPosition + BOUNCE_OFFSET * R;
+		direction = R;
+	}
+	return isCounted;
+}
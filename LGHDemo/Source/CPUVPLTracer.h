@@ -0,0 +1,74 @@
+#pragma once
+#include "CPUMath.h"
+#include "CPUParallel.h"
+#include "CPUScene.h"
+#include <vector>
+#include <cstdint>
+
+// the TEA seeded LCG of RandomGenerator.hlsli (RandInit, Rand)
+struct CPURandom
+{
+	uint32_t seed;
+
+	CPURandom(uint32_t seed0, uint32_t seed1)
+	{
+		const uint32_t delta = 0x9e3779b9;
+		const uint32_t key[4] = { 0xa341316c, 0xc8013ea4, 0xad90777d, 0x7e95761e };
+		uint32_t sum = 0;
+		for (int round = 0; round < 8; round++)
+		{
+			sum += delta;
+			seed0 += (seed1 + sum) ^ ((seed1 << 4) + key[0]) ^ ((seed1 >> 5) + key[1]);
+			seed1 += (seed0 + sum) ^ ((seed0 << 4) + key[2]) ^ ((seed0 >> 5) + key[3]);
+		}
+		seed = seed0;
+	}
+
+	float Next()
+	{
+		seed *= 48271;
+		return (float)(seed & 0x00FFFFFF) / (float)0x01000000;
+	}
+};
+
+// LightTracingConstants of the light tracing dispatch
+struct CPUVPLTracingParams
+{
+	glm::vec3 sunDirection; // the direction the light travels (-lightDirection)
+	glm::vec3 sunColor;
+	glm::vec4 sceneSphere; // center in xyz, radius in w
+	int sqrtNumPaths = 390; // the dispatch is sqrtNumPaths x sqrtNumPaths rays (VPLEmissionLevel * 100)
+	int maxDepth = 3;
+	int maxVPLs = 11000000; // VPLs past the size of the VPL buffers are dropped
+};
+
+// CPU counterpart of the LightRayGen/LightHit dispatch of VPLManager::GenerateVPLs. Path i is the
+// dispatch ray with index i: it draws from RandInit(i, 1234) and does the same disk sampling, alpha
+// tested light ray, cosine weighted bounces and color attenuation, so the VPLs do not depend on the
+// number of threads. Paths are traced in tasks of PATHS_PER_TASK by a dynamic ParallelFor, and the
+// VPLs come out in path order rather than in the order the GPU counter hands out.
+class CPUVPLTracer
+{
+public:
+
+	CPUVPLTracer() {};
+
+	// the scene has to be built
+	void Trace(const CPUScene& scene, const CPUVPLTracingParams& params, int numThreads);
+
+	int numVPLs = 0;
+	int numPaths = 0; // paths whose light ray left a VPL, the counter of g_vplNormals
+	// float4 with w = 0, as g_vplPositions/Normals/Colors
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> normals;
+	std::vector<glm::vec4> colors;
+	double traceMs = 0.0;
+
+private:
+
+	static const int PATHS_PER_TASK = 4096;
+
+	// appends the position, normal and color of each VPL of the path, returns if the path is counted
+	bool TracePath(const CPUScene& scene, const CPUVPLTracingParams& params, const glm::vec3& diskU, const glm::vec3& diskV,
+		uint32_t pathIndex, std::vector<glm::vec4>& vpls) const;
+};
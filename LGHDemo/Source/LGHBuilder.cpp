@@ -1,7 +1,27 @@
 #include "LGHBuilder.h"
+#include "SystemTime.h"
+#include <cfloat>
+#include <climits>
 
 const char* LGHBuilder::buildSourceOptionsText[2] = { "From S1", "From VPLs" };
 EnumVar LGHBuilder::m_BuildSource("Application/LGH/Build Source", 0, 2, buildSourceOptionsText);
+const char* LGHBuilder::buildDeviceOptionsText[2] = { "GPU", "CPU" };
+EnumVar LGHBuilder::m_BuildDevice("Application/LGH/Build Device", 0, 2, buildDeviceOptionsText);
+IntVar LGHBuilder::m_CPUBuildThreads("Application/LGH/CPU Build Threads", 0, 0, 256); // 0: all hardware threads
+BoolVar LGHBuilder::m_CPUSortVPLs("Application/LGH/CPU Morton Sort", true);
+BoolVar LGHBuilder::m_CPUTiledGather("Application/LGH/CPU Tiled Gather", true);
+BoolVar LGHBuilder::m_CPUDeterministic("Application/LGH/CPU Deterministic Build", false);
+BoolVar LGHBuilder::m_CPUIncrementalUpdate("Application/LGH/CPU Incremental Update", true);
+BoolVar LGHBuilder::m_CPUBoundingBox("Application/LGH/CPU Bounding Box", false);
+BoolVar LGHBuilder::m_CPUCompressedLevels("Application/LGH/CPU Compressed Levels", false);
+BoolVar LGHBuilder::m_ZeroCopyMerge("Application/LGH/Zero-copy Merge", false);
+BoolVar LGHBuilder::m_CPUInterleavedMerge("Application/LGH/CPU Interleaved Merge", false);
+BoolVar LGHBuilder::m_TuneBuildSchedule("Application/LGH/Tune Build Schedule", false);
+BoolVar LGHBuilder::m_UseTunedSchedule("Application/LGH/Use Tuned Schedule", true);
+BoolVar LGHBuilder::m_CaptureVPLs("Application/LGH/Capture VPLs", false);
+BoolVar LGHBuilder::m_VerboseStats("Application/LGH/Verbose Stats", false);
+
+static const char* LGH_TUNING_PROFILE_PATH = "LGHTuning.txt";
 
 void LGHBuilder::FindBoundingBox(ComputeContext & cptContext)
 {
@@ -108,8 +128,60 @@ void LGHBuilder::FindBoundingBox(ComputeContext & cptContext)
 	baseRadius = highestCellSize / (1 << highestLevel);
 }
 
+void LGHBuilder::FindBoundingBoxOnCPU(ComputeContext & cptContext)
+{
+	ScopedTimer _p0(L"Find BBox (CPU)", cptContext);
+
+	// one readback instead of a flush and readback per reduction stage
+	ReadbackVPLs(cptContext, 1);
+	InitCPUBuilder();
+	cpuBuilder.FindBoundingBox(numVPLs, cpuVPLAttribs[POSITION].data());
+
+	highestCellSize = cpuBuilder.highestCellSize;
+	baseRadius = cpuBuilder.baseRadius;
+	lgh_corner = Vector3(cpuBuilder.lgh_corner.x, cpuBuilder.lgh_corner.y, cpuBuilder.lgh_corner.z);
+}
+
+void LGHBuilder::ReadbackVPLs(ComputeContext & cptContext, int numAttributes, int firstVPL, int count)
+{
+	if (count < 0)
+	{
+		firstVPL = 0;
+		count = numVPLs;
+	}
+	for (int i = 0; i < numAttributes; i++) cpuVPLAttribs[i].resize(numVPLs);
+	if (count <= 0) return;
+
+	// every attribute goes into one readback buffer, so there is a single stall
+	size_t sliceBytes = (size_t)count * sizeof(Vector4);
+	ReadbackBuffer readback;
+	readback.Create(L"ReadBackVplsBuffer", numAttributes * count, sizeof(Vector4));
+	for (int i = 0; i < numAttributes; i++)
+	{
+		cptContext.TransitionResource(VPLs[i], D3D12_RESOURCE_STATE_COPY_SOURCE);
+		cptContext.CopyBufferRegion(readback, i * sliceBytes, VPLs[i], (size_t)firstVPL * sizeof(Vector4), sliceBytes);
+	}
+	cptContext.Flush(true);
+	const char* mapped = (const char*)readback.Map();
+	for (int i = 0; i < numAttributes; i++)
+	{
+		memcpy(cpuVPLAttribs[i].data() + firstVPL, mapped + i * sliceBytes, sliceBytes);
+	}
+	readback.Unmap();
+	readback.Destroy();
+}
+
 void LGHBuilder::MergeLevelsInterleave(ComputeContext & cptContext, int interleavedRate, bool includeLevelZero, bool isRemerge)
 {
+	// the levels are still on the CPU after a CPU build, level 0 only after a non-streamed one
+	if (m_CPUInterleavedMerge && (isCPULGHBuilt || (isStreamedBuild && !includeLevelZero)))
+	{
+		MergeLevelsInterleaveOnCPU(cptContext, interleavedRate, includeLevelZero);
+		return;
+	}
+
+	isInstancedFromArena = false;
+	instanceStart = 0;
 	numInstances = includeLevelZero ? numVPLs : 0;
 
 	for (int i = 1; i <= highestLevel; i++)
@@ -188,10 +260,12 @@ void LGHBuilder::MergeLevelsInterleave(ComputeContext & cptContext, int interlea
 		int levelSize;
 		int numLevels;
 		int numTiles;
+		int arenaOffset;
 	} mergeConstants;
 
 	mergeConstants.numLevels = highestLevel + 1;
 	mergeConstants.numTiles = numTiles;
+	mergeConstants.arenaOffset = 0;
 
 	if (includeLevelZero)
 	{
@@ -223,15 +297,17 @@ void LGHBuilder::MergeLevelsInterleave(ComputeContext & cptContext, int interlea
 		mergeConstants.baseOffset = (mergeConstants.baseTileLevelSize + 1) * remainder;
 		mergeConstants.level = level;
 		mergeConstants.levelSize = levelSizes[level];
-
-		cptContext.TransitionResource(VPLBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		cptContext.TransitionResource(VPLBuffersAtLevel[level][NORMAL], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		cptContext.TransitionResource(VPLBuffersAtLevel[level][COLOR], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		cptContext.TransitionResource(VPLBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		D3D12_CPU_DESCRIPTOR_HANDLE LevelAttribs[4] = { VPLBuffersAtLevel[level][POSITION].GetSRV(),
-			VPLBuffersAtLevel[level][NORMAL].GetSRV(),
-			VPLBuffersAtLevel[level][COLOR].GetSRV(),
-			VPLBuffersAtLevel[level][STDEV].GetSRV() };
+		mergeConstants.arenaOffset = isArenaMerge ? levelOffsets[level] : 0;
+		std::vector<StructuredBuffer>& levelBuffers = isArenaMerge ? LevelArena : VPLBuffersAtLevel[level];
+
+		cptContext.TransitionResource(levelBuffers[POSITION], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		cptContext.TransitionResource(levelBuffers[NORMAL], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		cptContext.TransitionResource(levelBuffers[COLOR], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		cptContext.TransitionResource(levelBuffers[STDEV], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		D3D12_CPU_DESCRIPTOR_HANDLE LevelAttribs[4] = { levelBuffers[POSITION].GetSRV(),
+			levelBuffers[NORMAL].GetSRV(),
+			levelBuffers[COLOR].GetSRV(),
+			levelBuffers[STDEV].GetSRV() };
 
 		cptContext.SetDynamicConstantBufferView(0, sizeof(mergeConstants), &mergeConstants);
 		cptContext.SetDynamicDescriptors(1, 0, _countof(InstanceUAVs), InstanceUAVs);
@@ -243,10 +319,67 @@ void LGHBuilder::MergeLevelsInterleave(ComputeContext & cptContext, int interlea
 
 }
 
+void LGHBuilder::MergeLevelsInterleaveOnCPU(ComputeContext & cptContext, int interleavedRate, bool includeLevelZero)
+{
+	ScopedTimer _p0(L"Merge levels interleave (CPU)", cptContext);
+
+	isInstancedFromArena = false;
+	instanceStart = 0;
+
+	std::vector<int> cpuLevelSizes = cpuBuilder.levelSizes;
+	cpuLevelSizes[0] = includeLevelZero ? numVPLs : 0;
+	numInstances = 0;
+	for (int level = 0; level <= highestLevel; level++) numInstances += cpuLevelSizes[level];
+	for (int attribute = POSITION; attribute <= STDEV; attribute++) cpuInstanceAttribs[attribute].resize(numInstances);
+
+	// same conversion as MergeLevelsInterleaveCS, level 0 has no level and no deviation
+	CPUInterleavedTiles tiles;
+	BucketInterleavedTiles(cpuLevelSizes, includeLevelZero ? 0 : 1, interleavedRate, interleavedRate, tiles,
+		[&](int level, int entry, int instanceId)
+	{
+		if (level == 0)
+		{
+			cpuInstanceAttribs[POSITION][instanceId] = glm::vec4(glm::vec3(cpuVPLAttribs[POSITION][entry]), 0.f);
+			cpuInstanceAttribs[NORMAL][instanceId] = cpuVPLAttribs[NORMAL][entry];
+			cpuInstanceAttribs[COLOR][instanceId] = cpuVPLAttribs[COLOR][entry];
+			cpuInstanceAttribs[STDEV][instanceId] = glm::vec4(0.f);
+			return;
+		}
+		const CPULGHLevel& cpuLevel = cpuBuilder.levels[level];
+		cpuInstanceAttribs[POSITION][instanceId] = cpuLevel.position[entry];
+		cpuInstanceAttribs[NORMAL][instanceId] = cpuLevel.normal[entry];
+		cpuInstanceAttribs[COLOR][instanceId] = cpuLevel.color[entry];
+		cpuInstanceAttribs[STDEV][instanceId] = cpuLevel.stdev[entry];
+	}, cpuBuilder.numThreads);
+
+	offsetOfTile = tiles.offsetOfTile;
+	numInstanceOfTile = tiles.numInstanceOfTile;
+
+	// the tile tables are exact, so the instance buffers are too
+	InstanceBuffers.resize(4);
+	InstanceBuffers[POSITION].Create(L"POSITION instance buffer", numInstances, sizeof(Vector4), cpuInstanceAttribs[POSITION].data());
+	InstanceBuffers[NORMAL].Create(L"NORMAL instance buffer", numInstances, sizeof(Vector3), cpuInstanceAttribs[NORMAL].data());
+	InstanceBuffers[COLOR].Create(L"COLOR instance buffer", numInstances, sizeof(Vector3), cpuInstanceAttribs[COLOR].data());
+	InstanceBuffers[STDEV].Create(L"STDEV instance buffer", numInstances, sizeof(Vector4), cpuInstanceAttribs[STDEV].data());
+	lastNumInstances = numInstances;
+}
+
 void LGHBuilder::MergeLevels(ComputeContext & cptContext, bool includeLevelZero, bool isRemerge)
 {
 	ScopedTimer _p0(L"Merge levels", cptContext);
 
+	if (isArenaMerge)
+	{
+		// the levels already lie back to back behind level 0, merging only picks the first instance
+		if (includeLevelZero && !isArenaLevelZeroValid) CopyLevelZeroToArena(cptContext);
+		instanceStart = includeLevelZero ? 0 : levelOffsets[1];
+		numInstances = levelOffsets[highestLevel + 1] - instanceStart;
+		isInstancedFromArena = true;
+		return;
+	}
+	isInstancedFromArena = false;
+	instanceStart = 0;
+
 	numInstances = includeLevelZero ? numVPLs : 0;
 	std::vector<int> levelOffsets(highestLevel + 1);
 	for (int i = 1; i <= highestLevel; i++)
@@ -333,8 +466,7 @@ void LGHBuilder::GatherForHighLevel(int level, ComputeContext & cptContext)
 	int levelRes = (1 << (highestLevel - level)) + 1;
 	int numVerts = levelRes * levelRes * levelRes;
 
-	int taskDivRate = 8;// >> (highestLevel - level);
-	if (level == highestLevel) taskDivRate = 16;
+	int taskDivRate = GetTaskDivRate(level);
 	int numTasksPerVertex = taskDivRate * taskDivRate * taskDivRate;
 
 	__declspec(align(16)) struct {
@@ -481,8 +613,10 @@ void LGHBuilder::GatherForHighLevel(int level, ComputeContext & cptContext)
 
 	__declspec(align(16)) struct {
 		int level;
+		int arenaOffset;
 	} compactConstants;
 	compactConstants.level = level;
+	std::vector<StructuredBuffer>& compactLevel = GetCompactionTarget(cptContext, level, compactConstants.arenaOffset);
 
 	// stage 3 scatter to new address and normalize
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
@@ -491,15 +625,15 @@ void LGHBuilder::GatherForHighLevel(int level, ComputeContext & cptContext)
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][WEIGHT], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLAddressBuffersAtLevel[level][1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	cptContext.SetDynamicConstantBufferView(0, sizeof(compactConstants), &compactConstants);
-	cptContext.SetDynamicDescriptor(1, 0, VPLBuffersAtLevel[level][POSITION].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 1, VPLBuffersAtLevel[level][NORMAL].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 2, VPLBuffersAtLevel[level][COLOR].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 3, VPLBuffersAtLevel[level][STDEV].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 0, compactLevel[POSITION].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 1, compactLevel[NORMAL].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 2, compactLevel[COLOR].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 3, compactLevel[STDEV].GetUAV());
 	cptContext.SetDynamicDescriptor(2, 0, VPLScratchBuffersAtLevel[level][POSITION].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 1, VPLScratchBuffersAtLevel[level][NORMAL].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 2, VPLScratchBuffersAtLevel[level][COLOR].GetSRV());
@@ -625,8 +759,10 @@ void LGHBuilder::GatherForLevel(int level, ComputeContext & cptContext)
 
 	__declspec(align(16)) struct {
 		int level;
+		int arenaOffset;
 	} compactConstants;
 	compactConstants.level = level;
+	std::vector<StructuredBuffer>& compactLevel = GetCompactionTarget(cptContext, level, compactConstants.arenaOffset);
 
 	levelSizes[level] = numNonEmptyVerts;
 
@@ -637,15 +773,15 @@ void LGHBuilder::GatherForLevel(int level, ComputeContext & cptContext)
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][WEIGHT], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLAddressBuffersAtLevel[level][1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	cptContext.SetDynamicConstantBufferView(0, sizeof(compactConstants), &compactConstants);
-	cptContext.SetDynamicDescriptor(1, 0, VPLBuffersAtLevel[level][POSITION].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 1, VPLBuffersAtLevel[level][NORMAL].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 2, VPLBuffersAtLevel[level][COLOR].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 3, VPLBuffersAtLevel[level][STDEV].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 0, compactLevel[POSITION].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 1, compactLevel[NORMAL].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 2, compactLevel[COLOR].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 3, compactLevel[STDEV].GetUAV());
 	cptContext.SetDynamicDescriptor(2, 0, VPLScratchBuffersAtLevel[level][POSITION].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 1, VPLScratchBuffersAtLevel[level][NORMAL].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 2, VPLScratchBuffersAtLevel[level][COLOR].GetSRV());
@@ -812,8 +948,10 @@ void LGHBuilder::SplatForLevel(int level, ComputeContext & cptContext, bool isBu
 
 	__declspec(align(16)) struct {
 		int level;
+		int arenaOffset;
 	} compactConstants;
 	compactConstants.level = level;
+	std::vector<StructuredBuffer>& compactLevel = GetCompactionTarget(cptContext, level, compactConstants.arenaOffset);
 
 	// stage 3 scatter to new address and normalize
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
@@ -822,15 +960,15 @@ void LGHBuilder::SplatForLevel(int level, ComputeContext & cptContext, bool isBu
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLScratchBuffersAtLevel[level][WEIGHT], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 	cptContext.TransitionResource(VPLAddressBuffersAtLevel[level][1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-	cptContext.TransitionResource(VPLBuffersAtLevel[level][STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[POSITION], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[NORMAL], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[COLOR], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(compactLevel[STDEV], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 	cptContext.SetDynamicConstantBufferView(0, sizeof(compactConstants), &compactConstants);
-	cptContext.SetDynamicDescriptor(1, 0, VPLBuffersAtLevel[level][POSITION].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 1, VPLBuffersAtLevel[level][NORMAL].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 2, VPLBuffersAtLevel[level][COLOR].GetUAV());
-	cptContext.SetDynamicDescriptor(1, 3, VPLBuffersAtLevel[level][STDEV].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 0, compactLevel[POSITION].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 1, compactLevel[NORMAL].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 2, compactLevel[COLOR].GetUAV());
+	cptContext.SetDynamicDescriptor(1, 3, compactLevel[STDEV].GetUAV());
 	cptContext.SetDynamicDescriptor(2, 0, VPLScratchBuffersAtLevel[level][POSITION].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 1, VPLScratchBuffersAtLevel[level][NORMAL].GetSRV());
 	cptContext.SetDynamicDescriptor(2, 2, VPLScratchBuffersAtLevel[level][COLOR].GetSRV());
@@ -857,4 +995,622 @@ void LGHBuilder::SplatForLevel(int level, ComputeContext & cptContext, bool isBu
 
 	cptContext.Flush(true);
 
-}
\ No newline at end of file
+}
+void LGHBuilder::InitCPUBuilder()
+{
+	cpuBuilder.Init(highestLevel, m_CPUBuildThreads, m_CPUSortVPLs, m_CPUTiledGather, m_CPUDeterministic, schedule.gatherTileSize,
+		m_CPUIncrementalUpdate);
+}
+
+void LGHBuilder::BuildOnCPU(ComputeContext & cptContext)
+{
+	ScopedTimer _p0(L"CPU build", cptContext);
+
+	// only the VPLs rewritten since the last CPU build are read back and re-splatted when the bounding box
+	// still holds, cpuVPLAttribs keeps the others from the earlier readbacks
+	bool isIncremental = false;
+	if (m_CPUIncrementalUpdate && isCPULGHBuilt)
+	{
+		int dirtyBegin = std::min(dirtyVPLBegin, numVPLs);
+		int dirtyEnd = std::min(dirtyVPLEnd, numVPLs);
+		ReadbackVPLs(cptContext, 3, dirtyBegin, std::max(dirtyEnd - dirtyBegin, 0));
+		isIncremental = cpuBuilder.Update(numVPLs, cpuVPLAttribs[POSITION].data(), cpuVPLAttribs[NORMAL].data(), cpuVPLAttribs[COLOR].data(),
+			dirtyBegin, dirtyEnd, m_BuildSource == buildFromS1);
+	}
+	if (!isIncremental)
+	{
+		ReadbackVPLs(cptContext, 3);
+		InitCPUBuilder();
+		cpuBuilder.Build(numVPLs, cpuVPLAttribs[POSITION].data(), cpuVPLAttribs[NORMAL].data(), cpuVPLAttribs[COLOR].data(),
+			m_BuildSource == buildFromS1);
+		isCPULGHBuilt = true;
+	}
+
+	highestCellSize = cpuBuilder.highestCellSize;
+	baseRadius = cpuBuilder.baseRadius;
+	lgh_corner = Vector3(cpuBuilder.lgh_corner.x, cpuBuilder.lgh_corner.y, cpuBuilder.lgh_corner.z);
+
+	UploadCPULevels(cptContext);
+	if (m_CPUCompressedLevels) CompressCPULevels();
+}
+
+void LGHBuilder::BuildFromStream(ComputeContext & cptContext, CPUVPLSource & source, std::vector<StructuredBuffer>& _VPLs,
+	int interleavedRate, int batchSize, bool isReinit)
+{
+	ScopedTimer _p0(L"CPU streamed build", cptContext);
+
+	// the sparse CPU levels are not limited by the dense GPU grids, so the level count can go one higher
+	long long numStreamedVPLs = source.NumVPLs();
+	int numLevels = CalculateNumLevels(numStreamedVPLs, CPULGHBuilder::MAX_NUM_LEVELS);
+	Init(cptContext, (int)std::min<long long>(numStreamedVPLs, INT_MAX), _VPLs, false, isReinit, std::min(5, numLevels), numLevels);
+	isStreamedBuild = true;
+
+	InitCPUBuilder();
+	cpuBuilder.BuildStreamed(source, batchSize, m_BuildSource == buildFromS1);
+
+	highestCellSize = cpuBuilder.highestCellSize;
+	baseRadius = cpuBuilder.baseRadius;
+	lgh_corner = Vector3(cpuBuilder.lgh_corner.x, cpuBuilder.lgh_corner.y, cpuBuilder.lgh_corner.z);
+	UploadCPULevels(cptContext);
+	if (m_CPUCompressedLevels) CompressCPULevels();
+
+	if (interleavedRate > 1) MergeLevelsInterleave(cptContext, interleavedRate, false);
+	else MergeLevels(cptContext, false);
+	lastInterleaveRate = interleavedRate;
+}
+
+void LGHBuilder::UploadCPULevels(ComputeContext & cptContext)
+{
+	if (isArenaMerge)
+	{
+		// levels go behind level 0 in the arena, a level whose range moved is uploaded completely.
+		// Streamed VPLs are not resident and level 0 is never merged, so it gets no slots.
+		std::vector<int> lastOffsets = levelOffsets;
+		levelOffsets[1] = isStreamedBuild ? 0 : numVPLs;
+		for (int level = 1; level <= highestLevel; level++)
+		{
+			levelSizes[level] = cpuBuilder.levelSizes[level];
+			levelOffsets[level + 1] = levelOffsets[level] + levelSizes[level];
+		}
+		bool isGrown = ReserveArena(cptContext, 0, levelOffsets[highestLevel + 1]);
+		if (isGrown) isArenaLevelZeroValid = false;
+		for (int level = 1; level <= highestLevel; level++)
+		{
+			int start = cpuBuilder.dirtyStart[level];
+			int count = cpuBuilder.dirtyEnd[level] - start;
+			if (isGrown || levelOffsets[level] != lastOffsets[level] || levelOffsets[level + 1] != lastOffsets[level + 1])
+			{
+				start = 0;
+				count = levelSizes[level];
+			}
+			if (count <= 0) continue;
+			const CPULGHLevel& cpuLevel = cpuBuilder.levels[level];
+			uint64_t offset = ((uint64_t)levelOffsets[level] + start) * sizeof(Vector4);
+			LevelArena[POSITION].Update(offset, count, cpuLevel.position.data() + start);
+			LevelArena[NORMAL].Update(offset, count, cpuLevel.normal.data() + start);
+			LevelArena[COLOR].Update(offset, count, cpuLevel.color.data() + start);
+			LevelArena[STDEV].Update(offset, count, cpuLevel.stdev.data() + start);
+		}
+		return;
+	}
+
+	// upload compacted levels, merging stays on the GPU. Level buffers are sized by the
+	// number of occupied vertices and only grow when a level outgrows them. Only the
+	// changed range of a level is uploaded.
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		levelSizes[level] = cpuBuilder.levelSizes[level];
+		if (levelSizes[level] == 0) continue;
+		int start = cpuBuilder.dirtyStart[level];
+		int count = cpuBuilder.dirtyEnd[level] - start;
+		if (!VPLBuffersAtLevel[level][POSITION].GetResource() || (uint32_t)levelSizes[level] > VPLBuffersAtLevel[level][POSITION].GetElementCount())
+		{
+			int capacity = int(1.1 * levelSizes[level]);
+			VPLBuffersAtLevel[level][POSITION].Create(L"A VPLBuffersAtLevel", capacity, sizeof(Vector3));
+			VPLBuffersAtLevel[level][NORMAL].Create(L"A VPLBuffersAtLevel", capacity, sizeof(Vector3));
+			VPLBuffersAtLevel[level][COLOR].Create(L"A VPLBuffersAtLevel", capacity, sizeof(Vector3));
+			VPLBuffersAtLevel[level][STDEV].Create(L"A VPLBuffersAtLevel", capacity, sizeof(Vector3));
+			start = 0;
+			count = levelSizes[level];
+		}
+		if (count <= 0) continue;
+		const CPULGHLevel& cpuLevel = cpuBuilder.levels[level];
+		uint64_t offset = (uint64_t)start * sizeof(Vector4);
+		VPLBuffersAtLevel[level][POSITION].Update(offset, count, cpuLevel.position.data() + start);
+		VPLBuffersAtLevel[level][NORMAL].Update(offset, count, cpuLevel.normal.data() + start);
+		VPLBuffersAtLevel[level][COLOR].Update(offset, count, cpuLevel.color.data() + start);
+		VPLBuffersAtLevel[level][STDEV].Update(offset, count, cpuLevel.stdev.data() + start);
+	}
+}
+
+std::vector<StructuredBuffer>& LGHBuilder::GetCompactionTarget(ComputeContext & cptContext, int level, int & arenaOffset)
+{
+	if (!isArenaMerge)
+	{
+		// level buffers were not preallocated when the arena was in use before a cache load
+		arenaOffset = 0;
+		if (!VPLBuffersAtLevel[level][POSITION].GetResource() || (uint32_t)levelSizes[level] > VPLBuffersAtLevel[level][POSITION].GetElementCount())
+		{
+			VPLBuffersAtLevel[level][POSITION].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3));
+			VPLBuffersAtLevel[level][NORMAL].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3));
+			VPLBuffersAtLevel[level][COLOR].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3));
+			VPLBuffersAtLevel[level][STDEV].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3));
+		}
+		return VPLBuffersAtLevel[level];
+	}
+	// levels are compacted in order, so each one starts where the previous one ended
+	arenaOffset = levelOffsets[level];
+	levelOffsets[level + 1] = arenaOffset + levelSizes[level];
+	ReserveArena(cptContext, arenaOffset, levelOffsets[level + 1]);
+	return LevelArena;
+}
+
+bool LGHBuilder::ReserveArena(ComputeContext & cptContext, int numUsed, int numRequired)
+{
+	if (numRequired <= arenaCapacity) return false;
+
+	int capacity = int(1.5 * numRequired);
+	std::vector<StructuredBuffer> grownArena(4);
+	grownArena[POSITION].Create(L"POSITION level arena", capacity, sizeof(Vector4));
+	grownArena[NORMAL].Create(L"NORMAL level arena", capacity, sizeof(Vector4));
+	grownArena[COLOR].Create(L"COLOR level arena", capacity, sizeof(Vector4));
+	grownArena[STDEV].Create(L"STDEV level arena", capacity, sizeof(Vector4));
+	if (numUsed > 0)
+	{
+		for (int attribute = POSITION; attribute <= STDEV; attribute++)
+		{
+			cptContext.TransitionResource(LevelArena[attribute], D3D12_RESOURCE_STATE_COPY_SOURCE);
+			cptContext.TransitionResource(grownArena[attribute], D3D12_RESOURCE_STATE_COPY_DEST);
+			cptContext.CopyBufferRegion(grownArena[attribute], 0, LevelArena[attribute], 0, numUsed * sizeof(Vector4));
+		}
+		cptContext.Flush(true);
+	}
+	LevelArena.swap(grownArena);
+	arenaCapacity = capacity;
+	return true;
+}
+
+void LGHBuilder::CopyLevelZeroToArena(ComputeContext & cptContext)
+{
+	// same conversion as the level zero pass of MergeLevels
+	__declspec(align(16)) struct {
+		int levelOffset;
+		int levelSize;
+		int isLevelZero;
+	} mergeConstants = { 0, numVPLs, 1 };
+
+	for (int attribute = POSITION; attribute <= STDEV; attribute++)
+		cptContext.TransitionResource(LevelArena[attribute], D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	cptContext.TransitionResource(VPLs[POSITION], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	cptContext.TransitionResource(VPLs[NORMAL], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	cptContext.TransitionResource(VPLs[COLOR], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	D3D12_CPU_DESCRIPTOR_HANDLE ArenaUAVs[4] = { LevelArena[POSITION].GetUAV(),
+		LevelArena[NORMAL].GetUAV(),
+		LevelArena[COLOR].GetUAV(),
+		LevelArena[STDEV].GetUAV() };
+	D3D12_CPU_DESCRIPTOR_HANDLE LevelAttribs[3] = { VPLs[POSITION].GetSRV(),
+		VPLs[NORMAL].GetSRV(),
+		VPLs[COLOR].GetSRV() };
+	cptContext.SetRootSignature(RootSig);
+	cptContext.SetPipelineState(m_MergeLevelsPSO);
+	cptContext.SetDynamicConstantBufferView(0, sizeof(mergeConstants), &mergeConstants);
+	cptContext.SetDynamicDescriptors(1, 0, _countof(ArenaUAVs), ArenaUAVs);
+	cptContext.SetDynamicDescriptors(2, 0, _countof(LevelAttribs), LevelAttribs);
+	cptContext.Dispatch1D(numVPLs, 1024);
+	cptContext.Flush(true);
+	isArenaLevelZeroValid = true;
+}
+
+void LGHBuilder::CompressCPULevels()
+{
+	// the compressed levels are kept next to the float ones for CPU shading, each is checked against the error budget
+	cpuBuilder.CompressLevels();
+	size_t floatBytes = 0;
+	size_t compressedBytes = 0;
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		floatBytes += levelSizes[level] * 4 * sizeof(Vector4);
+		compressedBytes += cpuBuilder.compressedLevels[level].SizeInBytes();
+		CPULGHCompressionError error = cpuBuilder.MeasureCompressionError(level);
+		if (!error.IsWithin(LGH_COMPRESSION_ERROR_BUDGET))
+		{
+			std::cout << "compressed LGH level " << level << " exceeds the error budget (position " << error.position
+				<< ", normal " << error.normal << ", color " << error.color << ", stdev " << error.stdev << ")" << std::endl;
+		}
+	}
+	if (m_VerboseStats) std::cout << "compressed LGH levels: " << compressedBytes << " bytes, " << floatBytes << " bytes as float4" << std::endl;
+}
+
+int LGHBuilder::GetLevelCapacity(int level)
+{
+	// a level has at most one vertex per grid vertex, and a VPL (or S1 vertex) reaches at most 8 of them
+	long long numVerts = (1 << (highestLevel - level)) + 1;
+	numVerts = numVerts * numVerts * numVerts;
+	return (int)std::min(numVerts, 8ll * numVPLs);
+}
+
+void LGHBuilder::AllocateDenseLevelBuffers()
+{
+	ReleaseDenseLevelBuffers();
+	plannedBuildSource = (BuildSourceOptions)(int)m_BuildSource;
+	bool isFromS1 = plannedBuildSource == buildFromS1;
+
+	// the GPU passes splat/gather into dense (2^(highestLevel-level)+1)^3 grids and compact them afterwards.
+	// Step 0 is the bbox reduction and step l builds level l, S1 is read by every step of a build from S1.
+	struct PlacedBuffer
+	{
+		StructuredBuffer* buffer;
+		const wchar_t* name;
+		uint32_t numElements;
+		uint32_t elementSize;
+		int index;
+	};
+	std::vector<PlacedBuffer> placed;
+	memoryPlan.Reset();
+	auto plan = [&](StructuredBuffer& buffer, const wchar_t* name, int step, int level, uint32_t numElements, uint32_t elementSize)
+	{
+		int index = memoryPlan.Add(step, (uint64_t)numElements * elementSize, level);
+		placed.push_back({ &buffer, name, numElements, elementSize, index });
+	};
+
+	if (isArenaMerge)
+	{
+		int capacity = numVPLs;
+		for (int level = 1; level <= highestLevel; level++) capacity += GetLevelCapacity(level);
+		for (int attribute = POSITION; attribute <= STDEV; attribute++)
+			plan(LevelArena[attribute], L"level arena", LGHMemoryPlan::PERSISTENT, 0, capacity, sizeof(Vector4));
+		arenaCapacity = capacity;
+		isArenaPlaced = true;
+	}
+
+	// the renderer can raise numVPLs up to MAXIMUM_NUM_VPLS without a new plan
+	int numBboxGroups = (int)((std::max<long long>(numVPLs, MAXIMUM_NUM_VPLS) + 1023) / 1024);
+	plan(bboxReductionBuffer[0], L"Reductionbuffer", 0, 0, numBboxGroups, sizeof(Vector3));
+	plan(bboxReductionBuffer[1], L"Reductionbuffer", 0, 0, numBboxGroups, sizeof(Vector3));
+
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		int numVerts = (1 << (highestLevel - level)) + 1;
+		numVerts = numVerts * numVerts * numVerts;
+
+		int scratchStep = level == 1 && isFromS1 ? LGHMemoryPlan::PERSISTENT : level;
+		VPLScratchBuffersAtLevel[level].resize(5); //additionally with weight
+		for (int attribute = POSITION; attribute <= STDEV; attribute++)
+			plan(VPLScratchBuffersAtLevel[level][attribute], L"A VPLScratchBuffersAtLevel", scratchStep, level, numVerts, sizeof(Vector3));
+		plan(VPLScratchBuffersAtLevel[level][WEIGHT], L"A VPLScratchBuffersAtLevel", scratchStep, level, numVerts, sizeof(float));
+
+		if (!isArenaMerge) // compacted into the arena otherwise
+		{
+			for (int attribute = POSITION; attribute <= STDEV; attribute++)
+				plan(VPLBuffersAtLevel[level][attribute], L"A VPLBuffersAtLevel", LGHMemoryPlan::PERSISTENT, level, GetLevelCapacity(level), sizeof(Vector3));
+		}
+
+		VPLAddressBuffersAtLevel[level].resize(2);
+		plan(VPLAddressBuffersAtLevel[level][0], L"A VPLAddressBufferAtLevel", level, level, numVerts, sizeof(int));
+		plan(VPLAddressBuffersAtLevel[level][1], L"A VPLAddressBufferAtLevel", level, level, numVerts, sizeof(int));
+
+		// task buffers are only used by the high level gather from S1
+		if (isFromS1 && level >= firstHighLevel)
+		{
+			int taskDivRate = GetTaskDivRate(level);
+			int numTasks = taskDivRate * taskDivRate * taskDivRate * numVerts;
+			std::vector<StructuredBuffer>& taskBuffers = VPLTaskBuffersAtHighLevel[level - firstHighLevel];
+			taskBuffers.resize(5);
+			plan(taskBuffers[POSITION], L"task buffer position", level, level, numTasks, sizeof(Vector3));
+			plan(taskBuffers[NORMAL], L"task buffer normal", level, level, numTasks, sizeof(Vector3));
+			plan(taskBuffers[COLOR], L"task buffer color", level, level, numTasks, sizeof(Vector3));
+			plan(taskBuffers[STDEV], L"task buffer stdev", level, level, numTasks, sizeof(Vector3));
+			plan(taskBuffers[WEIGHT], L"task buffer weight", level, level, numTasks, sizeof(float));
+		}
+	}
+
+	D3D12_HEAP_DESC heapDesc = {};
+	heapDesc.SizeInBytes = memoryPlan.TotalBytes();
+	heapDesc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	heapDesc.Alignment = LGHMemoryPlan::ALIGNMENT;
+	heapDesc.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+	ASSERT_SUCCEEDED(Graphics::g_Device->CreateHeap(&heapDesc, MY_IID_PPV_ARGS(&buildHeap)));
+	for (const PlacedBuffer& buffer : placed)
+	{
+		buffer.buffer->Destroy();
+		buffer.buffer->CreatePlaced(buffer.name, buildHeap.Get(), memoryPlan.Offset(buffer.index), buffer.numElements, buffer.elementSize);
+	}
+
+	if (m_VerboseStats)
+	{
+		const double MB = 1.0 / (1 << 20);
+		std::cout << "LGH build buffers (" << (isFromS1 ? "from S1" : "from VPLs") << "):";
+		for (int level = 0; level <= highestLevel; level++)
+			std::cout << (level ? ", level " + std::to_string(level) + " " : " bbox and arena ") << memoryPlan.TaggedBytes(level) * MB << " MB";
+		std::cout << std::endl << "LGH build heap: " << memoryPlan.TotalBytes() * MB << " MB (" << memoryPlan.PersistentBytes() * MB
+			<< " MB persistent, " << memoryPlan.SharedBytes() * MB << " MB shared by the build steps), "
+			<< memoryPlan.UnsharedBytes() * MB << " MB without reuse" << std::endl;
+	}
+
+	isDenseStorageAllocated = true;
+}
+
+void LGHBuilder::ReleaseDenseLevelBuffers()
+{
+	// placed buffers have to be released before their heap. Everything is planned again before the
+	// next GPU build, which also writes every level again.
+	if (!buildHeap) return;
+	for (std::vector<StructuredBuffer>& buffers : VPLScratchBuffersAtLevel) for (StructuredBuffer& buffer : buffers) buffer.Destroy();
+	for (std::vector<StructuredBuffer>& buffers : VPLBuffersAtLevel) for (StructuredBuffer& buffer : buffers) buffer.Destroy();
+	for (std::vector<StructuredBuffer>& buffers : VPLTaskBuffersAtHighLevel) for (StructuredBuffer& buffer : buffers) buffer.Destroy();
+	for (std::vector<StructuredBuffer>& buffers : VPLAddressBuffersAtLevel) for (StructuredBuffer& buffer : buffers) buffer.Destroy();
+	bboxReductionBuffer[0].Destroy();
+	bboxReductionBuffer[1].Destroy();
+	if (isArenaPlaced)
+	{
+		for (StructuredBuffer& buffer : LevelArena) buffer.Destroy();
+		arenaCapacity = 0;
+		isArenaLevelZeroValid = false;
+		isArenaPlaced = false;
+	}
+	buildHeap = nullptr;
+	isDenseStorageAllocated = false;
+}
+
+void LGHBuilder::BeginTransientStep(ComputeContext & cptContext)
+{
+	// the buffers of the previous step share memory with the ones of this step
+	cptContext.InsertAliasBarrier(anyPlacedResource, anyPlacedResource, true);
+}
+
+uint64_t LGHBuilder::HashBuildParameters(uint64_t hash)
+{
+	hash = HashValue((int)m_BuildSource, hash);
+	hash = HashValue((int)m_BuildDevice, hash);
+	return HashValue(firstHighLevel, hash);
+}
+
+uint64_t LGHBuilder::GetSceneClass(bool isAnyScene)
+{
+	return GetLGHSceneClass(isAnyScene ? 0 : sceneHash, highestLevel + 1, (int)m_BuildDevice, (int)m_BuildSource);
+}
+
+LGHBuildSchedule LGHBuilder::FindBuildSchedule(int _firstHighLevel)
+{
+	LGHBuildSchedule found;
+	if (m_UseTunedSchedule)
+	{
+		LGHTuningProfile profile;
+		profile.Load(LGH_TUNING_PROFILE_PATH);
+		if (!profile.Find(GetSceneClass(), found)) profile.Find(GetSceneClass(true), found);
+	}
+	if (_firstHighLevel > 0) found.firstHighLevel = _firstHighLevel;
+	return found;
+}
+
+void LGHBuilder::SetBuildSchedule(const LGHBuildSchedule& _schedule)
+{
+	bool isHighLevelGatherChanged = _schedule.firstHighLevel != schedule.firstHighLevel ||
+		_schedule.taskDivRate != schedule.taskDivRate || _schedule.topTaskDivRate != schedule.topTaskDivRate;
+	schedule = _schedule;
+	firstHighLevel = std::max(2, std::min(schedule.firstHighLevel, highestLevel + 1));
+
+	// task buffers are sized by the high levels and their task rates
+	if (isHighLevelGatherChanged)
+	{
+		VPLTaskBuffersAtHighLevel.clear();
+		VPLTaskBuffersAtHighLevel.resize(highestLevel + 1 - firstHighLevel);
+		isDenseStorageAllocated = false;
+	}
+}
+
+uint64_t LGHBuilder::GetTaskBufferBytes(const LGHBuildSchedule& candidate)
+{
+	uint64_t bytes = 0;
+	for (int level = std::max(2, candidate.firstHighLevel); level <= highestLevel; level++)
+	{
+		uint64_t taskRes = (uint64_t)GetTaskDivRate(level, candidate) * ((1 << (highestLevel - level)) + 1);
+		bytes += taskRes * taskRes * taskRes * (4 * sizeof(Vector3) + sizeof(float));
+	}
+	return bytes;
+}
+
+std::vector<LGHBuildSchedule> LGHBuilder::GetScheduleCandidates()
+{
+	// only builds from S1 have knobs: the high level gather on the GPU, the gather tiles on the CPU.
+	// GPU candidates whose task buffers take more than the budget (or the defaults) are left out.
+	const uint64_t TASK_BUFFER_BUDGET = 512ull << 20;
+	std::vector<LGHBuildSchedule> candidates;
+	if (m_BuildSource != buildFromS1) return candidates;
+
+	LGHBuildSchedule candidate = schedule;
+	candidate.buildMs = 0.f;
+	if (m_BuildDevice == buildOnCPU)
+	{
+		if (!m_CPUTiledGather || m_CPUDeterministic) return candidates;
+		for (int tileSize : { 4, 8, 16, 32 })
+		{
+			candidate.gatherTileSize = tileSize;
+			candidates.push_back(candidate);
+		}
+		return candidates;
+	}
+
+	uint64_t budget = std::max(TASK_BUFFER_BUDGET, GetTaskBufferBytes(LGHBuildSchedule()));
+	for (int first = 3; first <= std::min(6, highestLevel); first++)
+	{
+		for (int rate : { 4, 8, 16 })
+		{
+			for (int topRate : { 8, 16, 32 })
+			{
+				candidate.firstHighLevel = first;
+				candidate.taskDivRate = rate;
+				candidate.topTaskDivRate = topRate;
+				if (GetTaskBufferBytes(candidate) <= budget) candidates.push_back(candidate);
+			}
+		}
+	}
+	return candidates;
+}
+
+float LGHBuilder::TimeFullBuild(ComputeContext & cptContext, int interleavedRate)
+{
+	isCPULGHBuilt = false; // a full CPU build, not an incremental update
+	int64_t start = SystemTime::GetCurrentTick();
+	Build(cptContext, interleavedRate);
+	cptContext.Flush(true);
+	return (float)(1000.0 * SystemTime::TimeBetweenTicks(start, SystemTime::GetCurrentTick()));
+}
+
+void LGHBuilder::TuneBuildSchedule(ComputeContext & cptContext, int interleavedRate)
+{
+	ScopedTimer _p0(L"Tune LGH build", cptContext);
+	const int NUM_TIMED_BUILDS = 3;
+
+	std::vector<LGHBuildSchedule> candidates = GetScheduleCandidates();
+	if (candidates.size() < 2)
+	{
+		std::cout << "LGH tuning: the build schedule has no effect on this build device and source" << std::endl;
+		return;
+	}
+
+	// the first build of a candidate reallocates the dense buffers when the high levels change, so it
+	// is not timed. The fastest of the timed builds counts, they all build the same VPLs.
+	LGHBuildSchedule best = schedule;
+	best.buildMs = FLT_MAX;
+	for (const LGHBuildSchedule& candidate : candidates)
+	{
+		SetBuildSchedule(candidate);
+		TimeFullBuild(cptContext, interleavedRate);
+		float buildMs = FLT_MAX;
+		for (int run = 0; run < NUM_TIMED_BUILDS; run++) buildMs = std::min(buildMs, TimeFullBuild(cptContext, interleavedRate));
+		std::cout << "LGH tuning: firstHighLevel " << candidate.firstHighLevel << ", taskDivRate " << candidate.taskDivRate << "/"
+			<< candidate.topTaskDivRate << ", gather tile " << candidate.gatherTileSize << ": " << buildMs << " ms" << std::endl;
+		if (buildMs < best.buildMs)
+		{
+			best = candidate;
+			best.buildMs = buildMs;
+		}
+	}
+
+	// the grid is left built with the winner
+	SetBuildSchedule(best);
+	TimeFullBuild(cptContext, interleavedRate);
+
+	LGHTuningProfile profile;
+	profile.Load(LGH_TUNING_PROFILE_PATH);
+	profile.Set(GetSceneClass(), best);
+	profile.Set(GetSceneClass(true), best);
+	if (!profile.Save(LGH_TUNING_PROFILE_PATH)) std::cout << "failed to write LGH tuning profile " << LGH_TUNING_PROFILE_PATH << std::endl;
+	std::cout << "LGH tuning: firstHighLevel " << best.firstHighLevel << ", taskDivRate " << best.taskDivRate << "/"
+		<< best.topTaskDivRate << ", gather tile " << best.gatherTileSize << " is the fastest (" << best.buildMs << " ms)" << std::endl;
+}
+
+bool LGHBuilder::CaptureVPLs(ComputeContext & cptContext, const std::string & path)
+{
+	// a streamed build never had all VPLs on the GPU
+	if (isStreamedBuild || numVPLs <= 0) return false;
+
+	ReadbackVPLs(cptContext, 3);
+	return CPUVPLFileSource::Write(path.c_str(), numVPLs, cpuVPLAttribs[POSITION].data(), cpuVPLAttribs[NORMAL].data(),
+		cpuVPLAttribs[COLOR].data());
+}
+
+bool LGHBuilder::WriteCache(ComputeContext & cptContext, const std::string & path, uint64_t key, int numPaths)
+{
+	ScopedTimer _p0(L"Write LGH cache", cptContext);
+
+	int maxSize = numInstances;
+	for (int level = 1; level <= highestLevel; level++) maxSize = std::max(maxSize, levelSizes[level]);
+	if (maxSize <= 0) return false;
+
+	// read back the compacted levels and the merged instances
+	ReadbackBuffer readback;
+	readback.Create(L"ReadBackLGHBuffer", maxSize, sizeof(Vector4));
+	std::vector<std::vector<Vector4>> levelData((highestLevel + 1) * 4);
+	std::vector<Vector4> instanceData[4];
+	auto readBuffer = [&](GpuBuffer& buffer, int first, int count, std::vector<Vector4>& data)
+	{
+		data.resize(count);
+		if (count == 0) return;
+		cptContext.TransitionResource(buffer, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		cptContext.CopyBufferRegion(readback, 0, buffer, first * sizeof(Vector4), count * sizeof(Vector4));
+		cptContext.Flush(true);
+		memcpy(data.data(), readback.Map(), count * sizeof(Vector4));
+		readback.Unmap();
+	};
+
+	LGHCacheContents contents;
+	contents.levelData.resize(highestLevel + 1);
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		for (int attribute = POSITION; attribute <= STDEV; attribute++)
+		{
+			std::vector<Vector4>& data = levelData[level * 4 + attribute];
+			if (isArenaMerge) readBuffer(LevelArena[attribute], levelOffsets[level], levelSizes[level], data);
+			else readBuffer(VPLBuffersAtLevel[level][attribute], 0, levelSizes[level], data);
+			contents.levelData[level].push_back(data.data());
+		}
+	}
+	for (int attribute = POSITION; attribute <= STDEV; attribute++)
+	{
+		readBuffer(GetInstanceBuffers()[attribute], instanceStart, numInstances, instanceData[attribute]);
+		contents.instanceData[attribute] = instanceData[attribute].data();
+	}
+	readback.Destroy();
+
+	LGHCacheHeader& header = contents.header;
+	memset(&header, 0, sizeof(header));
+	header.key = key;
+	header.numVPLs = numVPLs;
+	header.numPaths = numPaths;
+	header.numInstances = numInstances;
+	header.interleaveRate = lastInterleaveRate;
+	header.isLevelZeroIncluded = isLevelZeroIncluded;
+	header.lgh_corner[0] = lgh_corner.GetX();
+	header.lgh_corner[1] = lgh_corner.GetY();
+	header.lgh_corner[2] = lgh_corner.GetZ();
+	header.highestCellSize = highestCellSize;
+	header.baseRadius = baseRadius;
+	contents.levelSizes = levelSizes;
+	if (lastInterleaveRate > 1)
+	{
+		contents.offsetOfTile = offsetOfTile;
+		contents.numInstanceOfTile = numInstanceOfTile;
+	}
+	return WriteLGHCache(path, contents);
+}
+
+bool LGHBuilder::LoadCache(const LGHCacheFile & cache)
+{
+	const LGHCacheHeader& header = cache.Header();
+	if (header.numLevels != highestLevel + 1 || header.numVPLs != numVPLs || header.numInstances == 0) return false;
+
+	levelSizes.assign(cache.LevelSizes(), cache.LevelSizes() + header.numLevels);
+	lgh_corner = Vector3(header.lgh_corner[0], header.lgh_corner[1], header.lgh_corner[2]);
+	highestCellSize = header.highestCellSize;
+	baseRadius = header.baseRadius;
+
+	// buffers are initialized straight from the mapped file
+	for (int level = 1; level <= highestLevel; level++)
+	{
+		if (levelSizes[level] == 0) continue;
+		VPLBuffersAtLevel[level][POSITION].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3), cache.LevelAttribute(level, POSITION));
+		VPLBuffersAtLevel[level][NORMAL].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3), cache.LevelAttribute(level, NORMAL));
+		VPLBuffersAtLevel[level][COLOR].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3), cache.LevelAttribute(level, COLOR));
+		VPLBuffersAtLevel[level][STDEV].Create(L"A VPLBuffersAtLevel", levelSizes[level], sizeof(Vector3), cache.LevelAttribute(level, STDEV));
+	}
+
+	numInstances = header.numInstances;
+	lastNumInstances = numInstances;
+	InstanceBuffers.resize(4);
+	InstanceBuffers[POSITION].Create(L"POSITION instance buffer", numInstances, sizeof(Vector4), cache.InstanceAttribute(POSITION));
+	InstanceBuffers[NORMAL].Create(L"NORMAL instance buffer", numInstances, sizeof(Vector3), cache.InstanceAttribute(NORMAL));
+	InstanceBuffers[COLOR].Create(L"COLOR instance buffer", numInstances, sizeof(Vector3), cache.InstanceAttribute(COLOR));
+	InstanceBuffers[STDEV].Create(L"STDEV instance buffer", numInstances, sizeof(Vector4), cache.InstanceAttribute(STDEV));
+
+	lastInterleaveRate = header.interleaveRate;
+	isLevelZeroIncluded = header.isLevelZeroIncluded != 0;
+	offsetOfTile.assign(cache.OffsetOfTile(), cache.OffsetOfTile() + cache.NumTiles());
+	numInstanceOfTile.assign(cache.NumInstanceOfTile(), cache.NumInstanceOfTile() + cache.NumTiles());
+	isCPULGHBuilt = false;
+	isArenaMerge = false; // the cache holds separate level and instance buffers
+	isInstancedFromArena = false;
+	instanceStart = 0;
+	return true;
+}
@@ -41,6 +41,11 @@
 #include "FindVPLBboxMaxCS.h"
 #include "FindVPLBboxMinCS.h"
 #include "MergeLevelsInterleaveCS.h"
+#include "CPULGHBuilder.h"
+#include "CPUInterleave.h"
+#include "LGHCache.h"
+#include "LGHTuning.h"
+#include "LGHMemoryPlan.h"
 #include <iostream>
 
 //change this if you want to generate more than 10M vpls
@@ -57,35 +62,30 @@ public:
 
 	LGHBuilder() {};
 
-	int CalculateNumLevels(int numVPLs)
+	int CalculateNumLevels(long long numVPLs, int maxNumLevels = 10)
 	{
-		int numEstDenseVPLs = numVPLs * 10;
-		int initEst = 8;
-		for (int i = 2; i <= 10; i++)
-		{
-			int dimLen = 1 << (i - 2) + 1;
-			if (dimLen*dimLen*dimLen > numEstDenseVPLs)
-			{
-				return i;
-			}
-		}
-		std::cout << "number of VPLs exceeds LGH capacity!\n" << std::endl;
-		exit(1);
+		bool isClamped;
+		int numLevels = CPULGHBuilder::CalculateNumLevels(numVPLs, maxNumLevels, &isClamped);
+		if (isClamped) std::cout << "number of VPLs exceeds LGH capacity, clamped to " << numLevels << " levels" << std::endl;
+		return numLevels;
 	}
 
+	// _firstHighLevel = 0 takes it from the tuned schedule of the scene class (5 if there is none)
 	void Init(ComputeContext& cptContext, int _numVPLs, std::vector<StructuredBuffer>& _VPLs, 
-										bool _isLevelZeroIncluded = false, bool isReinit = false, int _firstHighLevel = 5)
+										bool _isLevelZeroIncluded = false, bool isReinit = false, int _firstHighLevel = 0, int _numLevels = 0)
 	{
 		lastBuildSourceOption = (BuildSourceOptions)((int)m_BuildSource);
+		lastBuildDeviceOption = (BuildDeviceOptions)((int)m_BuildDevice);
 		lastNumInstances = 0;
 		assert(_VPLs.size() == 3);
+		ReleaseDenseLevelBuffers();
 		VPLs = _VPLs;
 		numVPLs = _numVPLs;
 		isLevelZeroIncluded = _isLevelZeroIncluded;
-		int numLevels = CalculateNumLevels(numVPLs);
+		int numLevels = _numLevels > 0 ? _numLevels : CalculateNumLevels(numVPLs);
 
 		highestLevel = numLevels - 1;
-		firstHighLevel = _firstHighLevel;
+		SetBuildSchedule(FindBuildSchedule(_firstHighLevel));
 		levelSizes.resize(numLevels);
 		levelSizes[0] = numVPLs;
 		vplAttribs[0] = VPLs[0].GetSRV();
@@ -96,65 +96,28 @@ public:
 		VPLScratchBuffersAtLevel.resize(numLevels);
 		VPLTaskBuffersAtHighLevel.resize(numLevels - firstHighLevel);
 		VPLAddressBuffersAtLevel.resize(numLevels);
-		CellStartIdAtLevel.resize(numLevels);
-		CellEndIdAtLevel.resize(numLevels);
-
-		SortedVPLs.resize(3);
-		SortedVPLs[0].Create(L"Sorted VPL Position List", 1.5 * numVPLs, sizeof(Vector3));
-		SortedVPLs[1].Create(L"Sorted VPL Normal List", 1.5 * numVPLs, sizeof(Vector3));
-		SortedVPLs[2].Create(L"Sorted VPL Color List", 1.5 * numVPLs, sizeof(Vector3));
-		IndexKeyList.Create(L"GPU Sort List", 1.2*numVPLs, sizeof(uint64_t));
+
 		for (int level = 1; level < numLevels; level++)
 		{
 			VPLBuffersAtLevel[level].resize(4);
-			VPLScratchBuffersAtLevel[level].resize(5); //additionally with weight
-			int numVerts = (1 << (highestLevel - level)) + 1;
-			numVerts = numVerts * numVerts * numVerts;
-			VPLScratchBuffersAtLevel[level][POSITION].Create(L"A VPLScratchBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLScratchBuffersAtLevel[level][NORMAL].Create(L"A VPLScratchBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLScratchBuffersAtLevel[level][COLOR].Create(L"A VPLScratchBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLScratchBuffersAtLevel[level][STDEV].Create(L"A VPLScratchBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLScratchBuffersAtLevel[level][WEIGHT].Create(L"A VPLScratchBuffersAtLevel", numVerts, sizeof(float));
-
-			VPLBuffersAtLevel[level][POSITION].Create(L"A VPLBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLBuffersAtLevel[level][NORMAL].Create(L"A VPLBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLBuffersAtLevel[level][COLOR].Create(L"A VPLBuffersAtLevel", numVerts, sizeof(Vector3));
-			VPLBuffersAtLevel[level][STDEV].Create(L"A VPLBuffersAtLevel", numVerts, sizeof(Vector3));
-
-			VPLAddressBuffersAtLevel[level].resize(2);
-			VPLAddressBuffersAtLevel[level][0].Create(L"A VPLAddressBufferAtLevel", numVerts, sizeof(int));
-			VPLAddressBuffersAtLevel[level][1].Create(L"A VPLAddressBufferAtLevel", numVerts, sizeof(int));
-
-			int numCells = (1 << (highestLevel - level));
-			numCells = numCells * numCells * numCells;
-			CellStartIdAtLevel[level].Create(L"A CellStartIdAtLevel", numCells, sizeof(int));
-			CellEndIdAtLevel[level].Create(L"A CellEndIdAtLevel", numCells, sizeof(int));
-			if (level >= firstHighLevel)
-			{
-				int taskDivRate = 8;
-				if (level == highestLevel) taskDivRate = 16;
-				int numTasksPerVertex = taskDivRate * taskDivRate * taskDivRate;
-
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel].resize(5);
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel][POSITION].Create(L"task buffer position", numTasksPerVertex * numVerts, sizeof(Vector3));
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel][NORMAL].Create(L"task buffer normal", numTasksPerVertex * numVerts, sizeof(Vector3));
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel][COLOR].Create(L"task buffer color", numTasksPerVertex * numVerts, sizeof(Vector3));
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel][STDEV].Create(L"task buffer stdev", numTasksPerVertex * numVerts, sizeof(Vector3));
-				VPLTaskBuffersAtHighLevel[level - firstHighLevel][WEIGHT].Create(L"task buffer weight", numTasksPerVertex * numVerts, sizeof(float));
-			}
 		}
 
-		int numLevelOneVerts = (1 << (highestLevel - 1)) + 1;
-		VertLockBuffers.resize(5);
-		VertLockBuffers[0].Create(L"vert lock buffer", numLevelOneVerts, sizeof(UINT));
-		VertLockBuffers[1].Create(L"vert lock buffer", numLevelOneVerts, sizeof(UINT));
-		VertLockBuffers[2].Create(L"vert lock buffer", numLevelOneVerts, sizeof(UINT));
-		VertLockBuffers[3].Create(L"vert lock buffer", numLevelOneVerts, sizeof(UINT));
-		VertLockBuffers[4].Create(L"vert lock buffer", numLevelOneVerts, sizeof(UINT));
-
-		int numBboxGroups = (MAXIMUM_NUM_VPLS + 1023) / 1024;
-		bboxReductionBuffer[0].Create(L"Reductionbuffer", numBboxGroups, sizeof(Vector3));
-		bboxReductionBuffer[1].Create(L"Reductionbuffer", numBboxGroups, sizeof(Vector3));
+		// dense level grids and bbox reduction buffers are only needed by the GPU passes, they are planned
+		// and placed in one heap by AllocateDenseLevelBuffers
+		isDenseStorageAllocated = false;
+		isCPULGHBuilt = false;
+		isStreamedBuild = false;
+		dirtyVPLBegin = 0;
+		dirtyVPLEnd = numVPLs;
+
+		// zero-copy merge: levels are compacted back to back behind level 0 into one arena per attribute
+		isArenaMerge = m_ZeroCopyMerge;
+		isInstancedFromArena = false;
+		isArenaLevelZeroValid = false;
+		instanceStart = 0;
+		levelOffsets.assign(numLevels + 1, 0);
+		LevelArena.resize(4);
+		arenaCapacity = 0;
 
 		if (!isReinit)
 		{
@@ -189,17 +152,21 @@ public:
 		}
 	};
 
+	// VPLs rewritten since the last Build, the CPU incremental update only reads back and diffs these
+	void SetDirtyVPLs(int begin, int end) { dirtyVPLBegin = begin; dirtyVPLEnd = end; }
+
 	bool CheckUpdate(ComputeContext& cptContext, int interleaveRate, bool vplsUpdated, bool drawLevelsChanged)
 	{
-		if (vplsUpdated || m_BuildSource != lastBuildSourceOption)
+		if (vplsUpdated || m_BuildSource != lastBuildSourceOption || m_BuildDevice != lastBuildDeviceOption)
 		{
 			lastBuildSourceOption = (BuildSourceOptions)(int)m_BuildSource;
+			lastBuildDeviceOption = (BuildDeviceOptions)(int)m_BuildDevice;
 			Build(cptContext, interleaveRate);
 			return true;
 		}
 		else if (drawLevelsChanged || interleaveRate != lastInterleaveRate) //re-merge
 		{
-			if (drawLevelsChanged) isLevelZeroIncluded = !isLevelZeroIncluded;
+			if (drawLevelsChanged && !isStreamedBuild) isLevelZeroIncluded = !isLevelZeroIncluded;
 			if (interleaveRate != lastInterleaveRate) { lastInterleaveRate = interleaveRate; };
 
 			if (interleaveRate > 1) MergeLevelsInterleave(cptContext, interleaveRate, isLevelZeroIncluded, true); //TODO: add buffer size dynamic adaption
@@ -212,25 +179,45 @@ public:
 	void Build(ComputeContext& cptContext, int interleavedRate = 1)
 	{
 		ScopedTimer _p0(L"Build LGH", cptContext);
+		isArenaLevelZeroValid = false;
 
-		FindBoundingBox(cptContext);
-
-		SplatForLevel(1, cptContext, m_BuildSource == buildFromS1);
-
-		for (int i = 2; i <= firstHighLevel - 1; i++)
+		if (m_BuildDevice == buildOnCPU)
 		{
-			if (m_BuildSource == buildFromVPLs)
-				SplatForLevel(i, cptContext);
-			else
-				GatherForLevel(i, cptContext);
+			BuildOnCPU(cptContext);
 		}
-
-		for (int i = firstHighLevel; i <= highestLevel; i++)
+		else
 		{
-			if (m_BuildSource == buildFromVPLs)
-				SplatForLevel(i, cptContext);
+			if (!isDenseStorageAllocated || plannedBuildSource != m_BuildSource) AllocateDenseLevelBuffers();
+			isCPULGHBuilt = false; // the GPU passes overwrite the level buffers
+			if (isArenaMerge) levelOffsets[1] = numVPLs; // the planned arena holds every level
+
+			if (m_CPUBoundingBox) FindBoundingBoxOnCPU(cptContext);
 			else
-				GatherForHighLevel(i, cptContext);
+			{
+				BeginTransientStep(cptContext);
+				FindBoundingBox(cptContext);
+			}
+
+			BeginTransientStep(cptContext);
+			SplatForLevel(1, cptContext, m_BuildSource == buildFromS1);
+
+			for (int i = 2; i <= firstHighLevel - 1; i++)
+			{
+				BeginTransientStep(cptContext);
+				if (m_BuildSource == buildFromVPLs)
+					SplatForLevel(i, cptContext);
+				else
+					GatherForLevel(i, cptContext);
+			}
+
+			for (int i = firstHighLevel; i <= highestLevel; i++)
+			{
+				BeginTransientStep(cptContext);
+				if (m_BuildSource == buildFromVPLs)
+					SplatForLevel(i, cptContext);
+				else
+					GatherForHighLevel(i, cptContext);
+			}
 		}
 
 		if (interleavedRate > 1) MergeLevelsInterleave(cptContext, interleavedRate, isLevelZeroIncluded);
@@ -239,6 +226,28 @@ public:
 		lastInterleaveRate = interleavedRate;
 	}
 
+	// out-of-core CPU build: VPLs are read from the source in batches of batchSize, so peak memory is
+	// the sparse level storage plus one batch. Level 0 is never merged since the VPLs are not resident.
+	void BuildFromStream(ComputeContext& cptContext, CPUVPLSource& source, std::vector<StructuredBuffer>& _VPLs,
+		int interleavedRate = 1, int batchSize = 1 << 22, bool isReinit = false);
+
+	// times full builds of the current VPLs over a grid of build schedules, keeps the fastest and
+	// stores it in the tuning profile for the scene class, so later Inits of the class start with it
+	void TuneBuildSchedule(ComputeContext& cptContext, int interleavedRate = 1);
+	static BoolVar m_TuneBuildSchedule;
+
+	// writes the VPLs of the last build to a VPL file (CPUVPLFileSource), the captured sets of LGHBench
+	bool CaptureVPLs(ComputeContext& cptContext, const std::string& path);
+	static BoolVar m_CaptureVPLs;
+
+	// prints the memory plan and the compressed level sizes whenever they are made
+	static BoolVar m_VerboseStats;
+
+	// disk cache of a finished hierarchy (levels and merged instances)
+	uint64_t HashBuildParameters(uint64_t hash);
+	bool WriteCache(ComputeContext& cptContext, const std::string& path, uint64_t key, int numPaths);
+	bool LoadCache(const LGHCacheFile& cache);
+
 	// create lighting grid
 	enum VPLAttributes
 	{
@@ -252,6 +261,7 @@ public:
 	int numVPLs;
 	int highestLevel;
 	int firstHighLevel;
+	uint64_t sceneHash = 0; // set by the renderer, selects the tuned schedule
 	float highestCellSize;
 	float baseRadius;
 	Vector3 lgh_corner;
@@ -259,6 +269,10 @@ public:
 	std::vector<StructuredBuffer> InstanceBuffers;
 	std::vector<int> levelSizes;
 	int numInstances;
+	int instanceStart; // first merged instance in GetInstanceBuffers(), level 0 is skipped by starting behind it
+
+	// the level arena itself after a zero-copy merge, InstanceBuffers otherwise
+	std::vector<StructuredBuffer>& GetInstanceBuffers() { return isInstancedFromArena ? LevelArena : InstanceBuffers; }
 	int lastNumInstances;
 
 	// for interleaved rendering
@@ -271,12 +285,49 @@ private:
 	static const char* buildSourceOptionsText[2];
 	static EnumVar m_BuildSource;
 
+	enum BuildDeviceOptions { buildOnGPU = 0, buildOnCPU };
+	static const char* buildDeviceOptionsText[2];
+	static EnumVar m_BuildDevice;
+	static IntVar m_CPUBuildThreads;
+	static BoolVar m_CPUSortVPLs;
+	static BoolVar m_CPUTiledGather;
+	static BoolVar m_CPUDeterministic;
+	static BoolVar m_CPUIncrementalUpdate;
+	static BoolVar m_CPUBoundingBox;
+	static BoolVar m_CPUCompressedLevels;
+	static BoolVar m_ZeroCopyMerge;
+	static BoolVar m_CPUInterleavedMerge;
+	static BoolVar m_UseTunedSchedule;
+
 	bool isLevelZeroIncluded;
+	bool isDenseStorageAllocated;
+	bool isCPULGHBuilt; // cpuBuilder holds the levels of the current grid, so it can be updated incrementally
+	int dirtyVPLBegin, dirtyVPLEnd; // set by SetDirtyVPLs
+	bool isStreamedBuild; // levels were built by BuildFromStream, VPLs is not the level 0 of the grid
+	bool isArenaMerge; // levels live in LevelArena at levelOffsets instead of VPLBuffersAtLevel
+	bool isInstancedFromArena;
+	bool isArenaLevelZeroValid; // level 0 is copied into the arena on first use after a build
 
 	BuildSourceOptions lastBuildSourceOption;
+	BuildDeviceOptions lastBuildDeviceOption;
 
 	int lastInterleaveRate;
 
+	LGHBuildSchedule schedule;
+	uint64_t GetSceneClass(bool isAnyScene = false);
+	LGHBuildSchedule FindBuildSchedule(int _firstHighLevel);
+	void SetBuildSchedule(const LGHBuildSchedule& _schedule);
+	std::vector<LGHBuildSchedule> GetScheduleCandidates();
+	uint64_t GetTaskBufferBytes(const LGHBuildSchedule& candidate);
+	float TimeFullBuild(ComputeContext& cptContext, int interleavedRate);
+
+	// a task covers (2^level / taskDivRate)^3 S1 vertices, so the rate is a power of two up to 2^level
+	int GetTaskDivRate(int level, const LGHBuildSchedule& _schedule)
+	{
+		return std::min(level == highestLevel ? _schedule.topTaskDivRate : _schedule.taskDivRate, 1 << level);
+	}
+	int GetTaskDivRate(int level) { return GetTaskDivRate(level, schedule); }
+
 	void VerifySort(uint64_t* List, uint32_t ListLength, bool bAscending)
 	{
 		const uint64_t IndexMask = Math::AlignPowerOfTwo(ListLength) - 1;
@@ -303,28 +354,54 @@ private:
 	}
 
 	void FindBoundingBox(ComputeContext& cptContext);
+	void FindBoundingBoxOnCPU(ComputeContext& cptContext);
+	// count < 0 reads back every VPL, otherwise only [firstVPL, firstVPL + count) into arrays of numVPLs entries
+	void ReadbackVPLs(ComputeContext& cptContext, int numAttributes, int firstVPL = 0, int count = -1);
 	void MergeLevelsInterleave(ComputeContext& cptContext, int interleavedRate, bool includeLevelZero = false, bool isRemerge = false);
+	void MergeLevelsInterleaveOnCPU(ComputeContext& cptContext, int interleavedRate, bool includeLevelZero);
 	void MergeLevels(ComputeContext& cptContext, bool includeLevelZero = false, bool isRemerge = false);
 	void GatherForHighLevel(int level, ComputeContext& cptContext);
 	void GatherForLevel(int level, ComputeContext& cptContext);
 	void SplatForLevel(int level, ComputeContext& cptContext, bool isBuildFromS1 = false);
+	void BuildOnCPU(ComputeContext& cptContext);
+	void InitCPUBuilder();
+	void UploadCPULevels(ComputeContext& cptContext);
+	std::vector<StructuredBuffer>& GetCompactionTarget(ComputeContext& cptContext, int level, int& arenaOffset);
+	bool ReserveArena(ComputeContext& cptContext, int numUsed, int numRequired);
+	void CopyLevelZeroToArena(ComputeContext& cptContext);
+	void CompressCPULevels();
+	void AllocateDenseLevelBuffers();
+	void ReleaseDenseLevelBuffers();
+	void BeginTransientStep(ComputeContext& cptContext);
+	int GetLevelCapacity(int level);
+
+	// every buffer of a GPU build is placed in buildHeap: persistent compacted levels (or the arena)
+	// first, then one region that each build step (bbox, level 1, level 2, ...) reuses for its
+	// transient dense grids, address and task buffers. Declared before the buffers, so it outlives them.
+	LGHMemoryPlan memoryPlan;
+	Microsoft::WRL::ComPtr<ID3D12Heap> buildHeap;
+	GpuResource anyPlacedResource; // stays empty, an aliasing barrier with it covers every placed buffer
+	BuildSourceOptions plannedBuildSource;
+	bool isArenaPlaced = false;
 
 	std::vector<std::vector<StructuredBuffer>> VPLScratchBuffersAtLevel; //before compaction
 	std::vector<std::vector<StructuredBuffer>> VPLBuffersAtLevel;
 	std::vector<std::vector<StructuredBuffer>> VPLTaskBuffersAtHighLevel;
 	std::vector<std::vector<StructuredBuffer>> VPLAddressBuffersAtLevel;
-	std::vector<StructuredBuffer> CellStartIdAtLevel;
-	std::vector<StructuredBuffer> CellEndIdAtLevel;
-
-	std::vector<StructuredBuffer> VertLockBuffers; //for level 1
 
-	ByteAddressBuffer IndexKeyList;
+	// [level 0 | level 1 | ... | highestLevel], level i starts at levelOffsets[i]
+	std::vector<StructuredBuffer> LevelArena;
+	std::vector<int> levelOffsets;
+	int arenaCapacity;
 
 	StructuredBuffer bboxReductionBuffer[2];
 
 	std::vector<StructuredBuffer> VPLs;
 
-	std::vector<StructuredBuffer> SortedVPLs;
+	// CPU build path
+	CPULGHBuilder cpuBuilder;
+	std::vector<glm::vec4> cpuVPLAttribs[3];
+	std::vector<glm::vec4> cpuInstanceAttribs[4]; // interleaved instances merged on the CPU
 
 	RootSignature RootSig;
 
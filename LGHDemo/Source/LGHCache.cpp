@@ -0,0 +1,165 @@
+#include "LGHCache.h"
+#include <cstdio>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint64_t ATTRIBUTE_STRIDE = 4 * sizeof(float);
+
+static uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+bool WriteLGHCache(const std::string& path, LGHCacheContents& contents)
+{
+	LGHCacheHeader& header = contents.header;
+	int numLevels = (int)contents.levelSizes.size();
+	int numTiles = (int)contents.offsetOfTile.size();
+	if (numLevels < 2 || (int)contents.levelData.size() != numLevels || (int)contents.numInstanceOfTile.size() != numTiles) return false;
+
+	header.magic = LGH_CACHE_MAGIC;
+	header.version = LGH_CACHE_VERSION;
+	header.numLevels = numLevels;
+	header.levelSizesOffset = AlignSection(sizeof(LGHCacheHeader));
+	header.tilesOffset = AlignSection(header.levelSizesOffset + numLevels * sizeof(int));
+	header.levelDataOffset = AlignSection(header.tilesOffset + 2 * numTiles * sizeof(int));
+	uint64_t levelDataSize = 0;
+	for (int level = 1; level < numLevels; level++) levelDataSize += 4 * contents.levelSizes[level] * ATTRIBUTE_STRIDE;
+	header.instanceDataOffset = header.levelDataOffset + levelDataSize;
+	header.fileSize = header.instanceDataOffset + 4 * (uint64_t)header.numInstances * ATTRIBUTE_STRIDE;
+
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) return false;
+
+	static const uint8_t zeros[16] = {};
+	uint64_t written = 0;
+	bool ok = true;
+	auto write = [&](const void* data, uint64_t bytes)
+	{
+		if (ok && bytes > 0) ok = fwrite(data, 1, (size_t)bytes, file) == bytes;
+		written += bytes;
+	};
+	auto seek = [&](uint64_t offset) { write(zeros, offset - written); };
+
+	write(&header, sizeof(header));
+	seek(header.levelSizesOffset);
+	write(contents.levelSizes.data(), numLevels * sizeof(int));
+	seek(header.tilesOffset);
+	write(contents.offsetOfTile.data(), numTiles * sizeof(int));
+	write(contents.numInstanceOfTile.data(), numTiles * sizeof(int));
+	seek(header.levelDataOffset);
+	for (int level = 1; level < numLevels; level++)
+	{
+		for (int attribute = 0; attribute < 4; attribute++) write(contents.levelData[level][attribute], contents.levelSizes[level] * ATTRIBUTE_STRIDE);
+	}
+	for (int attribute = 0; attribute < 4; attribute++) write(contents.instanceData[attribute], header.numInstances * ATTRIBUTE_STRIDE);
+
+	ok = fclose(file) == 0 && ok && written == header.fileSize;
+	if (ok)
+	{
+		remove(path.c_str());
+		ok = rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+	if (!ok) remove(tempPath.c_str());
+	return ok;
+}
+
+bool LGHCacheFile::Open(const std::string& path, uint64_t key)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	fileHandle = file;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(LGHCacheHeader))
+	{
+		Close();
+		return false;
+	}
+	size = (uint64_t)fileSize.QuadPart;
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle)
+	{
+		Close();
+		return false;
+	}
+	base = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+	fileDescriptor = open(path.c_str(), O_RDONLY);
+	if (fileDescriptor < 0) return false;
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(LGHCacheHeader))
+	{
+		Close();
+		return false;
+	}
+	size = (uint64_t)fileStat.st_size;
+	void* mapping = mmap(nullptr, (size_t)size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	base = mapping == MAP_FAILED ? nullptr : (const uint8_t*)mapping;
+#endif
+	if (!base)
+	{
+		Close();
+		return false;
+	}
+
+	const LGHCacheHeader& header = Header();
+	bool isValid = header.magic == LGH_CACHE_MAGIC && header.version == LGH_CACHE_VERSION && header.key == key &&
+		header.fileSize == size && header.numLevels >= 2 && header.numLevels <= 32 && header.numInstances >= 0 &&
+		header.interleaveRate >= 1 && header.interleaveRate <= 16 &&
+		header.levelSizesOffset + header.numLevels * sizeof(int) <= header.tilesOffset &&
+		header.tilesOffset + 2 * NumTiles() * sizeof(int) <= header.levelDataOffset;
+
+	// section bounds follow from levelSizes, which must add up to the stored offsets
+	uint64_t offset = header.levelDataOffset;
+	for (int level = 1; isValid && level < header.numLevels; level++)
+	{
+		if (LevelSizes()[level] < 0) isValid = false;
+		levelOffsets.push_back(offset);
+		offset += 4 * LevelSizes()[level] * ATTRIBUTE_STRIDE;
+	}
+	isValid = isValid && offset == header.instanceDataOffset &&
+		header.instanceDataOffset + 4 * (uint64_t)header.numInstances * ATTRIBUTE_STRIDE == header.fileSize;
+
+	if (!isValid) Close();
+	return isValid;
+}
+
+void LGHCacheFile::Close()
+{
+#ifdef _WIN32
+	if (base) UnmapViewOfFile(base);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (base) munmap((void*)base, (size_t)size);
+	if (fileDescriptor >= 0) close(fileDescriptor);
+	fileDescriptor = -1;
+#endif
+	base = nullptr;
+	size = 0;
+	levelOffsets.clear();
+}
+
+const void* LGHCacheFile::LevelAttribute(int level, int attribute) const
+{
+	return base + levelOffsets[level - 1] + attribute * LevelSizes()[level] * ATTRIBUTE_STRIDE;
+}
+
+const void* LGHCacheFile::InstanceAttribute(int attribute) const
+{
+	return base + Header().instanceDataOffset + attribute * Header().numInstances * ATTRIBUTE_STRIDE;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a style hash over 8-byte words, used to build LGH cache keys
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+template <typename T>
+inline uint64_t HashValue(const T& value, uint64_t hash)
+{
+	return HashBytes(&value, sizeof(T), hash);
+}
+
+constexpr uint32_t LGH_CACHE_MAGIC = 0x4348474c; // "LGHC"
+constexpr uint32_t LGH_CACHE_VERSION = 1; // bump when the layout below or the LGH math changes
+
+// File layout: header, levelSizes[numLevels], offsetOfTile[numTiles], numInstanceOfTile[numTiles],
+// position/normal/color/stdev of levels 1..numLevels-1, position/normal/color/stdev of the merged instances.
+// Attributes are float4 arrays exactly as in the GPU buffers and every section starts 16-byte aligned,
+// so a mapped file is used in place.
+struct LGHCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	int32_t numLevels;
+	int32_t numVPLs;
+	int32_t numPaths;
+	int32_t numInstances;
+	int32_t interleaveRate; // 1: instances are merged level by level, otherwise numTiles = interleaveRate^2
+	int32_t isLevelZeroIncluded;
+	float lgh_corner[3];
+	float highestCellSize;
+	float baseRadius;
+	uint32_t padding[3];
+	uint64_t levelSizesOffset;
+	uint64_t tilesOffset;
+	uint64_t levelDataOffset;
+	uint64_t instanceDataOffset;
+	uint64_t fileSize;
+};
+
+// a finished hierarchy to be written, levelData[level][attribute] and instanceData[attribute] are float4 arrays
+struct LGHCacheContents
+{
+	LGHCacheHeader header; // the offsets are filled in by WriteLGHCache
+	std::vector<int> levelSizes;
+	std::vector<int> offsetOfTile;
+	std::vector<int> numInstanceOfTile;
+	std::vector<std::vector<const void*>> levelData;
+	const void* instanceData[4];
+};
+
+// writes to a temporary file first, so concurrent jobs never map a partially written cache
+bool WriteLGHCache(const std::string& path, LGHCacheContents& contents);
+
+// read-only memory mapping of a cache file
+class LGHCacheFile
+{
+public:
+
+	LGHCacheFile() {};
+	~LGHCacheFile() { Close(); }
+
+	// maps the file and validates version, key and section bounds
+	bool Open(const std::string& path, uint64_t key);
+	void Close();
+
+	const LGHCacheHeader& Header() const { return *(const LGHCacheHeader*)base; }
+	const int* LevelSizes() const { return (const int*)(base + Header().levelSizesOffset); }
+	int NumTiles() const { return Header().interleaveRate > 1 ? Header().interleaveRate * Header().interleaveRate : 0; }
+	const int* OffsetOfTile() const { return (const int*)(base + Header().tilesOffset); }
+	const int* NumInstanceOfTile() const { return OffsetOfTile() + NumTiles(); }
+	const void* LevelAttribute(int level, int attribute) const;
+	const void* InstanceAttribute(int attribute) const;
+
+private:
+
+	const uint8_t* base = nullptr;
+	uint64_t size = 0;
+	std::vector<uint64_t> levelOffsets;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Offsets of the LGH build buffers in one heap. A buffer is either persistent (alive from one build
+// to the next) or transient to one step of a build. Steps run one after another and no transient
+// buffer outlives its step, so every step reuses one shared region behind the persistent buffers,
+// as large as the largest step.
+class LGHMemoryPlan
+{
+public:
+
+	static const int PERSISTENT = -1;
+	static const uint64_t ALIGNMENT = 65536; // D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+
+	void Reset()
+	{
+		buffers.clear();
+		stepBytes.clear();
+		persistentBytes = 0;
+	}
+
+	// returns the index of the buffer, tag groups buffers for reporting (e.g. by level)
+	int Add(int step, uint64_t bytes, int tag = 0)
+	{
+		PlannedBuffer buffer;
+		buffer.step = step;
+		buffer.tag = tag;
+		buffer.bytes = bytes;
+		bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		if (step == PERSISTENT)
+		{
+			buffer.offset = persistentBytes;
+			persistentBytes += bytes;
+		}
+		else
+		{
+			if ((int)stepBytes.size() <= step) stepBytes.resize(step + 1, 0);
+			buffer.offset = stepBytes[step];
+			stepBytes[step] += bytes;
+		}
+		buffers.push_back(buffer);
+		return (int)buffers.size() - 1;
+	}
+
+	// heap offset of a buffer, final once every buffer is added
+	uint64_t Offset(int buffer) const
+	{
+		const PlannedBuffer& planned = buffers[buffer];
+		return planned.step == PERSISTENT ? planned.offset : persistentBytes + planned.offset;
+	}
+
+	uint64_t SharedBytes() const { return stepBytes.empty() ? 0 : *std::max_element(stepBytes.begin(), stepBytes.end()); }
+	uint64_t TotalBytes() const { return persistentBytes + SharedBytes(); }
+	uint64_t PersistentBytes() const { return persistentBytes; }
+
+	// what separate allocations of every buffer would take
+	uint64_t UnsharedBytes() const
+	{
+		uint64_t bytes = persistentBytes;
+		for (uint64_t step : stepBytes) bytes += step;
+		return bytes;
+	}
+
+	uint64_t TaggedBytes(int tag) const
+	{
+		uint64_t bytes = 0;
+		for (const PlannedBuffer& buffer : buffers) if (buffer.tag == tag) bytes += buffer.bytes;
+		return bytes;
+	}
+
+private:
+
+	struct PlannedBuffer
+	{
+		int step;
+		int tag;
+		uint64_t bytes;
+		uint64_t offset; // within the persistent buffers or within the step
+	};
+
+	std::vector<PlannedBuffer> buffers;
+	std::vector<uint64_t> stepBytes;
+	uint64_t persistentBytes = 0;
+};
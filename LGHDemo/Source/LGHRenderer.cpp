@@ -46,6 +46,8 @@ const char* LGHRenderer::PresetVPLEmissionOrderOfMagnitudeText[6] = { "Custom",
 EnumVar LGHRenderer::m_PresetVPLOrderOfMagnitude("Application/VPL/Preset Density Level", 3, 6, PresetVPLEmissionOrderOfMagnitudeText);
 
 NumVar LGHRenderer::m_VPLEmissionLevel("Application/VPL/Density", 3.9, 0.1, 40.0, 0.1);
+BoolVar LGHRenderer::m_DiskCache("Application/LGH/Disk Cache", false);
+BoolVar LGHRenderer::m_CPUVPLTracing("Application/VPL/Trace on CPU", false);
 
 void LGHRenderer::InitBuffers(int scrWidth, int scrHeight)
 {
@@ -440,6 +442,7 @@ void LGHRenderer::Initialize(Model1* model, int numModels, int scrWidth, int scr
 	lastPresetOrderOfMagnitude = m_PresetVPLOrderOfMagnitude;
 	lastMaxDepth = m_MaxDepth;
 	m_Model = model;
+	m_NumModels = numModels;
 	m_PPhi = 0.66f * model[0].m_SceneBoundingSphere.GetW();
 	InitBuffers(scrWidth, scrHeight);
 	InitRootSignatures();
@@ -453,6 +456,81 @@ void LGHRenderer::Initialize(Model1* model, int numModels, int scrWidth, int scr
 		m_vplSampleBuffer.GetSRV(), m_runningSumBuffer.GetSRV(), m_sampleColorBuffer.GetSRV(), interleaveRates[m_InterleaveRate] > 1 ? &m_ScenePositionBufferArray : nullptr,
 		interleaveRates[m_InterleaveRate] > 1 ? &m_SceneNormalBufferArray : nullptr);
 	vplManager.InitializeLGHSrvs(m_Model->m_BlueNoiseSRV[0], m_Model->m_BlueNoiseSRV[1], m_Model->m_BlueNoiseSRV[2]);
+
+	// geometry fingerprint of the scene, model matrices are added per cache lookup
+	sceneHash = HashValue(numModels, 14695981039346656037ull);
+	for (int i = 0; i < numModels; i++)
+	{
+		const Model1& m = model[i];
+		const Model1::BoundingBox& bbox = m.m_Header.boundingBox;
+		float bounds[6] = { bbox.min.GetX(), bbox.min.GetY(), bbox.min.GetZ(), bbox.max.GetX(), bbox.max.GetY(), bbox.max.GetZ() };
+		uint32_t sizes[4] = { m.m_Header.meshCount, m.m_Header.materialCount, m.m_Header.vertexDataByteSize, m.m_Header.indexDataByteSize };
+		sceneHash = HashValue(bounds, sceneHash);
+		sceneHash = HashValue(sizes, sceneHash);
+		// assimp models do not keep their vertex data on the CPU
+		if (m.m_pVertexData) sceneHash = HashBytes(m.m_pVertexData, m.m_Header.vertexDataByteSize, sceneHash);
+		if (m.m_pIndexData) sceneHash = HashBytes(m.m_pIndexData, m.m_Header.indexDataByteSize, sceneHash);
+	}
+	gpuLightingGridBuilder.sceneHash = sceneHash;
+	isLGHLoadedFromCache = false;
+	isLGHCacheWritePending = false;
+}
+
+uint64_t LGHRenderer::GetLGHCacheKey(const Vector3& lightDirection, float lightIntensity)
+{
+	uint64_t key = sceneHash;
+	for (int i = 0; i < m_NumModels; i++)
+	{
+		float modelMatrix[16];
+		for (int column = 0; column < 4; column++)
+		{
+			Vector4 c = m_Model[i].m_modelMatrix.GetX();
+			if (column == 1) c = m_Model[i].m_modelMatrix.GetY();
+			else if (column == 2) c = m_Model[i].m_modelMatrix.GetZ();
+			else if (column == 3) c = m_Model[i].m_modelMatrix.GetW();
+			modelMatrix[column * 4] = c.GetX();
+			modelMatrix[column * 4 + 1] = c.GetY();
+			modelMatrix[column * 4 + 2] = c.GetZ();
+			modelMatrix[column * 4 + 3] = c.GetW();
+		}
+		key = HashValue(modelMatrix, key);
+	}
+	float lightParams[4] = { lightDirection.GetX(), lightDirection.GetY(), lightDirection.GetZ(), lightIntensity };
+	key = HashValue(lightParams, key);
+	float emissionLevel = m_VPLEmissionLevel;
+	int buildParams[3] = { m_MaxDepth, m_DrawLevels, interleaveRates[m_InterleaveRate] };
+	key = HashValue(emissionLevel, key);
+	key = HashValue(buildParams, key);
+	return gpuLightingGridBuilder.HashBuildParameters(key);
+}
+
+std::string LGHRenderer::GetLGHCachePath(uint64_t key)
+{
+	char fileName[64];
+	sprintf_s(fileName, "LGHCache/%016llx.lgh", (unsigned long long)key);
+	return fileName;
+}
+
+bool LGHRenderer::LoadLGHFromCache(GraphicsContext& context, const Vector3& lightDirection, float lightIntensity)
+{
+	uint64_t key = GetLGHCacheKey(lightDirection, lightIntensity);
+	LGHCacheFile cache;
+	if (!cache.Open(GetLGHCachePath(key), key)) return false;
+
+	const LGHCacheHeader& header = cache.Header();
+	if (gpuLightingGridBuilder.CalculateNumLevels(header.numVPLs) != header.numLevels) return false;
+
+	gpuLightingGridBuilder.Init(context.GetComputeContext(), header.numVPLs, vplManager.VPLBuffers, header.isLevelZeroIncluded != 0);
+	if (!gpuLightingGridBuilder.LoadCache(cache)) return false;
+
+	// the VPLs themselves are not cached, so they are only traced once something requires them
+	vplManager.SkipVPLGeneration(header.numVPLs, header.numPaths, lightDirection, lightIntensity);
+	vplManager.UpdateLGHSrvs(gpuLightingGridBuilder.GetInstanceBuffers()[0].GetSRV(),
+		gpuLightingGridBuilder.GetInstanceBuffers()[1].GetSRV(),
+		gpuLightingGridBuilder.GetInstanceBuffers()[2].GetSRV(),
+		gpuLightingGridBuilder.GetInstanceBuffers()[3].GetSRV());
+	if (LGHBuilder::m_VerboseStats) printf("LGH loaded from cache (%d VPLs)\n", header.numVPLs);
+	return true;
 }
 
 void LGHRenderer::GenerateLightingGridHierarchy(GraphicsContext& context, Vector3 lightDirection, float lightIntensity, bool hasSceneChange)
@@ -481,7 +559,27 @@ void LGHRenderer::GenerateLightingGridHierarchy(GraphicsContext& context, Vector
 		m_PresetVPLOrderOfMagnitude = 0; //set preset to custom
 	}
 
-	vplsUpdated = vplManager.GenerateVPLs(context, m_VPLEmissionLevel, lightDirection, lightIntensity, m_MaxDepth, hasSceneChange || hasRequiredVPLsChange);
+	if (isFirstTime && !hasRequiredVPLsChange && m_DiskCache)
+	{
+		if (LoadLGHFromCache(context, lightDirection, lightIntensity))
+		{
+			isLGHLoadedFromCache = true;
+			return;
+		}
+		isLGHCacheWritePending = true;
+	}
+
+	// a cached hierarchy has no VPLs behind it, so any change that needs them (re-merging level 0 or
+	// interleaved tiles, new VPLs) traces them and rebuilds, with Init following the current draw levels option
+	bool hasCacheRegenRequest = isLGHLoadedFromCache && (drawLevelsChanged || hasSceneChange || hasRequiredVPLsChange ||
+		lastInterleaveRateOption != (InterleaveRateOptions)interleaveRates[m_InterleaveRate]);
+	if (hasCacheRegenRequest)
+	{
+		isLGHLoadedFromCache = false;
+		drawLevelsChanged = false;
+	}
+
+	vplsUpdated = vplManager.GenerateVPLs(context, m_VPLEmissionLevel, lightDirection, lightIntensity, m_MaxDepth, hasSceneChange || hasRequiredVPLsChange || hasCacheRegenRequest, m_CPUVPLTracing);
 
 	if (vplsUpdated)
 	{
@@ -503,15 +601,46 @@ void LGHRenderer::GenerateLightingGridHierarchy(GraphicsContext& context, Vector
 		}
 	}
 
-	if (isFirstTime) gpuLightingGridBuilder.Init(context.GetComputeContext(), vplManager.numVPLs, vplManager.VPLBuffers, m_DrawLevels == includeVPLs, isReinit);
+	if (isFirstTime || hasCacheRegenRequest) gpuLightingGridBuilder.Init(context.GetComputeContext(), vplManager.numVPLs, vplManager.VPLBuffers, m_DrawLevels == includeVPLs, isReinit || hasCacheRegenRequest);
 	else gpuLightingGridBuilder.numVPLs = vplManager.numVPLs;
+	if (vplsUpdated) gpuLightingGridBuilder.SetDirtyVPLs(vplManager.dirtyVPLBegin, vplManager.dirtyVPLEnd);
+	else gpuLightingGridBuilder.SetDirtyVPLs(0, 0);
 
 	if (gpuLightingGridBuilder.CheckUpdate(context.GetComputeContext(), interleaveRates[m_InterleaveRate], vplsUpdated, drawLevelsChanged))
 	{
-		vplManager.UpdateLGHSrvs(gpuLightingGridBuilder.InstanceBuffers[0].GetSRV(),
-			gpuLightingGridBuilder.InstanceBuffers[1].GetSRV(),
-			gpuLightingGridBuilder.InstanceBuffers[2].GetSRV(),
-			gpuLightingGridBuilder.InstanceBuffers[3].GetSRV());
+		vplManager.UpdateLGHSrvs(gpuLightingGridBuilder.GetInstanceBuffers()[0].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[1].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[2].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[3].GetSRV());
+
+		// the first complete build of a startup that missed the cache is written back
+		if (isLGHCacheWritePending && vplsUpdated && vplManager.IsVPLGenerationComplete())
+		{
+			isLGHCacheWritePending = false;
+			uint64_t key = GetLGHCacheKey(lightDirection, lightIntensity);
+			CreateDirectoryA("LGHCache", nullptr);
+			if (!gpuLightingGridBuilder.WriteCache(context.GetComputeContext(), GetLGHCachePath(key), key, vplManager.numPaths))
+				printf("failed to write LGH cache %s\n", GetLGHCachePath(key).c_str());
+		}
+	}
+
+	// tuning times builds of the VPLs in use, so it waits until all of them are traced
+	if (LGHBuilder::m_TuneBuildSchedule && !isLGHLoadedFromCache && vplManager.IsVPLGenerationComplete())
+	{
+		LGHBuilder::m_TuneBuildSchedule = false;
+		gpuLightingGridBuilder.TuneBuildSchedule(context.GetComputeContext(), interleaveRates[m_InterleaveRate]);
+		vplManager.UpdateLGHSrvs(gpuLightingGridBuilder.GetInstanceBuffers()[0].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[1].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[2].GetSRV(),
+			gpuLightingGridBuilder.GetInstanceBuffers()[3].GetSRV());
+	}
+
+	if (LGHBuilder::m_CaptureVPLs && !isLGHLoadedFromCache && vplManager.IsVPLGenerationComplete())
+	{
+		LGHBuilder::m_CaptureVPLs = false;
+		if (gpuLightingGridBuilder.CaptureVPLs(context.GetComputeContext(), "LGHCapture.vpls"))
+			printf("wrote %d VPLs to LGHCapture.vpls\n", gpuLightingGridBuilder.numVPLs);
+		else printf("failed to capture VPLs\n");
 	}
 }
 
@@ -599,10 +728,10 @@ void LGHRenderer::RenderInterleaved(GraphicsContext& gfxContext, const ViewConfi
 			gfxContext.TransitionResource(m_SceneAlbedoBufferArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 			gfxContext.TransitionResource(m_SceneSpecularBufferArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 			gfxContext.TransitionResource(m_SceneDepthBufferDeinterleave, D3D12_RESOURCE_STATE_DEPTH_READ);
-			gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[0], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-			gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[1], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-			gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[2], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-			gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[3], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+			gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[0], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+			gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[1], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+			gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[2], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+			gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[3], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
 			gfxContext.TransitionResource(m_sampleColorBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 			gfxContext.TransitionResource(m_vplSampleBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 			gfxContext.TransitionResource(m_lockImageBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
@@ -625,10 +754,10 @@ void LGHRenderer::RenderInterleaved(GraphicsContext& gfxContext, const ViewConfi
 					gfxContext.SetIndexBuffer(m_cube.m_IndexBuffer.IndexBufferView());
 
 					const D3D12_VERTEX_BUFFER_VIEW VBViews[] = { m_cube.m_VertexBuffer.VertexBufferView(),
-												gpuLightingGridBuilder.InstanceBuffers[0].VertexBufferView(),
-												gpuLightingGridBuilder.InstanceBuffers[1].VertexBufferView(),
-												gpuLightingGridBuilder.InstanceBuffers[2].VertexBufferView(),
-												gpuLightingGridBuilder.InstanceBuffers[3].VertexBufferView() };
+												gpuLightingGridBuilder.GetInstanceBuffers()[0].VertexBufferView(),
+												gpuLightingGridBuilder.GetInstanceBuffers()[1].VertexBufferView(),
+												gpuLightingGridBuilder.GetInstanceBuffers()[2].VertexBufferView(),
+												gpuLightingGridBuilder.GetInstanceBuffers()[3].VertexBufferView() };
 
 					gfxContext.SetVertexBuffers(0, 5, VBViews);
 
@@ -712,10 +841,10 @@ void LGHRenderer::RenderInterleaved(GraphicsContext& gfxContext, const ViewConfi
 
 		gfxContext.TransitionResource(m_runningSumBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 		gfxContext.TransitionResource(m_vplSampleBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[0], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[2], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[3], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[0], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[2], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[3], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
 		vplManager.CastLGHShadowRays(gfxContext, viewConfig.m_MainViewport.Width, viewConfig.m_MainViewport.Height, m_ShadowRate,
 			gpuLightingGridBuilder.highestLevel + 1, m_DrawLevels == skipVPLs, gpuLightingGridBuilder.baseRadius, 
@@ -796,10 +925,10 @@ void LGHRenderer::Render(GraphicsContext& gfxContext, const ViewConfig& viewConf
 		gfxContext.SetIndexBuffer(m_cube.m_IndexBuffer.IndexBufferView());
 
 		const D3D12_VERTEX_BUFFER_VIEW VBViews[] = { m_cube.m_VertexBuffer.VertexBufferView(),
-													gpuLightingGridBuilder.InstanceBuffers[0].VertexBufferView(),
-													gpuLightingGridBuilder.InstanceBuffers[1].VertexBufferView(),
-													gpuLightingGridBuilder.InstanceBuffers[2].VertexBufferView(),
-													gpuLightingGridBuilder.InstanceBuffers[3].VertexBufferView() };
+													gpuLightingGridBuilder.GetInstanceBuffers()[0].VertexBufferView(),
+													gpuLightingGridBuilder.GetInstanceBuffers()[1].VertexBufferView(),
+													gpuLightingGridBuilder.GetInstanceBuffers()[2].VertexBufferView(),
+													gpuLightingGridBuilder.GetInstanceBuffers()[3].VertexBufferView() };
 
 		gfxContext.SetVertexBuffers(0, 5, VBViews);
 		gfxContext.SetDynamicDescriptors(3, 0, _countof(m_GBufferSrvs), m_GBufferSrvs);
@@ -814,10 +943,10 @@ void LGHRenderer::Render(GraphicsContext& gfxContext, const ViewConfig& viewConf
 		gfxContext.TransitionResource(m_vplSampleBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 		gfxContext.TransitionResource(m_AnalyticBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET);
 		gfxContext.TransitionResource(m_sampleColorBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[0], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[1], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[2], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[3], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[0], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[1], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[2], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[3], D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
 		gfxContext.TransitionResource(Graphics::g_ScenePositionBuffer, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 		gfxContext.TransitionResource(Graphics::g_SceneNormalBuffer, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 		gfxContext.TransitionResource(Graphics::g_SceneAlbedoBuffer, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
@@ -860,6 +989,7 @@ void LGHRenderer::Render(GraphicsContext& gfxContext, const ViewConfig& viewConf
 			int frameId;
 			int temporalRandom;
 			float sceneRadius;
+			int instanceOffset;
 		} psConstants;
 
 		psConstants.frameId = frameId % 1024;
@@ -879,8 +1009,9 @@ void LGHRenderer::Render(GraphicsContext& gfxContext, const ViewConfig& viewConf
 		psConstants.shadowRate = m_IndirectShadow ? m_ShadowRate : 0;
 		psConstants.temporalRandom = m_TemporalRandom;
 		psConstants.sceneRadius = vplManager.sceneBoundingSphere.GetW();
+		psConstants.instanceOffset = gpuLightingGridBuilder.instanceStart;
 		gfxContext.SetDynamicConstantBufferView(1, sizeof(psConstants), &psConstants);
-		gfxContext.DrawIndexedInstanced(m_cube.indicesPerInstance, gpuLightingGridBuilder.numInstances, 0, 0, 0);
+		gfxContext.DrawIndexedInstanced(m_cube.indicesPerInstance, gpuLightingGridBuilder.numInstances, 0, 0, gpuLightingGridBuilder.instanceStart);
 
 		gfxContext.Flush(true);
 	}
@@ -895,10 +1026,10 @@ void LGHRenderer::Render(GraphicsContext& gfxContext, const ViewConfig& viewConf
 
 		gfxContext.TransitionResource(m_runningSumBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 		gfxContext.TransitionResource(m_vplSampleBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[0], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[2], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-		gfxContext.TransitionResource(gpuLightingGridBuilder.InstanceBuffers[3], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[0], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[1], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[2], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		gfxContext.TransitionResource(gpuLightingGridBuilder.GetInstanceBuffers()[3], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 
 		vplManager.CastLGHShadowRays(gfxContext, viewConfig.m_MainViewport.Width, viewConfig.m_MainViewport.Height, m_ShadowRate,
 			gpuLightingGridBuilder.highestLevel + 1, m_DrawLevels == skipVPLs, gpuLightingGridBuilder.baseRadius, m_DevScale, 
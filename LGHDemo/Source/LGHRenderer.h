@@ -63,6 +63,9 @@ public:
 
 	static NumVar m_VPLEmissionLevel;
 
+	static BoolVar m_DiskCache;
+	static BoolVar m_CPUVPLTracing;
+
 	ColorBuffer m_ShadowedStochasticBuffer[3];
 	ColorBuffer m_UnshadowedStochasticBuffer[3];
 
@@ -74,9 +77,15 @@ private:
 	int lastPresetOrderOfMagnitude;
 	int lastMaxDepth;
 
+	// disk cache of the built hierarchy
+	uint64_t sceneHash;
+	bool isLGHLoadedFromCache;
+	bool isLGHCacheWritePending;
+
 	Cube m_cube;
 	Quad m_quad;
 	Model1* m_Model;
+	int m_NumModels;
 	RootSignature m_RootSig;
 	RootSignature m_ComputeRootSig;
 
@@ -141,6 +150,10 @@ private:
 	void InitComputePSOs();
 	void InitPSOs();
 
+	uint64_t GetLGHCacheKey(const Vector3& lightDirection, float lightIntensity);
+	std::string GetLGHCachePath(uint64_t key);
+	bool LoadLGHFromCache(GraphicsContext& context, const Vector3& lightDirection, float lightIntensity);
+
 	void GenerateDiscontinuityBuffer(ComputeContext & cptContext, int scrWidth, int scrHeight);
 
 	void WaveletFiltering(ComputeContext& cptContext, int scrWidth, int scrHeight);
@@ -0,0 +1,80 @@
+#include "LGHTuning.h"
+#include <cstdio>
+#include <iostream>
+
+static bool IsPowerOfTwo(int x, int minValue)
+{
+	return x >= minValue && (x & (x - 1)) == 0;
+}
+
+bool LGHTuningProfile::Load(const std::string& path)
+{
+	schedules.clear();
+	FILE* file = fopen(path.c_str(), "r");
+	if (!file) return false;
+
+	char line[256];
+	for (int lineNumber = 1; fgets(line, sizeof(line), file); lineNumber++)
+	{
+		unsigned long long sceneClass;
+		LGHBuildSchedule schedule;
+		if (sscanf(line, "%llx %d %d %d %d %f", &sceneClass, &schedule.firstHighLevel, &schedule.taskDivRate,
+			&schedule.topTaskDivRate, &schedule.gatherTileSize, &schedule.buildMs) != 6) continue;
+
+		// the task rates cut 2^level S1 vertices into equal tasks, the GPU gather needs at least 4.
+		// gather tiles can have any size, the last tile of an axis takes the remaining cells
+		const char* rejectedKey = nullptr;
+		int rejectedValue = 0;
+		auto check = [&](bool isValid, const char* key, int value)
+		{
+			if (isValid || rejectedKey) return;
+			rejectedKey = key;
+			rejectedValue = value;
+		};
+		check(schedule.firstHighLevel >= 2, "firstHighLevel", schedule.firstHighLevel);
+		check(IsPowerOfTwo(schedule.taskDivRate, 4), "taskDivRate", schedule.taskDivRate);
+		check(IsPowerOfTwo(schedule.topTaskDivRate, 4), "topTaskDivRate", schedule.topTaskDivRate);
+		check(schedule.gatherTileSize >= 1, "gatherTileSize", schedule.gatherTileSize);
+		if (rejectedKey)
+		{
+			std::cout << "LGH tuning profile " << path << ", line " << lineNumber << ": rejected " << rejectedKey << " "
+				<< rejectedValue << std::endl;
+			continue;
+		}
+		schedules[sceneClass] = schedule;
+	}
+	fclose(file);
+	return true;
+}
+
+bool LGHTuningProfile::Save(const std::string& path) const
+{
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "w");
+	if (!file) return false;
+
+	bool ok = true;
+	for (const auto& entry : schedules)
+	{
+		const LGHBuildSchedule& schedule = entry.second;
+		ok = ok && fprintf(file, "%016llx %d %d %d %d %.3f\n", (unsigned long long)entry.first, schedule.firstHighLevel,
+			schedule.taskDivRate, schedule.topTaskDivRate, schedule.gatherTileSize, schedule.buildMs) > 0;
+	}
+
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+	{
+		remove(path.c_str());
+		ok = rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+	if (!ok) remove(tempPath.c_str());
+	return ok;
+}
+
+bool LGHTuningProfile::Find(uint64_t sceneClass, LGHBuildSchedule& schedule) const
+{
+	auto it = schedules.find(sceneClass);
+	if (it == schedules.end()) return false;
+	schedule = it->second;
+	return true;
+}
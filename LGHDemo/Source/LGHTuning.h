@@ -0,0 +1,43 @@
+#pragma once
+#include "LGHCache.h"
+#include <map>
+#include <string>
+
+// LGHBuilder knobs that change how fast a hierarchy is built but not the hierarchy itself
+struct LGHBuildSchedule
+{
+	int firstHighLevel = 5; // GPU from S1: levels from here on are gathered by VertGatherHigh_1/2
+	int taskDivRate = 8; // GPU from S1: taskDivRate^3 threads gather one vertex of a high level
+	int topTaskDivRate = 16; // the same for the highest level
+	int gatherTileSize = 8; // CPU from S1: cells per axis of a tile of the tiled gather
+	float buildMs = 0.f; // measured build time, 0 for the defaults
+};
+
+// Schedules are tuned per scene class: the scene, the number of levels (the VPL order of
+// magnitude) and the build device and source. A scene that was never tuned falls back to the
+// class tuned last on any scene with the same levels, device and source.
+inline uint64_t GetLGHSceneClass(uint64_t sceneHash, int numLevels, int buildDevice, int buildSource)
+{
+	int params[3] = { numLevels, buildDevice, buildSource };
+	return HashValue(params, HashValue(sceneHash, 14695981039346656037ull));
+}
+
+// Text file with one tuned schedule per line:
+// <scene class, hex> firstHighLevel taskDivRate topTaskDivRate gatherTileSize buildMs
+class LGHTuningProfile
+{
+public:
+
+	// a missing file is an empty profile, malformed lines are skipped. Lines with a firstHighLevel below 2,
+	// task rates that are not powers of two from 4 on or a gather tile size below 1 are skipped with a
+	// message naming the key.
+	bool Load(const std::string& path);
+	bool Save(const std::string& path) const;
+
+	bool Find(uint64_t sceneClass, LGHBuildSchedule& schedule) const;
+	void Set(uint64_t sceneClass, const LGHBuildSchedule& schedule) { schedules[sceneClass] = schedule; }
+
+private:
+
+	std::map<uint64_t, LGHBuildSchedule> schedules;
+};
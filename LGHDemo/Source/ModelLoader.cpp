@@ -38,6 +38,7 @@
 #include "GraphicsCore.h"
 #include "DescriptorHeap.h"
 #include "CommandContext.h"
+#include "CPUAlphaCoverage.h"
 #include <iostream>
 
 bool Model1::LoadAssimpModel(const char *filename)
@@ -58,7 +59,7 @@ bool Model1::LoadAssimpModel(const char *filename)
 	for (int meshId = 0; meshId < numMeshes; meshId++)
 	{
 		Mesh mesh;
-		m_pMaterialIsCutout[meshId] = true;
+		m_pMaterialIsCutout[meshId] = IsAssimpMeshCutout(cpuModel.meshes[meshId]);
 		mesh.vertexCount = cpuModel.meshes[meshId].vertices.size();
 		numVerticesTotal += mesh.vertexCount;
 		mesh.vertexDataByteOffset = vertexArray.size() * sizeof(CPUVertex);
@@ -81,6 +82,12 @@ bool Model1::LoadAssimpModel(const char *filename)
 	m_Header.vertexDataByteSize = numVerticesTotal * sizeof(CPUVertex);
 	m_Header.indexDataByteSize = numIndicesTotal * sizeof(unsigned int);
 
+	// kept on the CPU like the demo scene data, for CPU ray tracing
+	m_pVertexData = new unsigned char[m_Header.vertexDataByteSize];
+	m_pIndexData = new unsigned char[m_Header.indexDataByteSize];
+	memcpy(m_pVertexData, vertexArray.data(), m_Header.vertexDataByteSize);
+	memcpy(m_pIndexData, indexArray.data(), m_Header.indexDataByteSize);
+
 	m_Header.boundingBox.min = Vector3(INFINITY, INFINITY, INFINITY);
 	m_Header.boundingBox.max = Vector3(-INFINITY, -INFINITY, -INFINITY);
 	for (int i = 0; i < cpuModel.meshes.size(); i++)
@@ -105,6 +112,26 @@ bool Model1::LoadAssimpModel(const char *filename)
 	return true;
 }
 
+// a mesh only needs the alpha tested (cutout) PSOs when its diffuse alpha can cull part of a triangle
+bool Model1::IsAssimpMeshCutout(const CPUMesh& mesh)
+{
+	const CPUTexture* diffuseTex = nullptr;
+	for (const CPUTexture& tex : mesh.textures)
+	{
+		if (tex.type == "texture_diffuse") diffuseTex = &tex;
+	}
+	if (!diffuseTex || !diffuseTex->data) return false;
+
+	CPUAlphaCoverage coverage;
+	coverage.Build(diffuseTex->width, diffuseTex->height, diffuseTex->nrComponents, diffuseTex->data);
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		if (coverage.Classify(mesh.vertices[mesh.indices[i]].TexCoords, mesh.vertices[mesh.indices[i + 1]].TexCoords,
+			mesh.vertices[mesh.indices[i + 2]].TexCoords) != ALPHA_OPAQUE) return true;
+	}
+	return false;
+}
+
 bool Model1::LoadDemoScene(const char *filename)
 {
 	FILE *file = nullptr;
@@ -235,6 +262,7 @@ void Model1::LoadAssimpTextures(CPUModel& model)
 			
 			const ManagedTexture* temp = TextureManager::LoadFromRawData(tex.path, tex.width, tex.height, tex.data);
 			m_SRVs[materialIdx * 3 + idx] = temp->GetSRV();
+			cpuTexs[materialIdx * 3 + idx] = tex;
 		}
 
 		for (int idx = 0; idx < 3; idx++)
@@ -260,6 +288,7 @@ void Model1::LoadAssimpTextures(CPUModel& model)
 void Model1::LoadTextures()
 {
 	m_SRVs.resize(m_Header.materialCount * 3);
+	m_IsDiffuseSRGB = true;
 
 	const ManagedTexture* MatTextures[3] = {};
 
@@ -310,6 +339,46 @@ void Model1::LoadTextures()
 	m_BlueNoiseSRV[2] = MatTextures[2]->GetSRV();
 }
 
+// the CPU side of TextureManager::LoadFromFile, tries the .dds and then the .tga file. ImageIO reads
+// images bottom-up, the rows are flipped to the top-down order of the GPU texture.
+static bool LoadCPUTextureFile(CPUTexture& texture, const std::string& name)
+{
+	if (name.empty()) return false;
+	for (const char* extension : { ".dds", ".tga" })
+	{
+		FILE* file = nullptr;
+		if (0 != fopen_s(&file, ("Textures/" + name + extension).c_str(), "rb")) continue;
+		fclose(file);
+		texture = CPUTexture(name + extension, "Textures");
+		if (!texture.data) continue;
+
+		size_t rowBytes = (size_t)texture.width * texture.nrComponents;
+		for (int y = 0; y < texture.height / 2; y++)
+		{
+			std::swap_ranges(texture.data + y * rowBytes, texture.data + (y + 1) * rowBytes,
+				texture.data + (texture.height - 1 - y) * rowBytes);
+		}
+		return true;
+	}
+	return false;
+}
+
+void Model1::LoadCPUTextures()
+{
+	if (!cpuTexs.empty()) return;
+	cpuTexs.resize(m_Header.materialCount * 3);
+
+	for (uint32_t materialIdx = 0; materialIdx < m_Header.materialCount; ++materialIdx)
+	{
+		const Material& pMaterial = m_pMaterial[materialIdx];
+		LoadCPUTextureFile(cpuTexs[materialIdx * 3 + DIFFUSETEX], pMaterial.texDiffusePath);
+		if (!LoadCPUTextureFile(cpuTexs[materialIdx * 3 + NORMALTEX], pMaterial.texNormalPath))
+		{
+			LoadCPUTextureFile(cpuTexs[materialIdx * 3 + NORMALTEX], std::string(pMaterial.texDiffusePath) + "_normal");
+		}
+	}
+}
+
 Model1::Model1()
 	: m_pMesh(nullptr)
 	, m_pMaterial(nullptr)
@@ -318,6 +387,7 @@ Model1::Model1()
 	, m_pVertexDataDepth(nullptr)
 	, m_pIndexDataDepth(nullptr)
 	, m_modelMatrix(kIdentity)
+	, m_IsDiffuseSRGB(false)
 {
 	Clear();
 }
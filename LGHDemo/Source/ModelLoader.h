@@ -273,6 +273,20 @@ public:
 
 	D3D12_CPU_DESCRIPTOR_HANDLE m_BlueNoiseSRV[3];
 
+	// the diffuse textures are sampled as sRGB (the demo scene) or as they are (assimp models)
+	bool m_IsDiffuseSRGB;
+
+	// CPU copy of a texture of a material (DIFFUSETEX, SPECULARTEX or NORMALTEX) with its rows in the
+	// order of the GPU texture, nullptr where the default texture is used. Assimp models keep theirs at
+	// load, LoadCPUTextures reads the demo scene's.
+	const CPUTexture* GetCPUTexture(uint32_t materialIdx, int type) const
+	{
+		size_t i = materialIdx * 3 + type;
+		return i < cpuTexs.size() && cpuTexs[i].data ? &cpuTexs[i] : nullptr;
+	}
+
+	void LoadCPUTextures();
+
 protected:
 
 	bool LoadAssimpModel(const char *filename);
@@ -283,6 +297,7 @@ protected:
 	void ComputeAllBoundingBoxes();
 
 	void LoadAssimpTextures(CPUModel& model);
+	static bool IsAssimpMeshCutout(const CPUMesh& mesh);
 	void LoadTextures();
 	std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> m_SRVs;
 	std::vector<CPUTexture> cpuTexs;
@@ -3,10 +3,12 @@
 #include "VPLManager.h"
 #include "ReadbackBuffer.h"
 #include "RaytracingHlslCompat.h"
+#include "LGHBuilder.h"
 
 #include "CommandContext.h"
 #include <D3D12RaytracingHelpers.hpp>
 #include <intsafe.h>
+#include <chrono>
 
 void VPLManager::MergeBoundingSpheres(Vector4& base, Vector4 in)
 {
@@ -106,6 +108,7 @@ void VPLManager::Initialize(Model1* _model, int _numModels, int _maxUpdateFrames
 	InitializeSceneInfo();
 	InitializeViews(*_model);
 	numFramesUpdated = -1;
+	dirtyVPLBegin = dirtyVPLEnd = 0;
 	maxRayRecursion = _maxRayRecursion;
 	maxUpdateFrames = _maxUpdateFrames;
 	BuildAccelerationStructures();
@@ -116,6 +119,8 @@ void VPLManager::Initialize(Model1* _model, int _numModels, int _maxUpdateFrames
 
 void VPLManager::UpdateAccelerationStructure()
 {
+	isCPUSceneMoved = true;
+
 	const UINT numBottomLevels = numModels;
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelAccelerationStructureDesc = {};
 	topLevelAccelerationStructureDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
@@ -953,20 +958,32 @@ void VPLManager::InitializeRaytracingShaderTable()
 	}
 }
 
-bool VPLManager::GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel, const Vector3& lightDirection, float lightIntensity, int maxDepth /*= 3*/, bool hasRegenRequest/*=false*/)
+bool VPLManager::GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel, const Vector3& lightDirection, float lightIntensity, int maxDepth /*= 3*/, bool hasRegenRequest/*=false*/, bool traceOnCPU/*=false*/)
 {
 	ScopedTimer _p0(L"Generate VPLs", context);
 
 	int sqrtDispatchDim = VPLEmissionLevel * 100;
-	if (lightIntensity != lastLightIntensity || lightDirection != lastLightDirection || hasRegenRequest)
+	if (lightIntensity != lastLightIntensity || lightDirection != lastLightDirection || hasRegenRequest || traceOnCPU != lastTraceOnCPU)
 	{
 		if (numFramesUpdated != -1) numFramesUpdated = 0;
 		lastLightIntensity = lightIntensity;
 		lastLightDirection = lightDirection;
+		lastTraceOnCPU = traceOnCPU;
 	}
 
 	if (numFramesUpdated != maxUpdateFrames)
 	{
+		if (traceOnCPU)
+		{
+			// all paths at once, there is no GPU frame to spread them over
+			TraceVPLsOnCPU(context, sqrtDispatchDim, lightDirection, lightIntensity, maxDepth);
+			numFramesUpdated = maxUpdateFrames;
+			return true;
+		}
+
+		// a new set starts over at index 0, later frames append after the VPLs of the previous one
+		dirtyVPLBegin = numFramesUpdated <= 0 ? 0 : dirtyVPLEnd;
+
 		//ScopedTimer _p0(L"LightTracingShader", context);
 		// Prepare constants
 		LightTracingConstants hitShaderConstants = {};
@@ -1039,6 +1056,7 @@ bool VPLManager::GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel,
 		uint32_t* tempNumPaths = (uint32_t*)readbackNumPathsBuffer.Map();
 		numVPLs = numFramesUpdated == maxUpdateFrames ? *tempNumVpls : std::max(numVPLs, *tempNumVpls);
 		numPaths = numFramesUpdated == maxUpdateFrames ? *tempNumPaths : std::max(numPaths, *tempNumPaths);
+		dirtyVPLEnd = *tempNumVpls;
 		readbackNumVplsBuffer.Unmap();
 		readbackNumPathsBuffer.Unmap();
 
@@ -1047,6 +1065,147 @@ bool VPLManager::GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel,
 	return false;
 }
 
+namespace
+{
+	glm::mat4 ToGLMMatrix(const Matrix4& matrix)
+	{
+		glm::mat4 result;
+		for (int c = 0; c < 4; c++)
+		{
+			Vector4 column = c == 0 ? matrix.GetX() : c == 1 ? matrix.GetY() : c == 2 ? matrix.GetZ() : matrix.GetW();
+			result[c] = glm::vec4(column.GetX(), column.GetY(), column.GetZ(), column.GetW());
+		}
+		return result;
+	}
+}
+
+// copy of the meshes of every model with their albedo and textures, one instance per model like the
+// BLASes, the CPU counterpart of the acceleration structures and the hit shader mesh info
+void VPLManager::BuildCPUScene()
+{
+	auto start = std::chrono::steady_clock::now();
+	cpuScene.Clear();
+
+	std::vector<CPUSceneVertex> vertices;
+	std::vector<uint32_t> indices;
+	for (int modelId = 0; modelId < numModels; modelId++)
+	{
+		Model1& model = m_Models[modelId];
+		model.LoadCPUTextures();
+
+		int firstMaterial = (int)cpuScene.materials.size();
+		for (uint32_t i = 0; i < model.m_Header.materialCount; i++)
+		{
+			CPUSceneMaterial material;
+			const Vector3& diffuse = model.m_pMaterial[i].diffuse;
+			material.albedo = glm::vec3(diffuse.GetX(), diffuse.GetY(), diffuse.GetZ());
+			const CPUTexture* diffuseTex = model.GetCPUTexture(i, DIFFUSETEX);
+			if (diffuseTex) material.diffuseTexture = cpuScene.AddTexture(diffuseTex->width, diffuseTex->height,
+				diffuseTex->nrComponents, diffuseTex->data, model.m_IsDiffuseSRGB);
+			const CPUTexture* normalTex = model.GetCPUTexture(i, NORMALTEX);
+			if (normalTex) material.normalTexture = cpuScene.AddTexture(normalTex->width, normalTex->height,
+				normalTex->nrComponents, normalTex->data, false);
+			cpuScene.AddMaterial(material);
+		}
+
+		int instance = cpuScene.AddInstance(ToGLMMatrix(model.m_modelMatrix));
+
+		for (uint32_t meshId = 0; meshId < model.m_Header.meshCount; meshId++)
+		{
+			const Model1::Mesh& mesh = model.m_pMesh[meshId];
+
+			// assimp meshes are CPUVertex arrays whose attrib offsets are not byte offsets
+			bool isCPUVertex = model.indexSize == 4;
+			uint32_t positionOffset = isCPUVertex ? offsetof(CPUVertex, Position) : mesh.attrib[Model1::attrib_position].offset;
+			uint32_t uvOffset = isCPUVertex ? offsetof(CPUVertex, TexCoords) : mesh.attrib[Model1::attrib_texcoord0].offset;
+			uint32_t normalOffset = isCPUVertex ? offsetof(CPUVertex, Normal) : mesh.attrib[Model1::attrib_normal].offset;
+			uint32_t tangentOffset = isCPUVertex ? offsetof(CPUVertex, Tangent) : mesh.attrib[Model1::attrib_tangent].offset;
+			uint32_t bitangentOffset = isCPUVertex ? offsetof(CPUVertex, Bitangent) : mesh.attrib[Model1::attrib_bitangent].offset;
+
+			vertices.resize(mesh.vertexCount);
+			for (uint32_t v = 0; v < mesh.vertexCount; v++)
+			{
+				const unsigned char* vertex = model.m_pVertexData + mesh.vertexDataByteOffset + v * mesh.vertexStride;
+				memcpy(&vertices[v].position, vertex + positionOffset, sizeof(glm::vec3));
+				memcpy(&vertices[v].uv, vertex + uvOffset, sizeof(glm::vec2));
+				memcpy(&vertices[v].normal, vertex + normalOffset, sizeof(glm::vec3));
+				memcpy(&vertices[v].tangent, vertex + tangentOffset, sizeof(glm::vec3));
+				memcpy(&vertices[v].bitangent, vertex + bitangentOffset, sizeof(glm::vec3));
+			}
+
+			indices.resize(mesh.indexCount);
+			const unsigned char* meshIndices = model.m_pIndexData + mesh.indexDataByteOffset;
+			for (uint32_t i = 0; i < mesh.indexCount; i++)
+			{
+				indices[i] = model.indexSize == 2 ? ((const uint16_t*)meshIndices)[i] : ((const uint32_t*)meshIndices)[i];
+			}
+
+			cpuScene.AddMesh(vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size(),
+				firstMaterial + mesh.materialIndex, instance);
+		}
+	}
+
+	cpuScene.Build(GetNumHardwareThreads());
+	if (LGHBuilder::m_VerboseStats)
+		printf("CPU scene: %d triangles (%d alpha tested, %d transparent) in %.1f ms (BVH %.1f ms)\n", cpuScene.NumTriangles(),
+			cpuScene.NumTriangles(ALPHA_MIXED), cpuScene.NumTriangles(ALPHA_TRANSPARENT),
+			std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), cpuScene.buildMs);
+}
+
+void VPLManager::TraceVPLsOnCPU(GraphicsContext& context, int sqrtDispatchDim, const Vector3& lightDirection, float lightIntensity, int maxDepth)
+{
+	if (isCPUSceneDirty)
+	{
+		BuildCPUScene();
+		isCPUSceneDirty = false;
+		isCPUSceneMoved = false;
+	}
+	else if (isCPUSceneMoved)
+	{
+		ScopedTimer _p0(L"CPU scene refit", context);
+		// instances are added per model
+		for (int modelId = 0; modelId < numModels; modelId++) cpuScene.SetInstanceTransform(modelId, ToGLMMatrix(m_Models[modelId].m_modelMatrix));
+		cpuScene.Refit();
+		isCPUSceneMoved = false;
+	}
+
+	CPUVPLTracingParams params;
+	params.sunDirection = -glm::vec3(lightDirection.GetX(), lightDirection.GetY(), lightDirection.GetZ());
+	params.sunColor = glm::vec3(lightIntensity);
+	params.sceneSphere = glm::vec4(sceneBoundingSphere.GetX(), sceneBoundingSphere.GetY(), sceneBoundingSphere.GetZ(), sceneBoundingSphere.GetW());
+	params.sqrtNumPaths = sqrtDispatchDim;
+	params.maxDepth = maxDepth;
+	params.maxVPLs = MAXIMUM_NUM_VPLS;
+	{
+		ScopedTimer _p1(L"CPU light tracing", context);
+		cpuVPLTracer.Trace(cpuScene, params, GetNumHardwareThreads());
+	}
+
+	// recorded work may still read the VPL buffers
+	context.Flush(true);
+	if (cpuVPLTracer.numVPLs > 0)
+	{
+		VPLBuffers[POSITION].Update(0, cpuVPLTracer.numVPLs, cpuVPLTracer.positions.data());
+		VPLBuffers[NORMAL].Update(0, cpuVPLTracer.numVPLs, cpuVPLTracer.normals.data());
+		VPLBuffers[COLOR].Update(0, cpuVPLTracer.numVPLs, cpuVPLTracer.colors.data());
+	}
+	numVPLs = cpuVPLTracer.numVPLs;
+	numPaths = cpuVPLTracer.numPaths;
+	dirtyVPLBegin = 0;
+	dirtyVPLEnd = numVPLs;
+}
+
+void VPLManager::SkipVPLGeneration(UINT _numVPLs, UINT _numPaths, const Vector3& lightDirection, float lightIntensity)
+{
+	numVPLs = _numVPLs;
+	numPaths = _numPaths;
+	dirtyVPLBegin = 0;
+	dirtyVPLEnd = numVPLs;
+	lastLightDirection = lightDirection;
+	lastLightIntensity = lightIntensity;
+	numFramesUpdated = maxUpdateFrames;
+}
+
 // brute force: go through each VPL for all screen pixels
 void VPLManager::ComputeInstantRadiosity(GraphicsContext& context, int scrWidth, int scrHeight, int currentVPL)
 {
@@ -8,6 +8,7 @@
 #include "ShadowHit.h"
 #include "IRRayGen.h"
 #include "LGHShadowRayGen.h"
+#include "CPUVPLTracer.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -65,13 +66,18 @@ public:
 	static const int MAXIMUM_NUM_VPLS = 11000000;
 
 	UINT numVPLs, numPaths;
+	UINT dirtyVPLBegin, dirtyVPLEnd; // VPLs written by the last GenerateVPLs that returned true
 	std::vector<StructuredBuffer> VPLBuffers;
 	unsigned maxRayRecursion;
 	int numFramesUpdated;
 	Vector4 sceneBoundingSphere;
 
 	void Initialize(Model1* _model, int numModels, int _maxUpdateFrames = 1, int _maxRayRecursion = 30);
-	bool GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel, const Vector3& lightDirection, float lightIntensity, int maxDepth = 3, bool hasRegenRequest=false);
+	// traceOnCPU traces the same paths with CPUVPLTracer over a CPU copy of the scene and uploads the VPLs
+	bool GenerateVPLs(GraphicsContext & context, float VPLEmissionLevel, const Vector3& lightDirection, float lightIntensity, int maxDepth = 3, bool hasRegenRequest=false, bool traceOnCPU=false);
+	// marks the VPLs of this light as generated without tracing them, used when the LGH comes from the disk cache
+	void SkipVPLGeneration(UINT _numVPLs, UINT _numPaths, const Vector3& lightDirection, float lightIntensity);
+	bool IsVPLGenerationComplete() const { return numFramesUpdated == maxUpdateFrames; }
 	void ComputeInstantRadiosity(GraphicsContext & context, int scrWidth, int scrHeight, int currentVPL);
 	void CastLGHShadowRays(GraphicsContext & context, int scrWidth, int scrHeight, int shadowRate, int numLevels, 
 		int minLevel, float baseRadius, float devScale, bool temporalRandom, float alpha, int frameId, int interleaveRate = 1);
@@ -113,6 +119,8 @@ private:
 	void InitializeRaytracingStateObjects();
 	void InitializeRaytracingShaderTable();
 	void MergeBoundingSpheres(Vector4& base, Vector4 in);
+	void BuildCPUScene();
+	void TraceVPLsOnCPU(GraphicsContext& context, int sqrtDispatchDim, const Vector3& lightDirection, float lightIntensity, int maxDepth);
 
 	//// Hardware DXR
 	RaytracingAPI m_raytracingAPI;
@@ -179,6 +187,13 @@ private:
 
 	Vector3 lastLightDirection;
 	float lastLightIntensity;
+	bool lastTraceOnCPU = false;
+
+	// CPU light tracing
+	CPUScene cpuScene;
+	CPUVPLTracer cpuVPLTracer;
+	bool isCPUSceneDirty = true;
+	bool isCPUSceneMoved = false; // model transforms changed, the CPU scene only needs a refit
 
 	bool Use16BitIndex;
 };
\ No newline at end of file